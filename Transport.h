@@ -26,9 +26,13 @@ Header for Transport layer protocols TCP, UDP
 #define TCP_TIME_WAIT   (10)
 #define TCP_LAST_ACK    (11)
 
-#define MAX_TCP_ROLES   (2) // Can combine the below to sum to less than total.
-#define TCP_CLIENT      (0) // Used as array coordinates, hence 0,1
-#define TCP_SERVER      (1)
+#ifndef TCP_SERVERS
+#define TCP_SERVERS     (1) // Pool of server TCBs : concurrent connections to our server
+#endif
+#define MAX_TCP_ROLES   (1+TCP_SERVERS) // Can combine the below to sum to less than total.
+#define TCP_CLIENT      (0) // Used as array coordinates, hence 0,1..
+#define TCP_SERVER      (1) // First of the pool : server roles are TCP_SERVER..MAX_TCP_ROLES-1
+#define IS_SERVER_ROLE(R) ((R)>=TCP_SERVER && (R)<MAX_TCP_ROLES)
 #define TCP_FTP_CLIENT  (0) // TODO : currently duplicates above - so use one at time
 #define TCP_FTP_PASSIVE (1)
 
@@ -69,6 +73,9 @@ typedef struct { // TCP header : 20 bytes
 } TCP_header;
 
 #define TCP_HEADER_SIZE (20)
+#define TCP_FRAME_ACK      (ETH_HEADER_SIZE+IP_HEADER_SIZE+8)  // In a frame we send
+#define TCP_FRAME_WINDOW   (ETH_HEADER_SIZE+IP_HEADER_SIZE+14)  // Then the checksum
+#define TCP_FRAME_CHECKSUM (ETH_HEADER_SIZE+IP_HEADER_SIZE+16)
 
 #define MAX_RETX    (10)  // TCP Packets to keep ready to re transmit
 
@@ -76,16 +83,31 @@ typedef struct { // Details of TCP packet needed for possible Re-transmission
   uint8_t     role;
   unsigned    active      :2;
   unsigned    retries     :6;
-  uint8_t     timeout;
+  uint16_t    due;       // TCP clock (ms) when to resend
+  uint16_t    sentAt;    // TCP clock (ms) when first sent : RTT (Karn : if never resent)
+  uint8_t     kept;      // Either the frame, kept in the link layer (linkKeepSent()) ...
+  uint16_t    (* callback)(uint16_t start,uint16_t length,uint8_t * result); // ... or a callback to make it.
+  uint8_t     flags;     // As sent
   uint16_t    payloadLength;  
-  uint16_t    headerLength;
   int32_t     lastByte;
-  uint8_t     * data;   // Either the packet data ... or a callback to make it.
-  uint16_t    (* callback)(uint16_t start,uint16_t length,uint8_t * result);
   int32_t     sequence;  // Only needed for callback : the sequence no of start of TCP stream
   uint16_t    start;     // Only needed for callback : the offset for the callback
+  uint16_t    checksum;  // As sent, but for an ack and a window of 0
 } Retransmit;
 
+#define TCP_QUEUE   (2*MAX_TCP_ROLES)  // Callback data queued to send, at most : e.g. a
+                                       // preamble and body for each connection
+
+typedef struct { // Data a callback makes, queued until the windows let it go (pumpTCP())
+  uint8_t     role;
+  unsigned    active      :1;
+  unsigned    reTx        :1;
+  uint16_t    (* callback)(uint16_t start,uint16_t length,uint8_t * result);
+  uint16_t    offset;    // For the callback, of its first byte
+  uint16_t    length;
+  int32_t     sequence;  // Of its first byte, in the TCP stream
+} Queued;
+
 typedef struct { // TCP Transmission Control Block (TCB)
   unsigned     status          :4;  // State machine
   unsigned     age             :4;  // countdown
@@ -96,12 +118,36 @@ typedef struct { // TCP Transmission Control Block (TCB)
 // int32_t     lastAckSent;
   int32_t      lastByteReceived;
   int32_t      lastAckReceived;
-  uint16_t     windowSize;
+  uint16_t     windowSize;  // The peer's receive window, as last advertised
+  uint16_t     cwnd;       // Congestion window (RFC 5681) : with the above, limits what's in flight
+  uint16_t     ssthresh;   // Slow start while cwnd is below this
+  uint16_t     mss;        // Our segments' largest payload : the peer's MSS, <=MAX_PAYLOAD
+  uint8_t      finQueued;  // TCP_FIN() to follow the data still queued
+  uint8_t      ackOwed;    // Segments received that no segment of ours has ACK'd yet
+  uint16_t     ackDue;     // When a bare ACK goes for them, if nothing else has (ms)
+  int32_t      windowEdge; // Just beyond the window we last advertised
+  uint16_t     srtt;       // Smoothed round trip time, ms<<3.  0 until measured
+  uint16_t     rttvar;     // Its mean deviation, ms<<2
+  uint16_t     rto;        // Retransmission timeout, ms
+  uint16_t     probeDue;   // When the next zero window probe goes (ms), while probing
+  uint8_t      probes;     // Sent since the peer's window shut, as the backoff.  0 : not probing
+  uint8_t      unanswered; // ... of them since the peer last ACK'd : beyond TCP_RETRIES, gone
 } TCP_TCB;
  
 #define TCP_MAX_AGE   (5)  // Unused connection will timeout after this many s.
-#define TCP_TIMEOUT   (1)  // seconds before retransmit, then BEB
-#define TCP_RETRIES   (3)  // Timeout * 2^Retries should be < 64.
+#define TCP_RTO_INITIAL (1000)  // ms before retransmit, until the RTT is measured (RFC 6298)
+#define TCP_RTO_MIN     (100)   // ms : floor.  Spans a few ticks, and peers' delayed ACKs
+#define TCP_RTO_MAX     (16000) // ms : ceiling, backoff included.  <32768 (16 bit clock)
+#define TCP_RTT_MAX     (4000)  // ms : longer RTT samples are taken as this
+#define TCP_ACK_DELAY   (100)   // ms an ACK may wait for data to carry it (RFC 1122 : <500)
+#define TCP_ACK_SEGMENTS (2)    // ... and segments : every second one is ACK'd at once
+#define TCP_RETRIES   (3)  // Resends, each after twice the wait of the last, before giving up
+#define MAX_PAYLOAD   (1460)  // <=1460 for Ethernet for TCP
+#define TCP_MSS_DEFAULT (536) // The peer's MSS if its SYN gives none (RFC 1122)
+#define TCP_MSS_MIN     (64)  // Smaller MSS offered are taken as this
+#define TCP_CWND_SEGMENTS (3) // Initial congestion window, in segments (RFC 5681)
+#define TCP_COOKIE_SLOT (13)  // SYN cookies are made in slots of 2^this ms, and
+                              // good for that and the next : 8-16s
 
 typedef struct  {  // Headers only.  Enough to ACK a TCP
   Ethernet_header Ethernet;
@@ -118,23 +164,53 @@ typedef struct  {  // Headers only.  Enough to ACK a TCP
 #include "application.h"
 
 #define MAX_PACKET_PAYLOAD (MAX_PACKET_SIZE-IP_HEADER_SIZE-TCP_HEADER_SIZE-ETH_HEADER_SIZE)
+#ifdef USE_TCP_REORDER
+#define TCP_WINDOW (REORDER_SIZE)       // We advertise : what reorder.c can hold ahead
+#else
+#define TCP_WINDOW (MAX_PACKET_PAYLOAD) // We advertise : segments are taken only in order
+#endif
+#define TCP_WINDOW_STEP ((MAX_PACKET_PAYLOAD<TCP_WINDOW/2)?MAX_PACKET_PAYLOAD:TCP_WINDOW/2)
+              // Our window's edge moves on by at least this, or not at all (RFC 1122 SWS)
+#define TCP_RX_FRAME (RX_FRAME_OVERHEAD+ETH_HEADER_SIZE+IP_HEADER_SIZE+TCP_HEADER_SIZE+\
+                      MAX_PACKET_PAYLOAD)  // A full sized segment, as it lies in the RX ring
+#define TCP_RX_RING ((ERXND-ERXST)/TCP_RX_FRAME*MAX_PACKET_PAYLOAD) // ... those an empty one holds
+#define TCP_WINDOW_SYN ((TCP_RX_RING<TCP_WINDOW)?TCP_RX_RING:TCP_WINDOW) // Offered with a SYN
+
+#define UDP_BINDINGS  (8)  // Ports with a handler, at most.  Power of 2 (hashed)
+#define UDP_ANY_PORT  (0)  // udpBind() : handler for datagrams to no bound port
+
+typedef void (* UDP_handler)(MergedPacket * Mash,uint8_t flags);  // Host order, 
+                                                   // flags as from linkPacketHeader()
+typedef struct {
+  uint16_t     port;      // Host order.  0 : slot free
+  UDP_handler  handler;
+} UDP_binding;
 
 // Global functions
 void initialiseTCP(void);
-void countdownTCP(void);
+void tickTCP(void);
 void retxTCP(void);
+void pumpTCP(void);
+uint8_t ActiveReTx(uint8_t role);
 void cleanupOldTCP();
 void initiateTCPConnection(MergedPacket * Mash, uint16_t source_port,
                                 uint16_t destination_port, IP4_address ToIP, uint8_t role);
+void initiate_TCP_connection(MergedPacket * Mash,uint16_t sourcePort,
+                   uint16_t destinationPort,IP4_address ToIP,uint8_t role);
+void TCP_FIN(MergedPacket * Mash,uint8_t role);
 void TCP_SimpleDataOut(const char * send,const uint8_t role,uint8_t reTx);
 void TCP_SimpleDataOutProgmem(const char * send,const uint8_t role,uint8_t reTx);
 void TCP_DataIn(MergedPacket * Mash, const uint16_t length, const uint8_t role);
-void TCP_ComplexDataOut(MergedPacket * Mash, const uint8_t role, const uint16_t payloadLength,
+uint8_t TCP_ComplexDataOut(MergedPacket * Mash, const uint8_t role, const uint16_t payloadLength,
       uint16_t (* callback)(uint16_t start,uint16_t length,uint8_t * result),uint16_t offset,
 	    uint8_t reTx);
 
 void handleTCP(MergedPacket * Mash);
 void handleUDP(MergedPacket * Mash, uint8_t flags);
+uint8_t TCP_Wanted(uint16_t destinationPort);
+uint8_t UDP_Wanted(uint16_t destinationPort,uint16_t sourcePort);
+uint8_t udpBind(uint16_t port,UDP_handler handler);
+void udpUnbind(uint16_t port);
 void launchUDP(MergedPacket * Mash, IP4_address * ToIP,uint16_t sourcePort, uint16_t destinationPort, 
    uint16_t data_length,void (* callback)(uint16_t start,uint16_t length,uint8_t * result),uint16_t offset);
 uint16_t newPort(uint8_t protocol);
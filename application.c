@@ -81,7 +81,6 @@ extern IP4_address FTP_IP;
 extern MAC_address myMAC;
 extern uint8_t DHCP_lease[4];
 extern TCP_TCB TCB[MAX_TCP_ROLES]; 
-extern uint16_t UDP_Port[MAX_UDP_PORTS];
 extern MergedPacket MashE;
 extern uint8_t fuseL,fuseH,fuseE;
 
@@ -658,15 +657,16 @@ uint8_t ringBufferCompare(uint8_t ptr,const char * c1,uint8_t len) {  // Respect
   return FALSE;
 }
 // ----------------------------------------------------------------------------------
-void resetHTTPServer(void) 
-{ // On SYN on server, make sure params are clear
+void resetHTTPServer(uint8_t role) 
+{ // On SYN on server, make sure params are clear.  They are shared : one server
+  // TCB (TCP_SERVERS) is assumed by POST handling.
 POSTflags=0;
 bufferPtr=0;
 bytesInPOST=0;
 bdryLength=0;
 }
 // ----------------------------------------------------------------------------------
-void sendHTML(/*const*/ MergedPacket * Mash, uint16_t newData)
+void sendHTML(/*const*/ MergedPacket * Mash, uint16_t newData, uint8_t role)
 { // Routine called sendHTML because we are server.  So if we are asked to do something in HTTP it will
   // be to reply (serve).  But we may not receive enough in
   // a given packet to go ahead and send, especially with POST.  But we will have ACK'd.
@@ -786,8 +786,8 @@ if (POSTflags) { // We are reading a POST
 		  }		
  		  ISPquiescent();
 		  uploadTo&=(~EEPROM_UPLOAD);
-		  if (valid) { HTTP_WITH_PREAMBLE(TCP_SERVER,UploadSuccess); }
-		  else  	 { HTTP_WITH_PREAMBLE(TCP_SERVER,UploadFailure); }
+		  if (valid) { HTTP_WITH_PREAMBLE(role,UploadSuccess); }
+		  else  	 { HTTP_WITH_PREAMBLE(role,UploadFailure); }
 		}
 		
 		if (uploadTo & FLASH_UPLOAD) { 
@@ -816,8 +816,8 @@ if (POSTflags) { // We are reading a POST
 		  }
   		  ISPquiescent();
 		  uploadTo&=(~FLASH_UPLOAD);
-		  if (valid) { HTTP_WITH_PREAMBLE(TCP_SERVER,UploadSuccess); }
-		  else  	 { HTTP_WITH_PREAMBLE(TCP_SERVER,UploadFailure); }
+		  if (valid) { HTTP_WITH_PREAMBLE(role,UploadSuccess); }
+		  else  	 { HTTP_WITH_PREAMBLE(role,UploadFailure); }
 
         }
 
@@ -925,13 +925,13 @@ if (POSTflags) { // We are reading a POST
         ris=((Mash->TCP_payload.chars[i+10]-'0')*10+(Mash->TCP_payload.chars[i+11]-'0'))%12; 
         fis=((Mash->TCP_payload.chars[i+14]-'0')*10+(Mash->TCP_payload.chars[i+15]-'0'))%12; 
         if (lastMode==MODE_LAN) lastMode=MODE_OFF;  // Force a refresh
-        TCP_SimpleDataOut(PSTR("HTTP/1.1 200 OK\r\nCache-control: no-cache,no-store\r\nConnection: close\r\nContent-Length: 1412\r\n\r\n"),TCP_SERVER);
-        TCP_ComplexDataOut(&MashE,TCP_SERVER,0,OVERSIZE_WHERE); // Oversize method (uses gis,ris, which may have just changed)
+        TCP_SimpleDataOut(PSTR("HTTP/1.1 200 OK\r\nCache-control: no-cache,no-store\r\nConnection: close\r\nContent-Length: 1412\r\n\r\n"),role);
+        TCP_ComplexDataOut(&MashE,role,0,OVERSIZE_WHERE); // Oversize method (uses gis,ris, which may have just changed)
         break;
       }
     }
   } else
-    TCP_SimpleDataOut(PSTR("HTTP/1.1 404 Not Found\r\nConnection: close\r\n\r\n<html><head><title>404 Not Found</title></head><body><h1>Not found</h1></body></html>"),TCP_SERVER,FALSE);
+    TCP_SimpleDataOut(PSTR("HTTP/1.1 404 Not Found\r\nConnection: close\r\n\r\n<html><head><title>404 Not Found</title></head><body><h1>Not found</h1></body></html>"),role,FALSE);
 */
 #define ICON_BYTES (0x2868)
 
@@ -986,21 +986,21 @@ SHA256Final(&context);
       //AuthorisedSHA256(Mash->TCP_payload.chars,cnonce,response);
     }
   }
-//send401Unauthorised(); 
+//send401Unauthorised(role); 
 
 //  if ((length >= 15 && !caseFreeCompare("favicon.ico",&Mash->HTTP[5],11)) ||
 //      (length >= 12 && !caseFreeCompare("icon.ico",&Mash->HTTP[5],8)))
   if ((length >= 15 && !caseFreeCompare("favicon.ico",&Mash->TCP_payload.chars[5],11)) ||
       (length >= 12 && !caseFreeCompare("icon.ico",&Mash->TCP_payload.chars[5],8)))
   {
-    HTTP_WITH_PREAMBLE_CACHE(TCP_SERVER,ISPbitmap);
+    HTTP_WITH_PREAMBLE_CACHE(role,ISPbitmap);
   }
   //else if (length >= 12 && !caseFreeCompare(PSTR("isp0.png"),&Mash->TCP_payload.chars[5],8)) // PSTR doesn't work
 #ifdef NET_PROG
   //else if (length >= 12 && !caseFreeCompare("isp9.bmp",&Mash->HTTP[5],8))
   else if (length >= 12 && !caseFreeCompare("isp9.bmp",&Mash->TCP_payload.chars[5],8))
   {
-    HTTP_WITH_PREAMBLE_CACHE(TCP_SERVER,ISPbitmap);
+    HTTP_WITH_PREAMBLE_CACHE(role,ISPbitmap);
   }
 #endif
   else if (Mash->TCP_payload.bytes[4]=='/') {  
@@ -1014,11 +1014,11 @@ SHA256Final(&context);
 #ifdef WHEREABOUTS
 #define TOTAL_DATA (HEAD_LEN+3*12*(ITEM_LEN+ROWEND_LEN)+TAIL_LEN)
         expectLen=TOTAL_DATA; // Tells preamble data the upcoming packet size
-        TCP_ComplexDataOut(&MashE,TCP_SERVER,PreambleData(0,0,&dummy),&PreambleData,0,TRUE);
-        TCP_ComplexDataOut(&MashE,TCP_SERVER,totalData,&WhereaboutsData,offset,TRUE);  
+        TCP_ComplexDataOut(&MashE,role,PreambleData(0,0,&dummy),&PreambleData,0,TRUE);
+        TCP_ComplexDataOut(&MashE,role,totalData,&WhereaboutsData,offset,TRUE);  
 #endif
 #ifdef HOUSE
-        HTTP_WITH_PREAMBLE(TCP_SERVER,HouseData);
+        HTTP_WITH_PREAMBLE(role,HouseData);
 #endif
 #ifdef NET_PROG
 
@@ -1054,42 +1054,42 @@ SHA256Final(&context);
         }
         if (chipData.vendor==ISP_UNKNOWN) strcpy(chipData.name,"*UNKNOWN* ");
             ISPquiescent();          
-            HTTP_WITH_PREAMBLE(TCP_SERVER,ProgData);      
+            HTTP_WITH_PREAMBLE(role,ProgData);      
       } else if (!caseFreeCompare("eeprom.html",&Mash->TCP_payload.chars[5],11)) {
 #ifdef SOURCE_RAM
       ISP_EEPROMDataToRAM();
 #endif
-      HTTP_WITH_PREAMBLE(TCP_SERVER,EEPROMData);
+      HTTP_WITH_PREAMBLE(role,EEPROMData);
     } else if (!caseFreeCompare("eeprom_p.html",&Mash->TCP_payload.chars[5],13)) {
 #ifdef SOURCE_RAM
       ISP_EEPROMDataToRAM();
 #endif
-      HTTP_WITH_PREAMBLE(TCP_SERVER,EEPROMDataP);
+      HTTP_WITH_PREAMBLE(role,EEPROMDataP);
     } else if (!caseFreeCompare("flash.html",&Mash->TCP_payload.chars[5],10)) {
 #ifdef SOURCE_RAM
       ISP_FLASHDataToRAM();
 #endif
-      HTTP_WITH_PREAMBLE(TCP_SERVER,FlashData);
+      HTTP_WITH_PREAMBLE(role,FlashData);
     } else if (!caseFreeCompare("erase",&Mash->TCP_payload.chars[5],5)) { // TODO add confirm window
 	
       if (!caseFreeCompare(".html",&Mash->TCP_payload.chars[10],5)) { // Ask to confirm
     
         cfmnonce=Rnd8bit(); // Nonce
-        HTTP_WITH_PREAMBLE(TCP_SERVER,EraseCfm);
+        HTTP_WITH_PREAMBLE(role,EraseCfm);
     
       } else if (Mash->TCP_payload.bytes[10]==hex[cfmnonce>>4] && 
                  Mash->TCP_payload.bytes[11]==hex[cfmnonce&0xF]) { 
         ISPactivate();
         ISPchipErase();
         ISPquiescent();
-        HTTP_WITH_PREAMBLE(TCP_SERVER,EraseData);
+        HTTP_WITH_PREAMBLE(role,EraseData);
         cfmnonce++; // won't repeat
       }
     }
 #endif 
-    else { SEND_404; }
+    else { SEND_404(role); }
   } 
-  else { SEND_404; }
+  else { SEND_404(role); }
 }
 #endif
 }
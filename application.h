@@ -189,15 +189,11 @@ typedef struct {      // DHCP_option
   }; 
 } DHCP_option;
  
-#define MAX_UDP_PORTS  (3)  // Using 3 so far
-
 #define DHCP_CLIENT_PORT   (0x44)   // 68 Dec
 #define DHCP_SERVER_PORT   (0x43)   // 67 Dec
 
-#define DNS_CLIENT_PORT_REF   (0)   // _REF are array references  
 #define DNS_SERVER_PORT    (0x35)
 
-#define NTP_CLIENT_PORT_REF   (1)  
 #define NTP_SERVER_PORT    (0x7B)
 #define NTP_ID  (7729) // For DNS identification
 
@@ -266,7 +262,7 @@ typedef struct {  // Merges all structures.
                                 TCP_ComplexDataOut(&MashE,(X),expectLen,&FN,0,TRUE);})
 
 
-#define SEND_404 ({HTTP_RAW(TCP_SERVER,HTTP_404);TCP_FIN(Mash,TCP_SERVER);})
+#define SEND_404(X) ({HTTP_RAW((X),HTTP_404);TCP_FIN(Mash,(X));})
 
 
 // Function prototypes
@@ -274,8 +270,8 @@ uint8_t genericUDPTo(uint16_t words[],uint16_t length,IP4_address * sendIP);
 uint8_t genericUDP(uint16_t words[],uint16_t length);
 uint8_t genericUDPBcast(uint16_t words[],uint16_t length);
 
-void resetHTTPServer();
-void sendHTML(MergedPacket * Mash, uint16_t length);
+void resetHTTPServer(uint8_t role);
+void sendHTML(MergedPacket * Mash, uint16_t length, uint8_t role);
 void parseHTML(MergedPacket * Mash, uint16_t length);
 void GET_HTTP(void);
 void initiate_POP3(void);
@@ -300,6 +296,7 @@ uint16_t prepDHCP(DHCP_message *, uint8_t type);
 void initiateDHCP(void);
 void requestDHCP(void);
 void handleDHCP(DHCP_message * DHCP);
+void bindCoreUDP(void);
 void handleFTP(MergedPacket * Mash, const uint16_t length);
 void FTPUpdate(void);
 uint8_t queueForFTP(uint8_t command,char * filename, char * data);
@@ -70,7 +70,6 @@ extern IP4_address FTP_IP;
 extern MAC_address myMAC;
 extern uint8_t DHCP_lease[4];
 extern TCP_TCB TCB[MAX_TCP_ROLES]; 
-extern uint16_t UDP_Port[MAX_UDP_PORTS];
 extern MergedPacket MashE;
 
 #ifdef AUTH7616
@@ -97,6 +96,13 @@ uint8_t iPOP3_Connect;
 extern IP4_address mDNS_IP4; 
 #endif
 
+#ifdef USE_NTP
+static uint16_t NTPport;  // Our end of the latest query (bound)
+#endif
+#ifdef USE_DNS
+static uint16_t DNSport;  // Ditto
+#endif
+
 // ----------------------------------------------------------------------------------
 #ifdef USE_HTTP
 uint16_t HTTP_404(uint16_t start,uint16_t length,uint8_t * result) {
@@ -129,7 +135,7 @@ uint16_t UnauthorisedData(uint16_t start,uint16_t length,uint8_t * result) {
   return sizeof(text);
 }
 // ----------------------------------------------------------------------------------
-void send401Unauthorised(void) {
+void send401Unauthorised(uint8_t role) {
   if (!(nonce[0]|nonce[1]|nonce[2]|nonce[3])) {
     nonce[0]=nextLFSR();
     nonce[1]=nextLFSR();
@@ -143,7 +149,7 @@ void send401Unauthorised(void) {
     shuffleTimeLFSR();  // Ensure the LFSR internal state changes now it's been shown
     opaque[3]=nextLFSR();
   }
-  TCP_ComplexDataOut(&MashE,TCP_SERVER,UnauthorisedData(0,0,&dummy),&UnauthorisedData,0,TRUE);
+  TCP_ComplexDataOut(&MashE,role,UnauthorisedData(0,0,&dummy),&UnauthorisedData,0,TRUE);
 }
 #endif
 #endif
@@ -444,6 +450,11 @@ minute=tad.minute;
 MyState.TIME=TIME_SET;
 }
 // ---------------------------------------------------------------------------------------
+static void udpNTP(MergedPacket * Mash,uint8_t flags)
+{ // Bound to NTPport
+if (Mash->UDP.sourcePort==NTP_SERVER_PORT) handleNTP(&Mash->NTP);  
+}
+// ---------------------------------------------------------------------------------------
 void queryNTP(void)
 { // EITHER launches a NTP packet asking the time; OR, if the NTP IP address is not set,
   // launches a DNS packet to set the NTP IP address. 
@@ -485,10 +496,11 @@ MashE.NTP.rx_stamp_fract=0;
 MashE.NTP.tx_stamp_int=0;
 MashE.NTP.tx_stamp_fract=0;
 
-UDP_Port[NTP_CLIENT_PORT_REF]=newPort(UDP_PORT);
+if (NTPport) udpUnbind(NTPport);  // Any answer to an older query is too late
+NTPport=newPort(UDP_PORT);
+udpBind(NTPport,udpNTP);
 
-launchUDP(&MashE,&NTPIP,UDP_Port[NTP_CLIENT_PORT_REF],
-                 NTP_SERVER_PORT,(sizeof(MashE.NTP)),NULL,0);
+launchUDP(&MashE,&NTPIP,NTPport,NTP_SERVER_PORT,(sizeof(MashE.NTP)),NULL,0);
 
 MyState.TIME=TIME_REQUESTED;
 
@@ -541,6 +553,11 @@ while (TRUE)
   i+=(Message[i]+1);  // Move along by the index (plus the index byte itself)
 }
 
+}
+// ---------------------------------------------------------------------------------------
+static void udpDNS(MergedPacket * Mash,uint8_t flags)
+{ // Bound to DNSport
+if (Mash->UDP.sourcePort==DNS_SERVER_PORT) handleDNS(&Mash->DNS);  
 }
 // ---------------------------------------------------------------------------------------
 void handleDNS(DNS_message * DNS)
@@ -657,13 +674,21 @@ Mash->DNS.message[3+len]=1;
 Mash->DNS.message[4+len]=0;  // Internet
 Mash->DNS.message[5+len]=1;
 
-UDP_Port[DNS_CLIENT_PORT_REF]=newPort(UDP_PORT);
+if (DNSport) udpUnbind(DNSport);
+DNSport=newPort(UDP_PORT);
+udpBind(DNSport,udpDNS);
 
-launchUDP(Mash,&DNSIP,UDP_Port[DNS_CLIENT_PORT_REF],DNS_SERVER_PORT,(18+len),NULL,0);
+launchUDP(Mash,&DNSIP,DNSport,DNS_SERVER_PORT,(18+len),NULL,0);
 }
 #endif
 #ifdef USE_LLMNR
 // ---------------------------------------------------------------------------------------
+static void udpLLMNR(MergedPacket * Mash,uint8_t flags)
+{ // Bound to LLMNR_PORT : check MAC and IP match
+if (MACForUs(&Mash->Ethernet.destinationMAC)==LLMNR_MULTICAST &&
+    LLMNR(&Mash->IP4.destination)) handleLLMNR(Mash);  
+}
+// ---------------------------------------------------------------------------------------
 void handleLLMNR(MergedPacket * Mash)
 { // Handle a received LLMNR query
 
@@ -725,6 +750,13 @@ return;
 #endif
 // ---------------------------------------------------------------------------------------
 #ifdef USE_mDNS
+static void udpMDNS(MergedPacket * Mash,uint8_t flags)
+{ // Bound to mDNS_PORT : check port, MAC and IP match ??? Or allow unicast 
+if (Mash->UDP.sourcePort==mDNS_PORT && 
+    MACForUs(&Mash->Ethernet.destinationMAC)==mDNS_MULTICAST &&
+    mDNS(&Mash->IP4.destination)) handleMDNS(Mash);  
+}
+// ---------------------------------------------------------------------------------------
 void handleMDNS(MergedPacket * Mash)
 { // Handle a received mDNS message
 
@@ -1005,6 +1037,12 @@ default:  // Something we don't handle
 }
 }
 // ----------------------------------------------------------------------------
+static void udpDHCP(MergedPacket * Mash,uint8_t flags)
+{ // Bound to DHCP_CLIENT_PORT.  The link layer has checked the server port
+  // and magic cookie (CS_DHCP), and set the read pointer to the options.
+if (flags & CS_DHCP) handleDHCP(&Mash->DHCP);  
+}
+// ----------------------------------------------------------------------------
 void handleDHCP(DHCP_message * DHCP)
 { // Handle a received DHCP message
 uint8_t DHCP_type;
@@ -1048,6 +1086,20 @@ subnetBroadcastIP=((~subnetMask)|myIP);
 }
 #endif // End of DHCP
 // ----------------------------------------------------------------------------
+void bindCoreUDP(void)
+{ // Binds the fixed ports of the services config.h asks for.  Clients (NTP,
+  // DNS) bind a new port for each query.  Applications bind their own.
+#ifdef USE_DHCP
+udpBind(DHCP_CLIENT_PORT,udpDHCP);
+#endif
+#ifdef USE_mDNS
+udpBind(mDNS_PORT,udpMDNS);
+#endif
+#ifdef USE_LLMNR
+udpBind(LLMNR_PORT,udpLLMNR);
+#endif
+}
+// ----------------------------------------------------------------------------
 uint16_t PreambleData(uint16_t start,uint16_t length,uint8_t * result) {
 // TCP preamble.  Important bit is auto-insertion of content length
 const static char head[] PROGMEM={"HTTP/1.1 200 OK\r\nConnection: close\r\nCache-control: no-cache,no-store\r\nContent-Length: "};
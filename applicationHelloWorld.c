@@ -40,29 +40,24 @@ extern uint8_t dummy;
 uint16_t expectLen;  // Special use - passing param to callback
 uint8_t progress;    // Special use - passing param to callback
 
-#ifdef HELLO_HTTP_WORLD
+#if defined HELLO_HTTP_WORLD || defined HOST_MODEL
 
 // ----------------------------------------------------------------------------------
 #ifdef USE_HTTP
 // ----------------------------------------------------------------------------------
-void resetHTTPServer(void) { // On SYN on server, don any cleanup
+void resetHTTPServer(uint8_t role) { // On SYN on server 'role', don any cleanup
 }
 // ----------------------------------------------------------------------------------
-void sendHTML(/*const*/ MergedPacket * Mash, uint16_t newData)
+void sendHTML(/*const*/ MergedPacket * Mash, uint16_t newData, uint8_t role)
 { // Routine called sendHTML because we are server.  So if we are asked to do something in HTTP it will
   // be to reply (serve).  But we may not receive enough in
   // a given packet to go ahead and send, especially with POST.  But we will have ACK'd.
 
-uint8_t authorisedPkt=TRUE;  // No auth, implies all packets are OK
-
 if (!newData) return;  // Just an ACK
 
 // We have a TCP packet with a certain payload length
 // only the last 'newData' bytes have not been seen before (usually this will be whole payload)
-uint16_t length=Mash->IP4.totalLength-(Mash->IP4.headerLength+Mash->TCP.headerLength)*4;
 
-uint16_t offset=length-newData;  // Position of first new data byte
-  
 if (!strncmp("GET ",Mash->TCP_payload.chars,4)) { // It's a GET 
 
   if (Mash->TCP_payload.bytes[4]=='/') {  
@@ -71,12 +66,12 @@ if (!strncmp("GET ",Mash->TCP_payload.chars,4)) { // It's a GET
         !caseFreeCompare("index.html",&Mash->TCP_payload.chars[5],10)) {
       // Plain GET or GET/index.html 
       // Assume is it also possible to have "GET /\r\n" if there is no other header data.
-      TCP_SimpleDataOutProgmem(PSTR("HTTP/1.1 200 OK\r\nConnection: keep-alive\r\n\r\n<html><head><title>Hello world</title></head><body><h1>Hello World</h1></body></html>\n"),TCP_SERVER,FALSE);
-      TCP_FIN(Mash,TCP_SERVER);
+      TCP_SimpleDataOutProgmem(PSTR("HTTP/1.1 200 OK\r\nConnection: keep-alive\r\n\r\n<html><head><title>Hello world</title></head><body><h1>Hello World</h1></body></html>\n"),role,TRUE);
+      TCP_FIN(Mash,role);
     } 
-    else { SEND_404; }
+    else { SEND_404(role); }
   }
-  else { SEND_404; }
+  else { SEND_404(role); }
 } 
 }
 #endif
@@ -11,7 +11,9 @@
 // ----------- User settable ------ ONE only
 
 //#define HELLO_HTTP_WORLD    // Minimal configuration for webserver
+#ifndef HOST_MODEL        // Host build ('make host') brings its own, see below
 #define POWER_METER       // Set if hardware is the Clamp Meter
+#endif
 //#define NETWORK_CONSOLE   // Hardware is console box
 //#define MSF_CLOCK         // When wired as a MSF clock on a Tuxgraphics board
 //#define NET_PROG          // When a network programmer
@@ -24,6 +26,7 @@
 //#define DEBUGGER      // Mainly removes LCD commands
 //#define REGRESS       // Perform regression tests
 //#define STATS          // Record statistics
+//#define CSUM_ASM      // Hand scheduled checksum kernel (AVR) : run REGRESS to check it
 
 
 #define MSG_LENGTH  (68)  // Save space by using same char everywhere
@@ -63,6 +66,7 @@
 //#define USE_DNS          
 //#define USE_NTP          
   #define IMPLEMENT_PING      // Useful unless space critical
+  #define SEND_FRAGMENTS      // UDP bigger than a frame (long waveforms) as IP fragments
 
   #define MAC_0  (LOCAL_ADMIN | 0)
   #define MAC_1  (0x01)
@@ -71,8 +75,10 @@
   #define MAC_4  (0x07)
   #define MAC_5  (0x09)
 
-  #define MAX_TIME_SAMPLES (188) // Number of points to transmit (NB = 16 bits each)
+  #define MAX_TIME_SAMPLES (188) // Number of points to transmit (NB = 16 bits each).
+                                 // Kept in the ENC28J60; may exceed a frame (SEND_FRAGMENTS)
   #define CYCLE   (188)  // integer number of cycles of 50Hz - N.B. f'n of clock etc
+  #define STORE_SPACE (2*(1+MAX_TIME_SAMPLES))  // ENC28J60 memory the capture is kept in
 
 #endif
 
@@ -325,6 +331,10 @@
 #define ETH_SPI_SEL_DDR        (DDRB)
 #define ETH_SPI_SEL_CS         (2)   
 
+// If the ENC28J60 INT pin is wired to INT0 (PD2), the chip need only be read when
+// it signals, rather than polled on every pass of the main loop.
+//#define ETH_INTERRUPT
+
 
 #ifdef NET_PROG  //****************************************************************
 // An ATMega328-based device with a local ENC28J60 interface and SPI RAM memory or
@@ -390,6 +400,8 @@
 //#define USE_SMTP         // TCP 
 //#define USE_POP3         // TCP
   #define USE_DNS          
+  #define USE_FRAGMENTS    // IP4 reassembly, in the 23LC1024 (fragment.c)
+  #define USE_TCP_REORDER  // Out-of-order TCP held there too (reorder.c)
 //#define USE_NTP          // Usually off when debugging to avoid flooding
   #define IS_HTTP_SERVER         // TCP
   #define USE_mDNS        
@@ -409,6 +421,55 @@
   
 #endif
 
+#ifdef HOST_MODEL  //****************************************************************
+// Not hardware : the stack built for a PC against a behavioural model of the 
+// ENC28J60 (host/), to measure and regression test the link layer off-board.
+
+  #define HOSTNAME "host-model"  // Length automatic (valid chars are letters, digits and '-')
+    
+  #define MYID  (1) 
+  
+  #define ATMEGA328     
+
+  #define F_CPU 16000000UL  // As if - SPI is timed in bytes, not seconds
+
+  #define USE_ENC28J60      // The model
+  
+  #define TIME_START   (180)
+  #define DELAY_CALIBRATE (1.0)
+
+  #define LEDON  {}   // No LED
+  #define LEDOFF {}   // No LED
+  #define PROTECT_TCP      
+  
+  #define STATIC_IP       // The driver (host/sim.c) plays the rest of the LAN
+  
+    #define OCT0 (192)  
+    #define OCT1 (168)  
+    #define OCT2 (0)  
+    #define OCT3 (99)
+  
+  #define IS_HTTP_SERVER         // TCP
+  #define TCP_SERVERS (3)      // Concurrent HTTP connections (sim benchmarks them)
+  #define USE_SYN_COOKIES  // A SYN beyond the pool still gets its SYN-ACK, and no TCB
+  #define USE_mDNS        
+  #define USE_LLMNR         
+  #define IMPLEMENT_PING     
+  #define USE_FRAGMENTS    // The model has a 23LC1024 too (fragment.c)
+  #define USE_TCP_REORDER  // Out-of-order TCP held there too (reorder.c)
+  #define USE_TCP_STREAMS  // Stream API, its rings there too (stream.c)
+  #define SEND_FRAGMENTS   // The sim sends a datagram several frames long
+  #define STORE_SPACE (256) // The sim sends a datagram from ENC28J60 memory, as power.c
+
+  #define MAC_0  (LOCAL_ADMIN | 0x34)   
+  #define MAC_1  (0x44)  
+  #define MAC_2  (0x54)
+  #define MAC_3  (0x64)
+  #define MAC_4  (0x74)
+  #define MAC_5  (0x84)
+  
+#endif
+
 #ifdef HELLO_HTTP_WORLD  //****************************************************************
 // A minimal ATMega328-based device with a local ENC28J60 interface
 
@@ -446,6 +507,8 @@
   #define USE_DNS          
 //#define USE_NTP          // Usually off when debugging to avoid flooding
   #define IS_HTTP_SERVER         // TCP
+  #define TCP_SERVERS (2)      // Stateless pages : a second browser need not wait
+  #define USE_SYN_COOKIES  // A SYN beyond the pool still gets its SYN-ACK, and no TCB
   #define USE_mDNS        
   #define USE_LLMNR         
   #define IMPLEMENT_PING     // Useful unless space critical
@@ -490,6 +553,15 @@
   #define USE_TCP    
 #endif
 
+#ifndef USE_TCP
+  #undef USE_TCP_REORDER  // Nothing to hold
+  #undef USE_TCP_STREAMS
+#endif
+
+#ifndef IS_HTTP_SERVER
+  #undef USE_SYN_COOKIES  // Only the server takes connections
+#endif
+
 #ifdef ATMEGA32
 #ifdef ATMEGA328
 Error cant both be defined
@@ -0,0 +1,211 @@
+/********************************************
+ IPv4 fragment reassembly, in the 23LC1024 SPI SRAM
+
+ The link layer hands over each fragment for us (linkPacketHeader()) and the
+ payload is copied from the ENC28J60 to the SRAM, leaving the RX ring free.
+ Each datagram being rebuilt has a descriptor here, in RAM; its bytes are at
+ FRAG_SRAM_BASE+d*FRAG_MAX_SIZE laid out as the frame would be (Ethernet,
+ then IP header without options, then payload) so link layer offsets apply.
+
+ Policy :
+ - UDP only (the link layer drops other fragments).  Its checksum is summed
+   as fragments arrive, and checked on completion.
+ - A fragment wholly within what we have is a duplicate : first copy kept.
+ - A fragment partly overlapping what we have, or inconsistent with the 
+   datagram's end, discards the whole datagram (as RFC 5722 for IPv6).
+ - No room (FRAG_DATAGRAMS, FRAG_RUNS, FRAG_MAX_SIZE) : dropped.
+ - FRAG_TICKS after its first fragment, an incomplete datagram is discarded.
+
+ Once complete, the link layer delivers it, reading the SRAM in place of the
+ ENC28J60 (linkReadRandomAccess() etc.), until linkDoneWithPacket().
+
+*********************************************/
+
+#include "config.h"
+
+#ifdef USE_FRAGMENTS
+
+#include <avr/io.h>
+#include "network.h"
+#include "link.h"
+#include "fragment.h"
+#include "mem23SRAM.h"
+
+#if FRAG_SRAM_BASE+FRAG_DATAGRAMS*FRAG_MAX_SIZE>ARP_SPILL_BASE
+#error "The datagrams rebuilt run into the ARP spill's SRAM (network.c)"
+#endif
+
+typedef struct {
+  IP4_address source;
+  uint16_t id;                  // As received (network order)
+  volatile uint8_t ticks;       // Left to complete.  0 is a free descriptor
+  uint8_t runs;                 // Used entries of start/end
+  uint16_t start[FRAG_RUNS];    // Payload held, [start,end) bytes
+  uint16_t end[FRAG_RUNS];
+  uint16_t total;               // Payload length, once the last fragment is in
+  uint32_t sum;                 // Of payload held, for the UDP checksum
+} Reassembly;
+
+static Reassembly frag[FRAG_DATAGRAMS];
+static uint8_t complete;        // The one being delivered
+
+#ifdef STATS
+uint16_t fragReassembled,fragDiscarded; // Datagrams rebuilt; given up (overlap, 
+                                        // timeout, checksum or no room)
+#endif
+
+#define FRAG_AT(D) (FRAG_SRAM_BASE+(uint32_t)(D)*FRAG_MAX_SIZE)
+
+// ---------------------------------------------------------------------------
+static uint8_t discard(Reassembly * r)
+{
+r->ticks=0;
+#ifdef STATS
+fragDiscarded++;
+#endif
+return (FRAG_DROPPED);
+}
+// ---------------------------------------------------------------------------
+static uint8_t finish(uint8_t d)
+{ // All the payload is in : fix up the IP header to that of the whole, check the
+  // UDP checksum and mark it for delivery
+
+Reassembly * r=&frag[d];
+struct {
+  Ethernet_header Ethernet;
+  IP4_header IP4;
+} head;  // FRAG_HEADERS
+uint32_t sum=r->sum;
+uint16_t udpCsum;
+
+memReadBufferMemoryArray(FRAG_AT(d),FRAG_HEADERS,(uint8_t *)&head);
+memReadBufferMemoryArray(FRAG_AT(d)+FRAG_HEADERS+6,2,(uint8_t *)&udpCsum);
+
+if (udpCsum) {  // Zero : sender didn't checksum
+  checksumBare(&sum,(uint16_t *)&head.IP4.source,4);  // Pseudo header
+  sum+=BYTESWAP16(UDPinIP4);
+  sum+=BYTESWAP16(r->total);
+  while (sum>>16) sum=(sum&0xFFFF)+(sum>>16);
+  if (sum!=0xFFFF) return (discard(r));
+}
+
+head.IP4.headerLength=5;  // Options were not kept
+head.IP4.totalLength=BYTESWAP16((IP_HEADER_SIZE+r->total));
+((uint16_t *)&head.IP4)[3]=0;  // Flags and fragment offset
+head.IP4.checksum=0;
+head.IP4.checksum=checksum((uint16_t *)&head.IP4,IP_HEADER_SIZE/2);
+memWriteBufferMemoryArray(FRAG_AT(d),FRAG_HEADERS,(uint8_t *)&head);
+
+r->ticks=FRAG_TICKS;  // Long enough to deliver
+complete=d;
+#ifdef STATS
+fragReassembled++;
+#endif
+return (FRAG_COMPLETE);
+}
+// ---------------------------------------------------------------------------
+uint8_t fragmentAdd(MergedPacket * mp,uint16_t length,uint8_t * scratch,uint16_t scratchSize)
+{ // A fragment for us : Ethernet and IP headers (as received, options skipped) 
+  // in mp, then its 'length' bytes of payload to come from linkReadBufferMemoryArray().
+  // Scratch is for moving the payload (2 bytes or more).  Returns FRAG_...
+
+uint16_t word=BYTESWAP16(IP4_FRAGMENT(mp));
+uint16_t offset=(word&IP4_OFFSET_MASK)*8;
+uint16_t end=offset+length;
+uint8_t last=!(word&IP4_MF),d,i,j,joined;
+Reassembly * r;
+
+if (!length || (!last && (length%8))) return (FRAG_DROPPED);  // Malformed
+
+for (d=0;d<FRAG_DATAGRAMS;d++) 
+  if (frag[d].ticks && frag[d].id==mp->IP4.id && 
+      IP4_match(&frag[d].source,&mp->IP4.source)) break;
+
+if (d==FRAG_DATAGRAMS) { // New datagram
+  for (d=0;d<FRAG_DATAGRAMS;d++) if (!frag[d].ticks) break;
+  if (d==FRAG_DATAGRAMS) return (FRAG_DROPPED);  // No room : its first fragment
+                                                 // was, so it will time out anyway
+  r=&frag[d];
+  copyIP4(&r->source,&mp->IP4.source);
+  r->id=mp->IP4.id;
+  r->runs=0;
+  r->total=0;
+  r->sum=0;
+  r->ticks=FRAG_TICKS;
+}
+r=&frag[d];
+
+if (end>FRAG_MAX_SIZE-FRAG_HEADERS) return (discard(r));  // Too big for us
+if (last) {
+  if (r->total && r->total!=end) return (discard(r));
+  for (i=0;i<r->runs;i++) if (r->end[i]>end) return (discard(r));
+  r->total=end;
+}
+if (r->total && end>r->total) return (discard(r));
+
+for (i=0;i<r->runs;i++) {  // Overlap policy
+  if (offset>=r->start[i] && end<=r->end[i]) return (FRAG_HELD);  // Duplicate
+  if (offset<r->end[i] && end>r->start[i]) return (discard(r));
+}
+if (r->runs==FRAG_RUNS) return (discard(r));
+r->start[r->runs]=offset;
+r->end[r->runs++]=end;
+
+do {  // Join up runs that now meet
+  joined=FALSE;
+  for (i=0;i<r->runs && !joined;i++)
+    for (j=0;j<r->runs && !joined;j++)
+      if (i!=j && r->end[i]==r->start[j]) {
+        r->end[i]=r->end[j];
+        r->runs--;                    // Last takes j's place
+        r->start[j]=r->start[r->runs];
+        r->end[j]=r->end[r->runs];
+        joined=TRUE;
+      }
+} while (joined);
+
+// Now move it : headers from the first, then payload via scratch.  All but the
+// last fragment are multiples of 8 long, so chunks stay 16 bit aligned.
+if (!offset) memWriteBufferMemoryArray(FRAG_AT(d),FRAG_HEADERS,(uint8_t *)mp);
+
+uint32_t at=FRAG_AT(d)+FRAG_HEADERS+offset;
+scratchSize=(scratchSize-1)&0xFFFE;  // Even, and a byte spare to pad an odd end
+while (length) {
+  uint16_t n=(length<scratchSize)?length:scratchSize;
+  linkReadBufferMemoryArray(n,scratch);
+  memWriteBufferMemoryArray(at,n,scratch);
+  if (n%2) scratch[n]=0;
+  checksumBare(&r->sum,(uint16_t *)scratch,(n+1)/2);
+  at+=n;
+  length-=n;
+}
+
+if (!r->ticks) return (FRAG_DROPPED);  // Timed out as we worked
+if (r->total && r->runs==1 && !r->start[0] && r->end[0]==r->total) return (finish(d));
+return (FRAG_HELD);
+}
+// ---------------------------------------------------------------------------
+uint32_t fragmentDatagram(uint16_t * length)
+{ // The datagram fragmentAdd() completed : where in the SRAM, and its length 
+  // as a frame.
+*length=FRAG_HEADERS+frag[complete].total;
+return (FRAG_AT(complete));
+}
+// ---------------------------------------------------------------------------
+void fragmentDone(void)
+{ // Delivered : free it
+frag[complete].ticks=0;
+}
+// ---------------------------------------------------------------------------
+void fragmentTick(void)
+{ // Called every tick (from interrupt : no SPI).  Times out datagrams.
+uint8_t d;
+
+for (d=0;d<FRAG_DATAGRAMS;d++) 
+  if (frag[d].ticks && !(--frag[d].ticks)) {
+#ifdef STATS
+    fragDiscarded++;
+#endif
+  }
+}
+#endif
@@ -0,0 +1,29 @@
+/********************************************
+ Header code for IPv4 fragment reassembly (fragment.c)
+
+*********************************************/
+
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+#include "network.h"
+
+#define FRAG_DATAGRAMS (2)       // Reassembled at once.  Each ~30 bytes RAM
+#define FRAG_MAX_SIZE  (4096)    // Largest rebuilt, as a frame : Ethernet and IP
+                                 // headers (FRAG_HEADERS) then payload.  Even.
+#define FRAG_RUNS      (4)       // Disjoint runs of fragments a datagram may have
+#define FRAG_TICKS     (15)      // Seconds-ish for all fragments to arrive (RFC 791)
+#define FRAG_SRAM_BASE (0x1C000) // 23LC1024 address.  Datagram d at +d*FRAG_MAX_SIZE
+
+#define FRAG_HEADERS   (ETH_HEADER_SIZE+IP_HEADER_SIZE)  // Options are dropped
+
+#define FRAG_DROPPED   (0)       // fragmentAdd() results
+#define FRAG_HELD      (1)
+#define FRAG_COMPLETE  (2)
+
+uint8_t  fragmentAdd(MergedPacket * mp,uint16_t length,uint8_t * scratch,uint16_t scratchSize);
+uint32_t fragmentDatagram(uint16_t * length);
+void     fragmentDone(void);
+void     fragmentTick(void);
+
+#endif
@@ -0,0 +1,21 @@
+/* Host build stand-in for <avr/eeprom.h> : 1kB in RAM */
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+extern uint8_t hostEEPROM[1024];
+
+#define EEMEM
+#define eeprom_read_byte(a)      (hostEEPROM[(uintptr_t)(a)])
+#define eeprom_write_byte(a,v)   (hostEEPROM[(uintptr_t)(a)]=(v))
+#define eeprom_read_word(a)      (*(uint16_t *)&hostEEPROM[(uintptr_t)(a)])
+#define eeprom_write_word(a,v)   (*(uint16_t *)&hostEEPROM[(uintptr_t)(a)]=(v))
+#define eeprom_read_block(d,a,n) (memcpy((d),&hostEEPROM[(uintptr_t)(a)],(n)))
+#define eeprom_write_block(s,a,n) (memcpy(&hostEEPROM[(uintptr_t)(a)],(s),(n)))
+#define eeprom_update_byte       eeprom_write_byte
+#define eeprom_update_word       eeprom_write_word
+#define eeprom_update_block      eeprom_write_block
+
+#endif
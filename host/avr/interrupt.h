@@ -0,0 +1,12 @@
+/* Host build stand-in for <avr/interrupt.h> : vectors are plain functions,
+   called by the model (INT0) or the driver */
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>   // As the real header does
+
+#define ISR(vector)  void vector(void)
+#define sei()
+#define cli()
+
+#endif
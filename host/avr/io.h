@@ -0,0 +1,64 @@
+/********************************************
+ Host build stand-in for <avr/io.h>
+
+ Registers are plain variables (see model.c), except SPSR, whose read
+ clocks the byte in SPDR through the ENC28J60 model when it is selected.
+ So the stack's SPDR= / WAIT_SPI() / =SPDR sequences run unaltered.  And
+ TCNT1, which counts host cycles, so REGRESS benchmarks time the host.
+
+*********************************************/
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+volatile uint8_t * modelSPSR(void);
+volatile uint16_t * modelTCNT1(void);
+
+#define SPSR (*modelSPSR())
+#define TCNT1 (*modelTCNT1())  // Counts host cycles : see model.c
+
+extern volatile uint8_t SPDR,SPCR;
+extern volatile uint8_t PORTB,DDRB,PINB,PORTC,DDRC,PINC,PORTD,DDRD,PIND;
+extern volatile uint8_t TCCR0A,TCCR0B,TCNT0,OCR0A,TIMSK0;
+extern volatile uint8_t TCCR1A,TCCR1B,TIMSK1;
+extern volatile uint16_t OCR1A,ICR1;
+extern volatile uint8_t EICRA,EIMSK,EIFR;
+extern volatile uint8_t ADMUX,ADCSRA;
+extern volatile uint16_t ADC;
+
+#define SPIF   (7)
+#define SPI2X  (0)
+#define SPE    (6)
+#define MSTR   (4)
+#define SPR1   (1)
+#define SPR0   (0)
+
+#define CS00   (0)
+#define CS01   (1)
+#define CS02   (2)
+#define CS10   (0)
+#define CS11   (1)
+#define CS12   (2)
+#define TOIE0  (0)
+
+#define INT0   (0)
+#define INTF0  (0)
+#define ISC00  (0)
+#define ISC01  (1)
+
+#define ADEN   (7)
+#define ADSC   (6)
+#define ADIF   (4)
+
+#define PORTB0 (0)
+#define PORTB1 (1)
+#define PORTB2 (2)
+#define PORTB3 (3)
+#define PORTB4 (4)
+#define PORTB5 (5)
+#define DDB1   (1)
+#define DDD2   (2)
+
+#endif
@@ -0,0 +1,19 @@
+/* Host build stand-in for <avr/pgmspace.h> : one address space */
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s)           (s)
+#define pgm_read_byte(a)  (*(const uint8_t *)(a))
+#define pgm_read_word(a)  (*(const uint16_t *)(a))
+#define strlen_P          strlen
+#define strcpy_P          strcpy
+#define strncpy_P         strncpy
+#define strcmp_P          strcmp
+#define strncmp_P         strncmp
+#define memcpy_P          memcpy
+#define sprintf_P         sprintf
+
+#endif
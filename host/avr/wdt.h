@@ -0,0 +1,9 @@
+/* Host build stand-in for <avr/wdt.h> */
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+
+#define wdt_reset()
+#define wdt_enable(x)
+#define wdt_disable()
+
+#endif
@@ -0,0 +1,501 @@
+/********************************************
+ Host (PC) behavioural model of the ENC28J60 Ethernet module
+
+ Sits behind the stand-in <avr/io.h> : the driver's SPI byte exchanges arrive
+ here one at a time (modelSPSR) and chip select comes from ETH_ACTIVATE/
+ ETH_DEACTIVATE (modelSelect).  Enough of the chip is modelled for the stack
+ in linkENC28J60.c to run unaltered :
+
+ - SPI opcodes RCR, RBM, WCR, WBM, BFS, BFC, SRC (incl. MAC/MII dummy byte)
+ - 4 register banks, common registers, PHY registers via MII
+ - 8kB buffer, RX ring (ERXST-ERXND) with wraparound for reads, ring writes
+   and DMA; even-aligned packets with 6 byte status preamble and 4 byte CRC
+ - ERXFCON unicast/broadcast/multicast/hash filters, EPKTCNT, PKTDEC, RXERIF
+ - TX from ETXST (control byte) to ETXND, padding, status vector, TXRTS held
+   busy for a settable time so overlap with SPI can be seen
+ - DMA copy and checksum
+ - INT pin, as a callback on its falling edge
+ - TIMER1 (TCNT1 only) free running at the host's cycle counter, for the 
+   REGRESS benchmarks
+
+ Also, more simply, the 23LC1024 SPI SRAM of the network programmer board : 
+ the mem23SRAM.h array calls, sequential mode, straight onto a 128kB array.
+
+ Not modelled : timing beyond SPI byte counts, collisions, PHY link events,
+ pattern match, magic packet, flow control (EFLOCON is just a register).
+
+*********************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "model.h"
+#include "mem23SRAM.h"
+
+// Stand-in AVR registers (see host/avr/io.h).  The only ones that do anything
+// are SPDR and SPSR.
+volatile uint8_t SPDR,SPCR;
+volatile uint8_t PORTB,DDRB,PINB,PORTC,DDRC,PINC,PORTD,DDRD,PIND;
+volatile uint8_t TCCR0A,TCCR0B,TCNT0,OCR0A,TIMSK0;
+volatile uint8_t TCCR1A,TCCR1B,TIMSK1;
+volatile uint16_t OCR1A,ICR1;
+volatile uint8_t EICRA,EIMSK,EIFR;
+volatile uint8_t ADMUX,ADCSRA;
+volatile uint16_t ADC;
+
+uint8_t hostEEPROM[1024];
+
+ModelStats modelStats;
+
+#define SPI_SPIF (1<<7)
+
+// Register addresses (bank,address), datasheet table 3-2
+#define ERDPT    (0x00)
+#define EWRPT    (0x02)
+#define ETXST    (0x04)
+#define ETXND    (0x06)
+#define ERXST    (0x08)
+#define ERXND    (0x0A)
+#define ERXRDPT  (0x0C)
+#define ERXWRPT  (0x0E)
+#define EDMAST   (0x10)
+#define EDMAND   (0x12)
+#define EDMADST  (0x14)
+#define EDMACS   (0x16)
+
+#define ERXFCON  (0x18)  // Bank 1
+#define EPKTCNT  (0x19)
+
+#define MICMD    (0x12)  // Bank 2
+#define MIREGADR (0x14)
+#define MIWRL    (0x16)
+#define MIWRH    (0x17)
+#define MIRDL    (0x18)
+#define MIRDH    (0x19)
+
+#define MISTAT   (0x0A)  // Bank 3
+#define EREVID   (0x12)
+
+#define EIE      (0x1B)  // Common
+#define EIR      (0x1C)
+#define ESTAT    (0x1D)
+#define ECON2    (0x1E)
+#define ECON1    (0x1F)
+
+#define EIR_PKTIF  (1<<6)
+#define EIR_DMAIF  (1<<5)
+#define EIR_TXIF   (1<<3)
+#define EIR_RXERIF (1<<0)
+#define EIE_INTIE  (1<<7)
+
+#define ECON1_DMAST  (1<<5)
+#define ECON1_CSUMEN (1<<4)
+#define ECON1_TXRTS  (1<<3)
+#define ECON1_RXEN   (1<<2)
+#define ECON1_TXRST  (1<<7)
+#define ECON2_AUTOINC (1<<7)
+#define ECON2_PKTDEC  (1<<6)
+
+#define FCON_UCEN  (1<<7)
+#define FCON_ANDOR (1<<6)
+#define FCON_HTEN  (1<<2)
+#define FCON_MCEN  (1<<1)
+#define FCON_BCEN  (1<<0)
+
+static uint8_t memory[MODEL_MEMORY];
+static uint8_t bank[4][0x1B];    // Banked registers
+static uint8_t common[5];        // 0x1B-0x1F, in every bank
+static uint16_t phy[0x20];
+
+static uint8_t powered;          // Reset state applied
+static uint8_t selected;         // CS state
+static uint16_t byteInTransaction;
+static uint8_t opcode,argument;
+static uint8_t spsr=SPI_SPIF;    // Always 'complete'
+
+static uint8_t intLevel;         // INT asserted (active low on the pin)
+static void (* intHook)(void);
+
+static uint32_t txBusy;          // SPI bytes until transmission completes
+static uint8_t txPercent;
+
+static uint8_t  txFrames[MODEL_TX_QUEUE][MODEL_MAX_FRAME];
+static uint16_t txLength[MODEL_TX_QUEUE];
+static uint8_t  txHead,txCount;
+
+// ---------------------------------------------------------------------------
+static uint8_t * reg(uint8_t address)
+{
+if (address>=0x1B) return (&common[address-0x1B]);
+return (&bank[common[ECON1-0x1B]&0x03][address]);
+}
+// ---------------------------------------------------------------------------
+static uint16_t reg16(uint8_t b,uint8_t address)
+          { return (bank[b][address]|((uint16_t)bank[b][address+1]<<8)); }
+// ---------------------------------------------------------------------------
+static void setReg16(uint8_t b,uint8_t address,uint16_t value)
+{
+bank[b][address]=value&0xFF;
+bank[b][address+1]=(value>>8)&0x1F;
+}
+// ---------------------------------------------------------------------------
+static uint16_t ringNext(uint16_t address)
+{ // Next address, following the RX ring wrap (as ERDPT, DMA and RX writes do)
+if (address==reg16(0,ERXND)) return (reg16(0,ERXST));
+return ((address+1)&(MODEL_MEMORY-1));
+}
+// ---------------------------------------------------------------------------
+static uint8_t isMACorMII(uint8_t address)
+{ // These return a dummy byte before the data on RCR
+uint8_t b=common[ECON1-0x1B]&0x03;
+if (address>=0x1B) return (0);
+if (b==2) return (address<=0x19);
+if (b==3) return (address<=0x05 || address==MISTAT);
+return (0);
+}
+// ---------------------------------------------------------------------------
+static void updateInt(void)
+{
+common[EIR-0x1B]=(common[EIR-0x1B]&~EIR_PKTIF)|(bank[1][EPKTCNT]?EIR_PKTIF:0);
+uint8_t level=(common[EIE-0x1B]&EIE_INTIE) && (common[EIR-0x1B]&common[EIE-0x1B]&0x7B);
+if (level && !intLevel && intHook) { intLevel=level; intHook(); }
+intLevel=level;
+}
+// ---------------------------------------------------------------------------
+static void reset(void)
+{ // Power on / SRC values (datasheet tables 3-3, 3-4) where the stack cares
+memset(bank,0,sizeof(bank));
+memset(common,0,sizeof(common));
+memset(phy,0,sizeof(phy));
+setReg16(0,ERXST,0x05FA);
+setReg16(0,ERXND,0x1FFF);
+setReg16(0,ERDPT,0x05FA);
+setReg16(0,ERXRDPT,0x05FA);
+bank[1][ERXFCON]=0xA1;
+bank[3][EREVID]=0x06;            // Rev B7
+common[ECON2-0x1B]=ECON2_AUTOINC;
+common[ESTAT-0x1B]=0x01;         // CLKRDY
+txBusy=0;
+intLevel=0;
+}
+// ---------------------------------------------------------------------------
+static void transmitDone(void)
+{ // Frame leaves : captured for modelCollect(), status vector written
+uint16_t start=reg16(0,ETXST);
+uint16_t end=reg16(0,ETXND);
+uint16_t length=(end-start)&(MODEL_MEMORY-1);   // Excludes control byte
+
+common[ECON1-0x1B]&=~ECON1_TXRTS;
+common[EIR-0x1B]|=EIR_TXIF;
+if (length>MODEL_MAX_FRAME-4) return;
+
+uint8_t slot=(txHead+txCount)%MODEL_TX_QUEUE;
+if (txCount==MODEL_TX_QUEUE) txHead=(txHead+1)%MODEL_TX_QUEUE;  // Lose oldest
+else txCount++;
+
+for (uint16_t i=0;i<length;i++) txFrames[slot][i]=memory[(start+1+i)&(MODEL_MEMORY-1)];
+if (length<60) {   // MACON3 : pad short frames
+  memset(&txFrames[slot][length],0,60-length);
+  length=60;
+}
+txLength[slot]=length;
+modelStats.framesOut++;
+
+for (uint8_t i=0;i<7;i++) memory[(end+1+i)&(MODEL_MEMORY-1)]=0;
+memory[(end+1)&(MODEL_MEMORY-1)]=length&0xFF;
+memory[(end+2)&(MODEL_MEMORY-1)]=length>>8;
+memory[(end+3)&(MODEL_MEMORY-1)]=0x80;   // Transmit done
+}
+// ---------------------------------------------------------------------------
+static void dma(void)
+{ // DMA runs instantly (datasheet 14) : copy, or checksum if CSUMEN
+uint16_t src=reg16(0,EDMAST);
+uint16_t end=reg16(0,EDMAND);
+
+if (common[ECON1-0x1B]&ECON1_CSUMEN) {
+  uint32_t sum=0;
+  uint8_t high=1;
+  for (;;) {
+    sum+=high?((uint16_t)memory[src]<<8):memory[src];
+    high=!high;
+    if (src==end) break;
+    src=ringNext(src);
+  }
+  while (sum>>16) sum=(sum&0xFFFF)+(sum>>16);
+  sum=(~sum)&0xFFFF;
+  bank[0][EDMACS]=sum&0xFF;
+  bank[0][EDMACS+1]=sum>>8;
+  modelStats.dmaChecksums++;
+} else {
+  uint16_t dst=reg16(0,EDMADST);
+  for (;;) {
+    memory[dst]=memory[src];
+    if (src==end) break;
+    src=ringNext(src);
+    dst=ringNext(dst);
+  }
+  modelStats.dmaCopies++;
+}
+common[ECON1-0x1B]&=~ECON1_DMAST;
+common[EIR-0x1B]|=EIR_DMAIF;
+}
+// ---------------------------------------------------------------------------
+static void writeECON1(uint8_t value)
+{
+uint8_t was=common[ECON1-0x1B];
+common[ECON1-0x1B]=value;
+
+if ((value&ECON1_TXRST) || ((was&ECON1_TXRTS) && !(value&ECON1_TXRTS)))
+  txBusy=0;   // Transmission abandoned
+if (value&ECON1_DMAST) dma();
+if ((value&ECON1_TXRTS) && !(was&ECON1_TXRTS)) {
+  uint16_t length=(reg16(0,ETXND)-reg16(0,ETXST))&(MODEL_MEMORY-1);
+  txBusy=((uint32_t)length*txPercent)/100;
+  if (!txBusy) transmitDone();
+}
+}
+// ---------------------------------------------------------------------------
+static void writeRegister(uint8_t address,uint8_t value)
+{
+uint8_t b=common[ECON1-0x1B]&0x03;
+
+if (address==ECON1) { writeECON1(value); return; }
+if (address==ECON2) {
+  if ((value&ECON2_PKTDEC) && bank[1][EPKTCNT]) bank[1][EPKTCNT]--;
+  common[ECON2-0x1B]=value&~ECON2_PKTDEC;
+  return;
+}
+if (address==ESTAT) return;   // Read only (bar a couple of flags we ignore)
+
+*reg(address)=value;
+
+if (b==0 && (address==ERXST || address==ERXST+1))  // ERXWRPT follows ERXST
+  setReg16(0,ERXWRPT,reg16(0,ERXST));
+if (b==2 && address==MIWRH) phy[bank[2][MIREGADR]&0x1F]=reg16(2,MIWRL);
+if (b==2 && address==MICMD && (value&0x01)) setReg16(2,MIRDL,phy[bank[2][MIREGADR]&0x1F]);
+}
+// ---------------------------------------------------------------------------
+static uint8_t readRegister(uint8_t address)
+{
+uint8_t b=common[ECON1-0x1B]&0x03;
+if (b==3 && address==MISTAT) return (0);  // Never busy
+return (*reg(address));
+}
+// ---------------------------------------------------------------------------
+static uint8_t exchange(uint8_t out)
+{ // One SPI byte while selected : returns what the chip drives on MISO
+uint8_t in=0;
+
+if (!byteInTransaction) {
+  opcode=out>>5;
+  argument=out&0x1F;
+  if (out==0xFF) reset();   // SRC
+} else {
+  switch (opcode) {
+    case 0 :  // RCR
+      if (byteInTransaction==(isMACorMII(argument)?2:1)) in=readRegister(argument);
+      break;
+    case 1 : { // RBM
+      uint16_t p=reg16(0,ERDPT);
+      in=memory[p];
+      if (common[ECON2-0x1B]&ECON2_AUTOINC) setReg16(0,ERDPT,ringNext(p));
+      break;
+    }
+    case 2 :  // WCR
+      if (byteInTransaction==1) writeRegister(argument,out);
+      break;
+    case 3 : { // WBM
+      uint16_t p=reg16(0,EWRPT);
+      memory[p]=out;
+      if (common[ECON2-0x1B]&ECON2_AUTOINC) setReg16(0,EWRPT,(p+1)&(MODEL_MEMORY-1));
+      break;
+    }
+    case 4 :  // BFS : ETH registers only
+      if (byteInTransaction==1) {
+        if (argument==ECON1) writeECON1(common[ECON1-0x1B]|out);
+        else if (argument==ECON2) writeRegister(ECON2,common[ECON2-0x1B]|out);
+        else *reg(argument)|=out;
+      }
+      break;
+    case 5 :  // BFC
+      if (byteInTransaction==1) {
+        if (argument==ECON1) writeECON1(common[ECON1-0x1B]&~out);
+        else *reg(argument)&=~out;
+      }
+      break;
+  }
+}
+byteInTransaction++;
+
+if (txBusy && !(--txBusy)) transmitDone();
+
+return (in);
+}
+// ---------------------------------------------------------------------------
+volatile uint8_t * modelSPSR(void)
+{ // Reading SPSR is where a byte gets clocked, if the ENC28J60 is selected
+if (selected) {
+  SPDR=exchange(SPDR);
+  modelStats.spiBytes++;
+}
+return (&spsr);
+}
+// ---------------------------------------------------------------------------
+void modelSelect(uint8_t select)
+{
+if (!powered) { powered=1; reset(); }  // Power-on values at first contact
+if (select && !selected) byteInTransaction=0;
+if (!select && selected) {
+  modelStats.spiTransactions++;
+  updateInt();
+}
+selected=select;
+}
+// ---------------------------------------------------------------------------
+static uint64_t hostCycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+return (__builtin_ia32_rdtsc());
+#else
+struct timespec ts;  // Nanoseconds will have to do
+clock_gettime(CLOCK_MONOTONIC,&ts);
+return ((uint64_t)ts.tv_sec*1000000000u+ts.tv_nsec);
+#endif
+}
+// ---------------------------------------------------------------------------
+volatile uint16_t * modelTCNT1(void)
+{ // Every TCNT1 access comes here.  A value written is noticed at the next
+  // access (as differing from what was last given) and counted on from the
+  // time of the access before.
+static volatile uint16_t tcnt1;
+static uint16_t given;
+static uint64_t base,last;
+uint64_t now=hostCycles();
+
+if (tcnt1!=given) base=last-tcnt1;  // Written since
+last=now;
+tcnt1=given=(uint16_t)(now-base);
+return (&tcnt1);
+}
+// ---------------------------------------------------------------------------
+void modelResetStats(void) { memset(&modelStats,0,sizeof(modelStats)); }
+// ---------------------------------------------------------------------------
+void modelIntHook(void (* hook)(void)) { intHook=hook; }
+// ---------------------------------------------------------------------------
+void modelTxWireTime(uint8_t percent) { txPercent=percent; }
+// ---------------------------------------------------------------------------
+static uint32_t ethernetCRC(const uint8_t * data,uint16_t length)
+{ // IEEE 802.3 FCS, reflected form
+uint32_t crc=0xFFFFFFFF;
+while (length--) {
+  crc^=*(data++);
+  for (uint8_t bit=0;bit<8;bit++) crc=(crc>>1)^((crc&1)?0xEDB88320:0);
+}
+return (~crc);
+}
+// ---------------------------------------------------------------------------
+static uint8_t hashBin(const uint8_t * MAC)
+{ // Datasheet 8.3.3 : bits 28:23 of the CRC over the destination address
+uint32_t crc=0xFFFFFFFF;
+for (uint8_t i=0;i<6;i++)
+  for (uint8_t bit=0;bit<8;bit++)
+    crc=(crc<<1)^((((crc>>31)^(MAC[i]>>bit))&1)?0x04C11DB7:0);
+return ((crc>>23)&0x3F);
+}
+// ---------------------------------------------------------------------------
+static uint8_t accepted(const uint8_t * frame)
+{ // Receive filters, OR mode (ANDOR is not used by the stack)
+uint8_t fcon=bank[1][ERXFCON];
+uint8_t ourMAC[6]={bank[3][4],bank[3][5],bank[3][2],bank[3][3],bank[3][0],bank[3][1]};
+static const uint8_t broadcast[6]={0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
+
+if (!(fcon&~0x20)) return (1);   // Promiscuous (CRCEN alone)
+if ((fcon&FCON_UCEN) && !memcmp(frame,ourMAC,6)) return (1);
+if ((fcon&FCON_BCEN) && !memcmp(frame,broadcast,6)) return (1);
+if ((fcon&FCON_MCEN) && (frame[0]&0x01)) return (1);
+if (fcon&FCON_HTEN) {
+  uint8_t b=hashBin(frame);
+  if (bank[1][b>>3]&(1<<(b&0x07))) return (1);
+}
+return (0);
+}
+// ---------------------------------------------------------------------------
+uint8_t modelInject(const uint8_t * frame,uint16_t length)
+{ // Frame arrives from the wire (without CRC, which we add).  Returns TRUE
+  // if it went into the RX ring.
+if (!powered) return (0);
+if (!(common[ECON1-0x1B]&ECON1_RXEN) || length<14 || length>MODEL_MAX_FRAME-4)
+  return (0);
+if (!accepted(frame)) { modelStats.framesFiltered++; return (0); }
+
+uint16_t start=reg16(0,ERXST), end=reg16(0,ERXND);
+uint16_t size=end-start+1;
+uint16_t wr=reg16(0,ERXWRPT), rd=reg16(0,ERXRDPT);
+uint16_t space=(rd>=wr)?(rd-wr):(size-(wr-rd));
+if (!space) space=size;   // Empty (as after initialisation)
+
+uint16_t bytes=length+4;
+uint16_t need=6+bytes+((6+bytes)&1);   // Next packet starts on even address
+if (need>=space || bank[1][EPKTCNT]==255) {
+  common[EIR-0x1B]|=EIR_RXERIF;
+  modelStats.framesOverflow++;
+  updateInt();
+  return (0);
+}
+
+uint16_t next=wr;
+for (uint16_t i=0;i<need;i++) next=ringNext(next);
+
+uint8_t preamble[6];
+preamble[0]=next&0xFF;
+preamble[1]=next>>8;
+preamble[2]=bytes&0xFF;
+preamble[3]=bytes>>8;
+preamble[4]=0x80;   // Received OK
+preamble[5]=(frame[0]&0x01)?((frame[0]==0xFF)?0x03:0x01):0x00;  // Broadcast/multicast
+
+uint32_t crc=ethernetCRC(frame,length);
+uint16_t p=wr;
+for (uint8_t i=0;i<6;i++)       { memory[p]=preamble[i]; p=ringNext(p); }
+for (uint16_t i=0;i<length;i++) { memory[p]=frame[i];    p=ringNext(p); }
+for (uint8_t i=0;i<4;i++)       { memory[p]=crc>>(8*i);  p=ringNext(p); }
+
+setReg16(0,ERXWRPT,next);
+bank[1][EPKTCNT]++;
+modelStats.framesIn++;
+updateInt();
+return (1);
+}
+// ---------------------------------------------------------------------------
+uint16_t modelCollect(uint8_t * frame)
+{ // Oldest transmitted frame not yet collected.  Time passes while the
+  // LAN waits, so a transmission in progress completes.
+if (txBusy) { txBusy=0; transmitDone(); }
+if (!txCount) return (0);
+uint16_t length=txLength[txHead];
+memcpy(frame,txFrames[txHead],length);
+txHead=(txHead+1)%MODEL_TX_QUEUE;
+txCount--;
+return (length);
+}
+// ---------------------------------------------------------------------------
+uint8_t  modelPending(void)       { return (bank[1][EPKTCNT]); }
+// ---------------------------------------------------------------------------
+uint16_t modelRxWritePointer(void) { return (reg16(0,ERXWRPT)); }
+// ---------------------------------------------------------------------------
+uint8_t  modelPeek(uint16_t address) { return (memory[address&(MODEL_MEMORY-1)]); }
+// ---------------------------------------------------------------------------
+static uint8_t sram[MODEL_SRAM];
+// ---------------------------------------------------------------------------
+void memReadBufferMemoryArray(uint32_t address,uint16_t len,uint8_t * buffer)
+{ // Command, 24 bit address, data : wraps at the top, as the chip does
+modelStats.sramBytes+=4+len;
+while (len--) { *(buffer++)=sram[address&(MODEL_SRAM-1)]; address++; }
+}
+// ---------------------------------------------------------------------------
+void memWriteBufferMemoryArray(uint32_t address,uint16_t len,uint8_t * buffer)
+{
+modelStats.sramBytes+=4+len;
+while (len--) { sram[address&(MODEL_SRAM-1)]=*(buffer++); address++; }
+}
@@ -0,0 +1,44 @@
+/********************************************
+ Header code for host (PC) behavioural model of the ENC28J60
+
+*********************************************/
+
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <stdint.h>
+
+#define MODEL_MEMORY     (0x2000)  // 8kB buffer
+#define MODEL_MAX_FRAME  (1518)
+#define MODEL_TX_QUEUE   (32)      // Frames held for collection
+#define MODEL_SRAM       (0x20000) // 128kB 23LC1024
+
+typedef struct {      // Counters : zero with modelResetStats()
+  uint32_t spiBytes;        // Every byte clocked while selected
+  uint32_t spiTransactions; // CS low/high pairs
+  uint32_t framesIn;        // Injected and accepted into the RX ring
+  uint32_t framesFiltered;  // Injected, rejected by ERXFCON
+  uint32_t framesOverflow;  // Injected, no room (RXERIF)
+  uint32_t framesOut;       // Transmitted (TXRTS)
+  uint32_t dmaCopies;
+  uint32_t dmaChecksums;
+  uint32_t sramBytes;       // Clocked to/from the 23LC1024, command and 
+                            // address included (not in spiBytes)
+} ModelStats;
+
+extern ModelStats modelStats;
+
+void     modelSelect(uint8_t selected);   // ETH_ACTIVATE/ETH_DEACTIVATE
+void     modelResetStats(void);
+void     modelIntHook(void (* hook)(void)); // Called on INT pin falling edge
+void     modelTxWireTime(uint8_t percent);  // TXRTS busy for percent% of the
+                                            // frame's bytes in SPI bytes (0=instant)
+
+uint8_t  modelInject(const uint8_t * frame,uint16_t length); // Frame without CRC
+uint16_t modelCollect(uint8_t * frame);    // Next transmitted frame, 0 if none
+uint8_t  modelPending(void);               // EPKTCNT
+uint16_t modelRxWritePointer(void);        // ERXWRPT
+
+uint8_t  modelPeek(uint16_t address);      // Direct look at buffer memory
+
+#endif
@@ -0,0 +1,1812 @@
+/********************************************
+ Host (PC) driver for the stack running against the ENC28J60 model
+
+ Takes the place of main.c for 'make host'.  Plays the rest of the LAN :
+ frames are built here byte by byte (independently of the stack's own
+ structures), injected into the model's RX ring, the stack is run, and
+ whatever it transmits is collected and checked.
+
+ Scenarios :
+ - Checksum kernel vs. a plain sum, random data (REGRESS : and its speed)
+ - Incremental checksum updates vs. summing again, random headers and edits
+ - ARP request for our IP      -> ARP reply
+ - Ping, small and full size   -> echo reply, payload and checksums intact
+ - UDP to an unused port       -> consumed silently
+ - UDP to a port bound at run
+   time, then unbound          -> handler called, then dropped unread;
+                                  the port table against a simple list
+ - TCP SYN, ACK, GET / to :80  -> SYN-ACK, page, FIN
+ - TCP to a closed port, ping
+   for another IP              -> dropped, mostly unread
+ - Fragmented LLMNR query, in
+   order, reversed, duplicated   -> answered once reassembled
+   overlapping, or no room       -> dropped
+ - UDP from a callback, bigger
+   than a frame                  -> IP fragments, last first
+ - Ring stress : thousands of random size pings in random bursts, so the
+   RX ring wraps many times and overflows now and then; every accepted
+   ping must get a correct reply
+
+ SPI bytes per packet (the cost the link layer optimisations target) are
+ reported for each.  Exit status is the number of failed checks.
+
+*********************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <avr/io.h>
+#include "config.h"
+#include <avr/interrupt.h>
+
+#include "network.h"
+#include "application.h"
+#include "link.h"
+#include "host/model.h"
+#ifdef USE_FRAGMENTS
+#include "fragment.h"
+#endif
+#ifdef USE_TCP_REORDER
+#include "reorder.h"
+#endif
+#ifdef USE_TCP_STREAMS
+#include "stream.h"
+#endif
+
+// The globals main.c would provide
+const MAC_address BroadcastMAC={.MAC={0xff,0xff,0xff,0xff,0xff,0xff}};
+const IP4_address NullIP=0;
+const IP4_address BroadcastIP=0xFFFFFFFF;
+const MAC_address myMAC={.MAC={MAC_0,MAC_1,MAC_2,MAC_3,MAC_4,MAC_5}};
+
+IP4_address GWIP;
+IP4_address NTPIP=0;
+IP4_address subnetMask;
+IP4_address subnetBroadcastIP;
+
+char buffer[MSG_LENGTH];
+volatile uint8_t timecount;
+
+Status MyState;
+MergedPacket MashE;
+
+uint32_t time_now;
+IP4_address myIP;
+
+uint16_t lfsr=0xACE1u;
+
+#ifdef ETH_INTERRUPT
+ISR(INT0_vect);
+#endif
+// ----------------------------------------------------------------------------
+void delay_ms(uint16_t ms) { return; }
+// ----------------------------------------------------------------------------
+uint8_t caseFreeCompare(const char * s1,const char * s2, uint8_t len)
+{ // As application.c, which drags in much the host build doesn't want
+while (len--) if (toupper(*(s1++))!=toupper(*(s2++))) return TRUE;
+return FALSE;
+}
+// ----------------------------------------------------------------------------
+
+#define STRESS_PINGS  (5000)
+#define STRESS_BURST  (8)   // Most frames queued before the stack runs
+#define MAX_ICMP_DATA (1472)
+#define UNWANTED_DATA (1000)  // Payload of frames we should drop unread
+
+static const uint8_t peerMAC[6]={0x02,0x00,0x00,0x00,0x00,0x01};
+static const uint8_t peerIP[4] ={192,168,0,1};
+static const uint8_t ourIP[4]  ={OCT0,OCT1,OCT2,OCT3};
+static const uint8_t ourMAC[6] ={MAC_0,MAC_1,MAC_2,MAC_3,MAC_4,MAC_5};
+static const uint8_t farIP[4]  ={10,1,2,3};     // Beyond the peer, our gateway
+
+static uint8_t frame[MODEL_MAX_FRAME];
+static uint8_t reply[MODEL_MAX_FRAME];
+static uint16_t failures;
+static uint32_t rnd=0x12345678;
+
+// ----------------------------------------------------------------------------
+static uint32_t random32(void)
+{ // xorshift : reproducible runs
+rnd^=rnd<<13;
+rnd^=rnd>>17;
+rnd^=rnd<<5;
+return (rnd);
+}
+// ----------------------------------------------------------------------------
+static void check(uint8_t ok,const char * what)
+{
+if (!ok) {
+  printf("  FAIL : %s\n",what);
+  failures++;
+}
+}
+// ----------------------------------------------------------------------------
+static uint16_t get16(const uint8_t * p) { return ((p[0]<<8)|p[1]); }
+// ----------------------------------------------------------------------------
+static void put16(uint8_t * p,uint16_t v) { p[0]=v>>8; p[1]=v&0xFF; }
+// ----------------------------------------------------------------------------
+static uint32_t sum16(const uint8_t * p,uint16_t length,uint32_t sum)
+{ // Ones complement sum, unfolded
+for (uint16_t i=0;i+1<length;i+=2) sum+=get16(&p[i]);
+if (length&1) sum+=p[length-1]<<8;
+return (sum);
+}
+// ----------------------------------------------------------------------------
+static uint16_t fold(uint32_t sum)
+{
+while (sum>>16) sum=(sum&0xFFFF)+(sum>>16);
+return (~sum&0xFFFF);
+}
+// ----------------------------------------------------------------------------
+static uint16_t pseudoSum(const uint8_t * ip,uint16_t length)
+{ // Checksum over pseudo header and transport segment : 0 if good
+uint32_t sum=sum16(&ip[12],8,0)+ip[9]+length;
+return (fold(sum16(&ip[20],length,sum)));
+}
+// ----------------------------------------------------------------------------
+static uint16_t ethernet(uint8_t * f,const uint8_t * to,uint16_t type)
+{
+memcpy(&f[0],to,6);
+memcpy(&f[6],peerMAC,6);
+put16(&f[12],type);
+return (14);
+}
+// ----------------------------------------------------------------------------
+static uint16_t ip4(uint8_t * f,uint8_t protocol,uint16_t payload)
+{ // IP header (no options) from peer to us, after the Ethernet header
+static uint16_t id;
+uint8_t * ip=&f[14];
+
+ethernet(f,ourMAC,0x0800);
+ip[0]=0x45;
+ip[1]=0;
+put16(&ip[2],20+payload);
+put16(&ip[4],++id);
+put16(&ip[6],0);
+ip[8]=64;
+ip[9]=protocol;
+put16(&ip[10],0);
+memcpy(&ip[12],peerIP,4);
+memcpy(&ip[16],ourIP,4);
+put16(&ip[10],fold(sum16(ip,20,0)));
+return (34);
+}
+// ----------------------------------------------------------------------------
+static uint16_t echoRequest(uint8_t * f,uint16_t id,uint16_t seq,uint16_t data)
+{
+uint16_t at=ip4(f,1,8+data);
+uint8_t * icmp=&f[at];
+
+icmp[0]=8;
+icmp[1]=0;
+put16(&icmp[2],0);
+put16(&icmp[4],id);
+put16(&icmp[6],seq);
+for (uint16_t i=0;i<data;i++) icmp[8+i]=(uint8_t)(seq+i*7);
+put16(&icmp[2],fold(sum16(icmp,8+data,0)));
+return (at+8+data);
+}
+// ----------------------------------------------------------------------------
+static uint8_t goodEchoReply(const uint8_t * req,uint16_t reqLength,
+                             const uint8_t * rep,uint16_t repLength)
+{ // Reply must mirror the request, with fresh but valid checksums
+const uint8_t * ip=&rep[14];
+uint16_t ipLength=get16(&ip[2]);
+
+if (repLength<reqLength || (repLength>reqLength && repLength!=60)) return (0);
+if (memcmp(&rep[0],peerMAC,6) || memcmp(&rep[6],ourMAC,6)) return (0);
+if (get16(&rep[12])!=0x0800 || ip[0]!=0x45 || ip[9]!=1) return (0);
+if (ipLength!=get16(&req[16])) return (0);
+if (memcmp(&ip[12],ourIP,4) || memcmp(&ip[16],peerIP,4)) return (0);
+if (fold(sum16(ip,20,0))) return (0);
+if (ip[20]!=0 || ip[21]!=0) return (0);                  // Echo reply
+if (fold(sum16(&ip[20],ipLength-20,0))) return (0);
+return (!memcmp(&ip[24],&req[38],ipLength-24));          // id, seq, data
+}
+// ----------------------------------------------------------------------------
+static void run(void)
+{ // What main.c's loop does for received frames, until the ring is empty
+do {
+  handlePacket();
+#ifdef USE_TCP
+  pumpTCP();
+#endif
+} while (modelPending());
+}
+// ----------------------------------------------------------------------------
+static uint32_t spiCost(const uint8_t * f,uint16_t length)
+{ // SPI bytes to receive and answer one frame
+modelResetStats();
+modelInject(f,length);
+run();
+return (modelStats.spiBytes);
+}
+// ----------------------------------------------------------------------------
+static void scenarioChecksum(void)
+{ // The checksum kernel against sum16() here, for random data, lengths and 
+  // alignments.  And, with REGRESS, its speed (host cycles; TIMER1 on the AVR).
+static uint8_t data[2+1460];
+uint16_t i,ok=TRUE;
+
+for (i=0;i<sizeof(data);i++) data[i]=random32();
+for (i=0;i<1000 && ok;i++) {
+  uint16_t words=random32()%(1+1460/2),at=random32()&1;
+  uint16_t got=checksum((uint16_t *)&data[at],words);
+  uint16_t want=fold(sum16(&data[at],2*words,0));
+  if (got!=BYTESWAP16(want)) ok=FALSE;  // Native (little endian) words here
+}
+check(ok,"Checksum kernel");
+
+// Incremental updates : random headers with a few words rewritten (at times
+// the same word twice), adjusted one by one or all at once; or two swapped
+uint16_t header[30],was[30],now[30],at[30];
+for (i=0,ok=TRUE;i<10000 && ok;i++) {
+  uint16_t words=2+random32()%29,n=1+random32()%5,k,csum,old;
+
+  for (k=0;k<words;k++) header[k]=random32();
+  if (!(random32()%8)) header[0]=header[1]=0xFFFF;  // Edges of 1s complement
+  csum=old=checksum(header,words);
+  if (random32()&1) { // Rewrites
+    for (k=0;k<n;k++) {
+      at[k]=random32()%words;
+      was[k]=header[at[k]];
+      switch (random32()%4) {
+        case 0 :  break;                                          // Unchanged
+        case 1 :  header[at[k]]=(header[at[k]]&0xFF00)|(random32()&0xFF); break;
+        case 2 :  header[at[k]]=0xFFFF-(random32()&1); break;     // Either zero
+        default : header[at[k]]=random32();
+      }
+      now[k]=header[at[k]];
+      csum=checksumAdjust(csum,&was[k],&now[k],1);
+    }
+    if (checksumAdjust(old,was,now,n)!=csum) ok=FALSE;
+  } else {  // Swap : no adjustment
+    uint16_t a=random32()%words,b=random32()%words,t=header[a];
+    header[a]=header[b];
+    header[b]=t;
+  }
+  if (csum!=checksum(header,words)) ok=FALSE;
+}
+check(ok,"Incremental checksum updates");
+
+#ifdef REGRESS
+static const uint16_t sizes[]={CSUM_BENCH_SIZES};
+uint16_t cycles[CSUM_BENCH_RESULTS],n;
+
+checksumBenchmark(data,cycles);
+check(cycles[CSUM_BENCH_RESULTS-1]==0,"Checksum kernel as the portable C");
+for (n=0;n<sizeof(sizes)/sizeof(sizes[0]);n++)
+  printf("Checksum %4u bytes   %3u.%02u cycles/byte (portable C %u.%02u)\n",sizes[n],
+         cycles[2*n]/sizes[n],(100*cycles[2*n]/sizes[n])%100,
+         cycles[2*n+1]/sizes[n],(100*cycles[2*n+1]/sizes[n])%100);
+#endif
+}
+// ----------------------------------------------------------------------------
+static void scenarioARP(void)
+{
+uint16_t length=ethernet(frame,BroadcastMAC.MAC,0x0806);
+uint8_t * arp=&frame[length];
+
+put16(&arp[0],1);
+put16(&arp[2],0x0800);
+arp[4]=6;
+arp[5]=4;
+put16(&arp[6],1);       // Request
+memcpy(&arp[8],peerMAC,6);
+memcpy(&arp[14],peerIP,4);
+memset(&arp[18],0,6);
+memcpy(&arp[24],ourIP,4);
+length+=28;
+
+uint32_t cost=spiCost(frame,length);
+uint16_t got=modelCollect(reply);
+printf("ARP request          %6u SPI bytes\n",cost);
+
+check(got==60,"ARP reply sent");
+check(!memcmp(&reply[0],peerMAC,6),"ARP reply to requester");
+check(get16(&reply[12])==0x0806 && get16(&reply[20])==2,"ARP reply opcode");
+check(!memcmp(&reply[22],ourMAC,6) && !memcmp(&reply[28],ourIP,4),"ARP reply sender");
+check(!memcmp(&reply[32],peerMAC,6) && !memcmp(&reply[38],peerIP,4),"ARP reply target");
+}
+// ----------------------------------------------------------------------------
+static void scenarioPing(uint16_t data)
+{
+uint16_t length=echoRequest(frame,0x4242,data,data);
+uint32_t cost=spiCost(frame,length);
+uint16_t got=modelCollect(reply);
+
+printf("Ping %4u data bytes  %6u SPI bytes\n",data,cost);
+check(got && goodEchoReply(frame,length,reply,got),"Echo reply");
+check(!modelCollect(reply),"Single reply");
+}
+// ----------------------------------------------------------------------------
+static void scenarioUDP(void)
+{
+uint16_t at=ip4(frame,17,8+UNWANTED_DATA);
+uint8_t * udp=&frame[at];
+
+put16(&udp[0],50000);
+put16(&udp[2],50001);   // Nothing listening
+put16(&udp[4],8+UNWANTED_DATA);
+put16(&udp[6],0);
+for (uint16_t i=0;i<UNWANTED_DATA;i++) udp[8+i]=i;
+uint16_t csum=pseudoSum(&frame[14],8+UNWANTED_DATA);
+put16(&udp[6],csum?csum:0xFFFF);
+
+uint32_t cost=spiCost(frame,at+8+UNWANTED_DATA);
+printf("UDP to unused port   %6u SPI bytes\n",cost);
+check(!modelCollect(reply),"UDP ignored");
+check(!modelPending(),"UDP consumed");
+}
+// ----------------------------------------------------------------------------
+static uint16_t boundCalls,boundPort,boundFirst;
+
+static void boundHandler(MergedPacket * Mash,uint8_t flags)
+{ // Bound in scenarioBind()
+boundCalls++;
+boundPort=Mash->UDP.destinationPort;  // Host order by now
+boundFirst=Mash->UDP_payload.bytes[0];
+}
+// ----------------------------------------------------------------------------
+static uint16_t udpTo(uint8_t * f,uint16_t port,uint16_t data)
+{
+uint16_t at=ip4(f,17,8+data);
+uint8_t * udp=&f[at];
+
+put16(&udp[0],50000);
+put16(&udp[2],port);
+put16(&udp[4],8+data);
+put16(&udp[6],0);
+for (uint16_t i=0;i<data;i++) udp[8+i]=0x40+i;
+uint16_t csum=pseudoSum(&f[14],8+data);
+put16(&udp[6],csum?csum:0xFFFF);
+return (at+8+data);
+}
+// ----------------------------------------------------------------------------
+static void scenarioBind(void)
+{ // udpBind() at run time : datagrams reach the handler until udpUnbind().
+  // Then random binds and unbinds, colliding, with the table checked against
+  // a plain list after each.
+#define BIND_TRIES (2000)
+uint16_t length=udpTo(frame,50300,UNWANTED_DATA),i,k,n=0;
+uint16_t ports[UDP_BINDINGS];
+uint8_t ok;
+
+check(udpBind(50300,boundHandler),"Port bound");
+boundCalls=0;
+spiCost(frame,length);
+check(boundCalls==1 && boundPort==50300 && boundFirst==0x40,"Bound port's handler called");
+udpUnbind(50300);
+uint32_t cost=spiCost(frame,length);
+printf("UDP to unbound port  %6u SPI bytes\n",cost);
+check(boundCalls==1 && !modelPending() && cost<UNWANTED_DATA,"Unbound port dropped unread");
+
+udpBind(UDP_ANY_PORT,boundHandler);
+udpUnbind(0);        // A client's port before its first query
+spiCost(frame,length);
+check(boundCalls==2 && boundPort==50300,"Any port handler outlives unbinding port 0");
+udpBind(UDP_ANY_PORT,NULL);
+spiCost(frame,length);
+check(boundCalls==2 && !modelPending(),"Any port handler cleared");
+
+for (i=0,ok=TRUE;i<BIND_TRIES && ok;i++) {
+  uint16_t port=START_DYNAMIC_PORTS+(random32()%64)*8;  // Same home slot, often
+  for (k=0;k<n;k++) if (ports[k]==port) break;
+  if (k<n) {           // Bound : unbind
+    udpUnbind(port);
+    ports[k]=ports[--n];
+  } else if (udpBind(port,boundHandler)) ports[n++]=port;
+  else if (n+2<UDP_BINDINGS) ok=FALSE;  // Only full once mDNS, LLMNR are in too
+  for (k=0;k<n;k++) if (!UDP_Wanted(ports[k],0)) ok=FALSE;
+  if (UDP_Wanted(START_DYNAMIC_PORTS+1,0)) ok=FALSE;  // Never bound
+}
+check(ok,"Port table lookups");
+while (n) udpUnbind(ports[--n]);
+check(UDP_Wanted(LLMNR_PORT,0) && !UDP_Wanted(START_DYNAMIC_PORTS,0),"Port table restored");
+}
+// ----------------------------------------------------------------------------
+static uint16_t peerWindow=1024;  // As the peer advertises
+static uint16_t peerMSS=1460;     // As the peer's SYN offers.  0 : no MSS option
+// ----------------------------------------------------------------------------
+static uint16_t tcpSegmentFrom(uint8_t * f,uint16_t from,uint16_t port,uint8_t flags,
+                               uint32_t seq,uint32_t ack,const char * data)
+{ // From the peer's port 'from' to our 'port'
+uint16_t payload=data?strlen(data):0;
+uint16_t header=((flags&FL_SYN) && peerMSS)?24:20;
+uint16_t at=ip4(f,6,header+payload);
+uint8_t * tcp=&f[at];
+
+put16(&tcp[0],from);
+put16(&tcp[2],port);
+put16(&tcp[4],seq>>16);  put16(&tcp[6],seq&0xFFFF);
+put16(&tcp[8],ack>>16);  put16(&tcp[10],ack&0xFFFF);
+tcp[12]=(header/4)<<4;
+tcp[13]=flags;
+put16(&tcp[14],peerWindow);
+put16(&tcp[16],0);
+put16(&tcp[18],0);
+if (header>20) {
+  tcp[20]=2;  tcp[21]=4;  // MSS
+  put16(&tcp[22],peerMSS);
+}
+if (payload) memcpy(&tcp[header],data,payload);
+put16(&tcp[16],pseudoSum(&f[14],header+payload));
+return (at+header+payload);
+}
+// ----------------------------------------------------------------------------
+static uint16_t tcpSegment(uint8_t * f,uint16_t port,uint8_t flags,uint32_t seq,
+                           uint32_t ack,const char * data)
+{
+return (tcpSegmentFrom(f,40000,port,flags,seq,ack,data));
+}
+// ----------------------------------------------------------------------------
+static uint8_t goodTCP(const uint8_t * f,uint16_t length)
+{ // A well formed segment from us to the peer
+const uint8_t * ip=&f[14];
+if (length<54 || get16(&f[12])!=0x0800 || ip[9]!=6) return (0);
+if (fold(sum16(ip,20,0))) return (0);
+return (!pseudoSum(ip,get16(&ip[2])-20));
+}
+// ----------------------------------------------------------------------------
+static uint32_t get32(const uint8_t * p) { return (((uint32_t)get16(p)<<16)|get16(&p[2])); }
+// ----------------------------------------------------------------------------
+static uint16_t withOptions(uint8_t * f,uint16_t length)
+{ // The frame given, its IP header grown by 4 bytes of options (NOP, EOL)
+uint8_t * ip=&f[14];
+
+memmove(&f[38],&f[34],length-34);
+ip[20]=ip[21]=ip[22]=1;
+ip[23]=0;
+ip[0]=0x46;
+put16(&ip[2],get16(&ip[2])+4);
+put16(&ip[10],0);
+put16(&ip[10],fold(sum16(ip,24,0)));
+return (length+4);
+}
+// ----------------------------------------------------------------------------
+static void scenarioIPOptions(void)
+{ // Segments and datagrams with IP options : answered and delivered as any
+  // other, the options being stepped over.  With a bad checksum, dropped.
+uint16_t got,length;
+
+spiCost(frame,withOptions(frame,tcpSegmentFrom(frame,46200,80,FL_SYN,95000,0,NULL)));
+got=modelCollect(reply);
+check(got && goodTCP(reply,got) && reply[47]==(FL_SYN|FL_ACK) && get32(&reply[42])==95001,
+      "SYN with IP options answered");
+spiCost(frame,tcpSegmentFrom(frame,46200,80,FL_RST,95001,0,NULL));
+
+udpBind(50300,boundHandler);
+boundCalls=0;
+spiCost(frame,withOptions(frame,udpTo(frame,50300,UNWANTED_DATA)));
+check(boundCalls==1 && boundFirst==0x40,"UDP with IP options delivered");
+
+length=withOptions(frame,udpTo(frame,50300,UNWANTED_DATA));
+frame[length-1]^=0x01;
+spiCost(frame,length);
+length=withOptions(frame,tcpSegmentFrom(frame,46201,80,FL_SYN,96000,0,NULL));
+frame[length-1]^=0x01;  // The MSS option
+spiCost(frame,length);
+check(boundCalls==1 && !modelCollect(reply) && !modelPending(),"Bad checksums dropped");
+udpUnbind(50300);
+}
+// ----------------------------------------------------------------------------
+static void scenarioTCP(void)
+{
+uint32_t seq=1000,theirs;
+uint16_t got,length;
+uint32_t cost;
+
+length=tcpSegment(frame,80,FL_SYN,seq,0,NULL);
+cost=spiCost(frame,length);
+got=modelCollect(reply);
+printf("TCP SYN              %6u SPI bytes\n",cost);
+check(got && goodTCP(reply,got),"SYN-ACK well formed");
+check(reply[47]==(FL_SYN|FL_ACK) && get32(&reply[42])==seq+1,"SYN-ACK flags, ack");
+check((reply[46]>>4)==6 && reply[54]==2 && reply[55]==4 && get16(&reply[56])==536,
+      "SYN-ACK offers MSS 536");
+theirs=get32(&reply[38])+1;
+seq++;
+
+length=tcpSegment(frame,80,FL_ACK,seq,theirs,NULL);
+cost=spiCost(frame,length);
+printf("TCP ACK              %6u SPI bytes\n",cost);
+check(!modelCollect(reply),"Bare ACK not answered");
+
+const char * get="GET / HTTP/1.1\r\n\r\n";
+length=tcpSegment(frame,80,FL_ACK|FL_PSH,seq,theirs,get);
+cost=spiCost(frame,length);
+
+uint8_t sawPage=FALSE,sawFin=FALSE,bare=FALSE,frames=0;
+while ((got=modelCollect(reply))) {
+  check(goodTCP(reply,got),"Response segment well formed");
+  uint16_t payload=get16(&reply[16])-40;
+  if (payload && !memcmp(&reply[54],"HTTP/1.1 200 OK",15)) sawPage=TRUE;
+  if (reply[47]&FL_FIN) sawFin=TRUE;
+  if (!payload && reply[47]==FL_ACK) bare=TRUE;
+  frames++;
+}
+printf("TCP GET /            %6u SPI bytes, %u frames back\n",cost,frames);
+check(sawPage,"HTTP page served");
+check(sawFin,"Connection closed");
+check(!bare,"The page carries the ACK for the GET");
+}
+// ----------------------------------------------------------------------------
+static void scenarioConcurrent(void)
+{ // A browser for each server TCB, all with a GET outstanding at once, and one
+  // more caller that the full pool refuses
+#define CALLERS (TCP_SERVERS+1)
+uint32_t seq[CALLERS],theirs[CALLERS],cost=0;
+uint8_t  sawPage[CALLERS],sawFin[CALLERS];
+uint16_t got,i,served=0;
+const char * get="GET / HTTP/1.1\r\n\r\n";
+
+spiCost(frame,tcpSegment(frame,80,FL_RST,0,0,NULL));  // Free the server from scenarioTCP
+
+for (i=0;i<CALLERS;i++) {
+  seq[i]=5000+1000*i;
+  sawPage[i]=sawFin[i]=FALSE;
+  cost+=spiCost(frame,tcpSegmentFrom(frame,41000+i,80,FL_SYN,seq[i],0,NULL));
+  got=modelCollect(reply);
+  check(got && goodTCP(reply,got) && get32(&reply[42])==seq[i]+1,"Pool SYN answered");
+  if (i<TCP_SERVERS) check(reply[47]==(FL_SYN|FL_ACK),"Pool SYN-ACK while a TCB free");
+#ifdef USE_SYN_COOKIES
+  else check(reply[47]==(FL_SYN|FL_ACK),"SYN-ACK, with a cookie, once the pool is full");
+#else
+  else               check(reply[47]&FL_RST,"RST once the pool is full");
+#endif
+  theirs[i]=get32(&reply[38])+1;
+  seq[i]++;
+}
+for (i=0;i<TCP_SERVERS;i++) {
+  cost+=spiCost(frame,tcpSegmentFrom(frame,41000+i,80,FL_ACK,seq[i],theirs[i],NULL));
+  cost+=spiCost(frame,tcpSegmentFrom(frame,41000+i,80,FL_ACK|FL_PSH,seq[i],theirs[i],get));
+  seq[i]+=strlen(get);
+}
+while ((got=modelCollect(reply))) {  // Replies all together, sorted by caller
+  check(goodTCP(reply,got),"Pool response well formed");
+  i=get16(&reply[36])-41000;
+  if (i>=TCP_SERVERS) { check(FALSE,"Pool response to a caller"); continue; }
+  uint16_t payload=get16(&reply[16])-40;
+  if (payload && !memcmp(&reply[54],"HTTP/1.1 200 OK",15)) sawPage[i]=TRUE;
+  if (reply[47]&FL_FIN) {
+    sawFin[i]=TRUE;
+    theirs[i]=get32(&reply[38])+payload+1;
+  }
+}
+for (i=0;i<TCP_SERVERS;i++) {
+  check(sawPage[i] && sawFin[i],"Every pooled connection served and closed");
+  if (sawPage[i]) served++;
+  cost+=spiCost(frame,tcpSegmentFrom(frame,41000+i,80,FL_FIN|FL_ACK,seq[i],theirs[i],NULL));
+  check(modelCollect(reply) && reply[47]==FL_ACK,"Pooled connection's FIN acknowledged");
+}
+printf("Concurrent GETs      %6u served, %u SPI bytes each\n",served,
+       (unsigned)(served?cost/served:0));
+
+cost=spiCost(frame,tcpSegmentFrom(frame,41000+TCP_SERVERS,80,FL_SYN,seq[TCP_SERVERS],0,NULL));
+got=modelCollect(reply);
+check(got && reply[47]==(FL_SYN|FL_ACK),"Pool has room again once closed");
+spiCost(frame,tcpSegmentFrom(frame,41000+TCP_SERVERS,80,FL_RST,seq[TCP_SERVERS]+1,0,NULL));
+}
+// ----------------------------------------------------------------------------
+static uint16_t tcpWait(uint16_t limit)
+{ // The TCP clock ticks on, with retxTCP() between ticks as main.c's loop would
+  // call it, until it talks to the ENC28J60 (to resend) or 'limit' ms pass.
+  // Returns ms passed.
+uint32_t ticks,spi=modelStats.spiBytes;
+
+for (ticks=1;ticks*1000<=(uint32_t)limit*TIMER_TICKS;ticks++) {
+  tickTCP();
+  retxTCP();
+  pumpTCP();
+  if (modelStats.spiBytes!=spi) break;
+}
+return ((ticks*1000+TIMER_TICKS/2)/TIMER_TICKS);
+}
+// ----------------------------------------------------------------------------
+static uint8_t serverRole(uint16_t from)
+{ // The server TCB open to the peer's port 'from', else MAX_TCP_ROLES
+extern TCP_TCB TCB[MAX_TCP_ROLES];
+uint8_t role;
+
+for (role=TCP_SERVER;role<MAX_TCP_ROLES;role++)
+  if (TCB[role].status!=TCP_CLOSED && TCB[role].remotePort==from) break;
+return (role);
+}
+// ----------------------------------------------------------------------------
+static uint16_t lostPage(uint16_t from,uint32_t seq,uint32_t theirs,uint8_t * sent)
+{ // GET on an open connection, from the peer's port 'from', with the page lost
+  // on the way : it is left in 'sent'.  Returns its length.
+const char * get="GET / HTTP/1.1\r\n\r\n";
+uint16_t got,length=0;
+
+spiCost(frame,tcpSegmentFrom(frame,from,80,FL_ACK|FL_PSH,seq,theirs,get));
+while ((got=modelCollect(reply)))
+  if (get16(&reply[16])>40 && !memcmp(&reply[54],"HTTP/1.1 200 OK",15)) {
+    memcpy(sent,reply,got);
+    length=got;
+  }
+return (length);
+}
+// ----------------------------------------------------------------------------
+static void scenarioRetransmit(void)
+{ // Segments the peer never ACKs come again, sent from where the ENC28J60 keeps
+  // them : only the ack (if it has moved on), window and checksum are rewritten
+  // over SPI
+extern TCP_TCB TCB[MAX_TCP_ROLES];
+static uint8_t sent[MODEL_MAX_FRAME];
+uint32_t seq=9000,theirs,cost;
+uint16_t got,length,ms;
+uint8_t role,resent,resends;
+
+spiCost(frame,tcpSegmentFrom(frame,42000,80,FL_SYN,seq,0,NULL));
+length=modelCollect(sent);  // The SYN-ACK, as first sent
+modelResetStats();
+ms=tcpWait(3*TCP_RTO_INITIAL);
+cost=modelStats.spiBytes;
+got=modelCollect(reply);
+check(got && got==length && !memcmp(reply,sent,got),"SYN-ACK sent again as it was");
+check(ms>=TCP_RTO_INITIAL && ms<=TCP_RTO_INITIAL+5,"SYN-ACK resent after the initial RTO");
+printf("TCP SYN-ACK resent   %6u SPI bytes, after %u ms\n",cost,ms);
+theirs=get32(&reply[38])+1;
+seq++;
+
+spiCost(frame,tcpSegmentFrom(frame,42000,80,FL_ACK,seq,theirs,NULL));
+tcpWait(3*TCP_RTO_INITIAL);
+check(!modelCollect(reply),"ACK'd SYN-ACK not sent again");
+
+length=lostPage(42000,seq,theirs,sent);
+check(length,"Page sent");
+seq+=18;  // strlen(GET)
+
+role=serverRole(42000);
+if (role==MAX_TCP_ROLES) { check(FALSE,"Retransmitting connection open"); return; }
+check(TCB[role].rto==TCP_RTO_INITIAL,"No RTT from a segment resent (Karn)");
+TCB[role].lastByteReceived++;  // As if more had come since : the ack moves on
+
+modelResetStats();
+tcpWait(3*TCP_RTO_INITIAL);
+cost=modelStats.spiBytes;
+resent=FALSE;
+while ((got=modelCollect(reply))) {
+  check(goodTCP(reply,got),"Resent segment well formed");
+  if (got==length && !memcmp(&reply[54],&sent[54],length-54)) {
+    resent=TRUE;
+    check(get32(&reply[42])==seq+1,"Resent with the ack moved on");
+  }
+}
+check(resent,"Lost page sent again");
+printf("TCP page, FIN resent %6u SPI bytes (%u byte page)\n",cost,length);
+
+resends=1;
+ms=0;
+while (TCB[role].status!=TCP_CLOSED && ms<60000) {
+  ms+=tcpWait(1000);
+  while ((got=modelCollect(reply)))
+    if (got==length && !memcmp(&reply[54],&sent[54],length-54)) resends++;
+}
+check(TCB[role].status==TCP_CLOSED && !ActiveReTx(role),"Closed once retries run out");
+check(resends==TCP_RETRIES,"Resent as often as TCP_RETRIES");
+printf("TCP unanswered       %u resends, closed %u ms after the first\n",resends,ms);
+}
+// ----------------------------------------------------------------------------
+static void scenarioRTO(void)
+{ // The RTO follows the RTT measured : a peer whose handshake ACK takes 'rtt' 
+  // ms sees a lost page again after 3*rtt (first sample : srtt=rtt, rttvar=rtt/2),
+  // within TCP_RTO_MIN..TCP_RTO_MAX
+static const uint16_t rtts[]={1,10,400};
+static uint8_t sent[MODEL_MAX_FRAME];
+uint32_t seq,theirs;
+uint16_t i,ms,want;
+
+for (i=0;i<sizeof(rtts)/sizeof(rtts[0]);i++) {
+  uint16_t from=43000+i;
+  seq=20000*(i+1);
+  spiCost(frame,tcpSegmentFrom(frame,from,80,FL_SYN,seq,0,NULL));
+  modelCollect(reply);
+  theirs=get32(&reply[38])+1;
+  seq++;
+  ms=tcpWait(rtts[i]);   // The round trip
+  check(!modelCollect(reply),"Nothing resent within the RTT");
+  spiCost(frame,tcpSegmentFrom(frame,from,80,FL_ACK,seq,theirs,NULL));
+
+  check(lostPage(from,seq,theirs,sent),"Page sent");
+  ms=tcpWait(TCP_RTO_MAX);
+  want=3*rtts[i];
+  if (want<TCP_RTO_MIN) want=TCP_RTO_MIN;
+  check(modelCollect(reply) && ms+10>=want && ms<=want+10,"Lost page resent after the RTO");
+  printf("TCP RTO, %3u ms RTT  resent after %u ms\n",rtts[i],ms);
+  while (modelCollect(reply)) ;
+
+  spiCost(frame,tcpSegmentFrom(frame,from,80,FL_RST,seq+18,0,NULL));
+}
+}
+// ----------------------------------------------------------------------------
+#define STREAM_LENGTH (20000)
+
+static uint16_t streamData(uint16_t start,uint16_t length,uint8_t * result)
+{ // A page made on demand, as IconData() and the like are
+uint16_t i;
+
+for (i=0;i<length;i++) result[i]=(uint8_t)((start+i)*7+((start+i)>>8));
+return (STREAM_LENGTH);
+}
+// ----------------------------------------------------------------------------
+static uint8_t streamed[STREAM_LENGTH];
+static uint32_t streamNext,streamAcked,streamFlight;  // Offsets in the page
+static uint16_t streamLargest;  // Segment
+static uint8_t streamFin;
+// ----------------------------------------------------------------------------
+static uint16_t streamRound(uint16_t from,uint32_t seq,uint32_t base,uint8_t lose)
+{ // The peer takes what has come, in order, the 'lose'th segment (from 1) lost
+  // on the way, and ACKs it.  Returns segments that came.
+uint16_t got,length,segments=0;
+uint32_t at;
+
+while ((got=modelCollect(reply))) {
+  check(goodTCP(reply,got),"Streamed segment well formed");
+  length=get16(&reply[16])-40;
+  at=get32(&reply[38])-base;
+  if (length>streamLargest) streamLargest=length;
+  if (at+length>streamAcked && at+length-streamAcked>streamFlight) 
+    streamFlight=at+length-streamAcked;
+  if (++segments==lose) continue;
+  if (at==streamNext && at+length<=STREAM_LENGTH) {
+    memcpy(&streamed[at],&reply[54],length);
+    streamNext+=length;
+    if (reply[47]&FL_FIN) streamFin=TRUE;
+  }
+}
+if (streamNext>streamAcked) {
+  streamAcked=streamNext;
+  spiCost(frame,tcpSegmentFrom(frame,from,80,FL_ACK,seq,base+streamNext+streamFin,NULL));
+}
+return (segments);
+}
+// ----------------------------------------------------------------------------
+static void scenarioStream(void)
+{ // A page bigger than the window, made by a callback, then FIN : queued, and sent
+  // as ACKs come, never more in flight than the peer's window or the congestion
+  // window, in segments as large as the peer's MSS allows.  With a segment lost, 
+  // that one is made again from its offset.
+static const uint16_t windows[]={2920,0xFFFF,0xFFFF};
+static const uint16_t msss[]   ={1460,1460,0};  // 0 : none offered, so 536
+extern TCP_TCB TCB[MAX_TCP_ROLES];
+void TCP_FIN(MergedPacket * Mash,uint8_t role);
+uint32_t seq,base,spi;
+uint16_t i,from,rounds,first,ms,mss,segments;
+uint8_t role;
+
+for (i=0;i<sizeof(windows)/sizeof(windows[0]);i++) {
+  from=44000+i;
+  seq=50000;
+  peerWindow=windows[i];
+  peerMSS=msss[i];
+  mss=msss[i]?msss[i]:TCP_MSS_DEFAULT;
+  spiCost(frame,tcpSegmentFrom(frame,from,80,FL_SYN,seq,0,NULL));
+  modelCollect(reply);
+  base=get32(&reply[38])+1;
+  seq++;
+  spiCost(frame,tcpSegmentFrom(frame,from,80,FL_ACK,seq,base,NULL));
+  role=serverRole(from);
+  if (role==MAX_TCP_ROLES) { check(FALSE,"Streaming connection open"); break; }
+
+  check(TCB[role].mss==mss,"Peer's MSS taken");
+
+  memset(streamed,0,sizeof(streamed));
+  streamNext=streamAcked=streamFlight=streamLargest=0;
+  streamFin=FALSE;
+  modelResetStats();
+  TCP_ComplexDataOut(&MashE,role,STREAM_LENGTH,&streamData,0,TRUE);
+  TCP_FIN(&MashE,role);
+  spi=modelStats.spiBytes;
+
+  segments=first=streamRound(from,seq,base,0);
+  check(first==(TCP_CWND_SEGMENTS*mss<windows[i]?TCP_CWND_SEGMENTS*mss:windows[i])/mss,
+        "First flight fills the window");
+  for (rounds=1;!streamFin && rounds<100;rounds++) {
+    spi+=modelStats.spiBytes;
+    modelResetStats();
+    if (rounds==3) {  // Lose one
+      segments+=streamRound(from,seq,base,1);
+      ms=tcpWait(3*TCP_RTO_INITIAL);
+      check(ms>=TCP_RTO_MIN && ms<3*TCP_RTO_INITIAL,"Lost segment resent");
+      check(TCB[role].cwnd==mss,"Congestion window back to a segment");
+    } else {
+      first=streamRound(from,seq,base,0);
+      segments+=first;
+      if (!first) tcpWait(TCP_RTO_MAX);  // Until resent
+    }
+  }
+  spi+=modelStats.spiBytes;
+  check(streamFin && streamNext==STREAM_LENGTH,"Whole page, then FIN");
+  for (streamNext=0;streamNext<STREAM_LENGTH;streamNext++) {
+    uint8_t byte;
+    streamData(streamNext,1,&byte);
+    if (streamed[streamNext]!=byte) break;
+  }
+  check(streamNext==STREAM_LENGTH,"Page as made");
+  check(streamFlight<=windows[i],"Never more in flight than the peer's window");
+  check(streamLargest==mss,"Segments as large as the MSS, no larger");
+  printf("TCP stream, %5u win %4u MSS %2u segments %u rounds, %u in flight at most, "
+         "%.2f SPI bytes a byte\n",windows[i],mss,segments,rounds,(unsigned)streamFlight,
+         (double)spi/STREAM_LENGTH);
+
+  spiCost(frame,tcpSegmentFrom(frame,from,80,FL_FIN|FL_ACK,seq,base+STREAM_LENGTH+1,NULL));
+  check(modelCollect(reply) && TCB[role].status==TCP_CLOSED,"Closed");
+}
+
+// Data in RAM (no callback) bigger than a small MSS : each segment carries on
+// from the last
+{
+static char text[201];
+uint16_t got,length=0;
+uint8_t ok=TRUE;
+
+for (i=0;i<sizeof(text)-1;i++) text[i]='A'+i%26;
+peerWindow=0xFFFF;
+peerMSS=64;
+spiCost(frame,tcpSegmentFrom(frame,44100,80,FL_SYN,seq,0,NULL));
+modelCollect(reply);
+base=get32(&reply[38])+1;
+spiCost(frame,tcpSegmentFrom(frame,44100,80,FL_ACK,seq+1,base,NULL));
+role=serverRole(44100);
+if (role==MAX_TCP_ROLES) check(FALSE,"Small MSS connection open");
+else {
+  TCP_SimpleDataOut(text,role,TRUE);
+  while ((got=modelCollect(reply))) {
+    ok&=(goodTCP(reply,got) && get32(&reply[38])==base+length && got-54<=64 &&
+         !memcmp(&reply[54],&text[length],got-54));
+    length+=got-54;
+  }
+  check(ok && length==sizeof(text)-1,"Data in RAM split by a small MSS, in order");
+  spiCost(frame,tcpSegmentFrom(frame,44100,80,FL_RST,seq+1,0,NULL));
+  while (modelCollect(reply)) ;
+}
+}
+
+// The peer's window shut, and the update that opens it lost : probes find it
+{
+uint16_t got,waits[2];
+uint8_t byte;
+
+peerMSS=1460;
+spiCost(frame,tcpSegmentFrom(frame,44200,80,FL_SYN,seq,0,NULL));
+modelCollect(reply);
+base=get32(&reply[38])+1;
+seq++;
+peerWindow=0;
+spiCost(frame,tcpSegmentFrom(frame,44200,80,FL_ACK,seq,base,NULL));
+role=serverRole(44200);
+if (role==MAX_TCP_ROLES) check(FALSE,"Zero window connection open");
+else {
+  TCP_ComplexDataOut(&MashE,role,1000,&streamData,0,TRUE);
+  check(!modelCollect(reply),"Nothing sent into a shut window");
+  for (i=0;i<2;i++) {  // Refused
+    waits[i]=tcpWait(TCP_RTO_MAX);
+    got=modelCollect(reply);
+    streamData(0,1,&byte);
+    check(got && goodTCP(reply,got) && get16(&reply[16])-40==1 && 
+          get32(&reply[38])==base && reply[54]==byte,"Probe : the next byte, alone");
+    spiCost(frame,tcpSegmentFrom(frame,44200,80,FL_ACK,seq,base,NULL));
+    check(!modelCollect(reply),"Refused probe : still shut");
+  }
+  check(waits[0]>=TCB[role].rto && waits[1]>=2*TCB[role].rto,"Probes on the RTO, backing off");
+  tcpWait(TCP_RTO_MAX);
+  got=modelCollect(reply);
+  check(got && get32(&reply[38])==base,"Probed again");
+  peerWindow=0xFFFF;  // Taken, and the window open
+  spiCost(frame,tcpSegmentFrom(frame,44200,80,FL_ACK,seq,base+1,NULL));
+  got=modelCollect(reply);
+  streamData(1,1,&byte);
+  check(got && goodTCP(reply,got) && get32(&reply[38])==base+1 && 
+        get16(&reply[16])-40==999 && reply[54]==byte,"Then the rest goes");
+  spiCost(frame,tcpSegmentFrom(frame,44200,80,FL_ACK,seq,base+1000,NULL));
+  TCP_FIN(&MashE,role);
+  got=modelCollect(reply);
+  check(got && (reply[47]&FL_FIN) && get32(&reply[38])==base+1000,"All sent : FIN goes at once");
+  spiCost(frame,tcpSegmentFrom(frame,44200,80,FL_RST,seq,0,NULL));
+}
+}
+peerWindow=1024;
+peerMSS=1460;
+}
+// ----------------------------------------------------------------------------
+#ifdef USE_TCP_REORDER
+static void scenarioReorder(void)
+{ // A GET overtakes the segment before it : held in the SRAM, then delivered 
+  // once that comes, so the page is sent.  Meanwhile, duplicate ACKs.  One
+  // beyond the window we advertise is dropped.
+const char * gap="\r\n\r\n\r\n\r\n";  // Not a GET
+const char * get="GET / HTTP/1.1\r\n\r\n";
+uint32_t seq=70000,theirs,cost;
+uint16_t got;
+uint8_t page=FALSE,acked=FALSE;
+
+spiCost(frame,tcpSegmentFrom(frame,45000,80,FL_SYN,seq,0,NULL));
+modelCollect(reply);
+theirs=get32(&reply[38])+1;
+seq++;
+spiCost(frame,tcpSegmentFrom(frame,45000,80,FL_ACK,seq,theirs,NULL));
+
+cost=spiCost(frame,tcpSegmentFrom(frame,45000,80,FL_ACK|FL_PSH,seq+8,theirs,get));
+got=modelCollect(reply);
+check(got && get32(&reply[42])==seq && !modelCollect(reply),"Held, with a duplicate ACK");
+spiCost(frame,tcpSegmentFrom(frame,45000,80,FL_ACK|FL_PSH,seq+8,theirs,get));
+got=modelCollect(reply);
+check(got && get32(&reply[42])==seq && !modelCollect(reply),"Held twice, the same");
+spiCost(frame,tcpSegmentFrom(frame,45000,80,FL_ACK|FL_PSH,seq+get16(&reply[48]),theirs,get));
+check(!modelCollect(reply),"Beyond the window, dropped");
+
+spiCost(frame,tcpSegmentFrom(frame,45000,80,FL_ACK|FL_PSH,seq,theirs,gap));
+while ((got=modelCollect(reply))) {
+  if (get32(&reply[42])==seq+8+18) acked=TRUE;
+  if (get16(&reply[16])>40 && !memcmp(&reply[54],"HTTP/1.1 200 OK",15)) page=TRUE;
+}
+check(page,"Held GET delivered once the gap filled");
+check(acked,"ACK'd through what was held");
+printf("TCP out of order     %6u SPI bytes to hold a GET\n",cost);
+
+spiCost(frame,tcpSegmentFrom(frame,45000,80,FL_RST,seq+8+18,0,NULL));
+}
+#endif
+// ----------------------------------------------------------------------------
+static void scenarioDelayedACK(void)
+{ // Data that makes no reply is ACK'd alone, but only after TCP_ACK_DELAY, or 
+  // at once for every TCP_ACK_SEGMENTS.  A reply carries the ACK instead.
+const char * line="\r\n";  // Not a GET
+const char * get="GET / HTTP/1.1\r\n\r\n";
+uint32_t seq=80000,theirs;
+uint16_t got,ms;
+uint8_t bare=FALSE,acked=FALSE;
+
+spiCost(frame,tcpSegmentFrom(frame,46000,80,FL_SYN,seq,0,NULL));
+modelCollect(reply);
+theirs=get32(&reply[38])+1;
+seq++;
+spiCost(frame,tcpSegmentFrom(frame,46000,80,FL_ACK,seq,theirs,NULL));
+
+spiCost(frame,tcpSegmentFrom(frame,46000,80,FL_ACK|FL_PSH,seq,theirs,line));
+seq+=strlen(line);
+check(!modelCollect(reply),"ACK delayed");
+ms=tcpWait(TCP_RTO_MAX);
+got=modelCollect(reply);
+check(got && reply[47]==FL_ACK && get32(&reply[42])==seq,"Delayed ACK sent");
+check(ms>=TCP_ACK_DELAY && ms<TCP_ACK_DELAY+20,"... after TCP_ACK_DELAY");
+printf("TCP delayed ACK      %6u ms\n",ms);
+
+spiCost(frame,tcpSegmentFrom(frame,46000,80,FL_ACK|FL_PSH,seq,theirs,line));
+seq+=strlen(line);
+check(!modelCollect(reply),"First segment's ACK delayed");
+spiCost(frame,tcpSegmentFrom(frame,46000,80,FL_ACK|FL_PSH,seq,theirs,line));
+seq+=strlen(line);
+got=modelCollect(reply);
+check(got && get32(&reply[42])==seq,"Second segment ACK'd at once, with the first");
+
+spiCost(frame,tcpSegmentFrom(frame,46000,80,FL_ACK|FL_PSH,seq,theirs,get));
+seq+=strlen(get);
+while ((got=modelCollect(reply))) {
+  uint16_t payload=get16(&reply[16])-40;
+  if (!payload && reply[47]==FL_ACK) bare=TRUE;
+  if (payload && get32(&reply[42])==seq) acked=TRUE;
+  if (reply[47]&FL_FIN) theirs=get32(&reply[38])+payload+1;
+}
+check(!bare && acked,"Reply carries the ACK");
+spiCost(frame,tcpSegmentFrom(frame,46000,80,FL_ACK,seq,theirs,NULL));  // No resends
+tcpWait(2*TCP_ACK_DELAY);
+check(!modelCollect(reply),"Nothing owed once carried");
+
+spiCost(frame,tcpSegmentFrom(frame,46000,80,FL_RST,seq,0,NULL));
+}
+// ----------------------------------------------------------------------------
+#define BURST_BYTES   (12000)
+#define BURST_SEGMENT (500)
+
+static void scenarioRxWindow(void)
+{ // A peer that sends all our window allows at once, faster than we take it : 
+  // the window follows the room in the RX ring, so nothing is lost to overflow.
+  // Its edge never moves back.
+static char data[BURST_SEGMENT+1];
+uint32_t seq=90000,theirs,next,edge,acked;
+uint16_t got,rounds=0,first=0;
+uint8_t  back=FALSE;
+
+memset(data,' ',BURST_SEGMENT);  // Not a GET
+spiCost(frame,tcpSegmentFrom(frame,46100,80,FL_SYN,seq,0,NULL));
+modelCollect(reply);
+check(get16(&reply[48])==TCP_WINDOW_SYN,"SYN-ACK offers what an empty RX ring holds");
+theirs=get32(&reply[38])+1;
+acked=next=++seq;
+edge=seq+get16(&reply[48]);
+spiCost(frame,tcpSegmentFrom(frame,46100,80,FL_ACK,seq,theirs,NULL));
+
+modelResetStats();
+while (acked<seq+BURST_BYTES && rounds++<100) {
+  while (next+BURST_SEGMENT<=edge && next<seq+BURST_BYTES) {  // All at once
+    modelInject(frame,tcpSegmentFrom(frame,46100,80,FL_ACK|FL_PSH,next,theirs,data));
+    next+=BURST_SEGMENT;
+  }
+  run();
+  if (!modelPending()) tcpWait(TCP_RTO_MAX);  // Any ACK delayed, or update
+  while ((got=modelCollect(reply))) {
+    if (get32(&reply[42])+get16(&reply[48])<edge) back=TRUE;
+    else edge=get32(&reply[42])+get16(&reply[48]);
+    acked=get32(&reply[42]);
+    if (!first) first=get16(&reply[48]);
+  }
+}
+check(acked==seq+BURST_BYTES,"All taken");
+check(!modelStats.framesOverflow,"... none lost to RX overflow");
+check(first<TCP_WINDOW_SYN-2*BURST_SEGMENT+TCP_WINDOW_STEP,"Window held while the ring is full");
+check(!back,"Window's edge never moved back");
+printf("RX window            %6u bytes in %u bursts, %u frames lost\n",BURST_BYTES,rounds,
+       (unsigned)modelStats.framesOverflow);
+
+spiCost(frame,tcpSegmentFrom(frame,46100,80,FL_RST,acked,0,NULL));
+}
+// ----------------------------------------------------------------------------
+#ifdef USE_SYN_COOKIES
+#define FLOOD_SYNS (200)
+
+static void scenarioSynFlood(void)
+{ // SYNs from callers that never ACK : the pool's TCBs are left half open, and 
+  // the rest get cookies, at no TCB.  A real browser among them is still served,
+  // its ACK bringing back its cookie to take a half open TCB.  A cookie forged,
+  // or stale, opens nothing.
+extern TCP_TCB TCB[MAX_TCP_ROLES];
+const char * get="GET / HTTP/1.1\r\n\r\n";
+uint32_t seq=90000,theirs,stale,cost=0;
+uint16_t i,got,synAcks=0,ms;
+uint8_t  role,half=0,page=FALSE;
+
+for (i=0;i<FLOOD_SYNS;i++) {
+  cost+=spiCost(frame,tcpSegmentFrom(frame,47000+i,80,FL_SYN,random32(),0,NULL));
+  got=modelCollect(reply);
+  if (got && goodTCP(reply,got) && reply[47]==(FL_SYN|FL_ACK)) synAcks++;
+}
+for (role=TCP_SERVER;role<MAX_TCP_ROLES;role++) if (TCB[role].status==TCP_SYN_RCVD) half++;
+check(synAcks==FLOOD_SYNS,"Every SYN of the flood answered");
+check(half==TCP_SERVERS,"No more half open than the pool");
+printf("SYN flood            %6u SYNs, %u TCBs half open, %u SPI bytes a SYN\n",
+       FLOOD_SYNS,half,(unsigned)(cost/FLOOD_SYNS));
+
+spiCost(frame,tcpSegmentFrom(frame,48002,80,FL_SYN,seq,0,NULL));  // To keep
+modelCollect(reply);
+stale=get32(&reply[38])+1;
+
+spiCost(frame,tcpSegmentFrom(frame,48000,80,FL_SYN,seq,0,NULL));
+got=modelCollect(reply);
+check(got && reply[47]==(FL_SYN|FL_ACK) && get32(&reply[42])==seq+1,"Browser's SYN answered");
+check(serverRole(48000)==MAX_TCP_ROLES,"... at no TCB");
+theirs=get32(&reply[38])+1;
+seq++;
+
+spiCost(frame,tcpSegmentFrom(frame,48001,80,FL_ACK,seq,theirs,NULL));
+check(!modelCollect(reply) && serverRole(48001)==MAX_TCP_ROLES,"Cookie from another port refused");
+spiCost(frame,tcpSegmentFrom(frame,48000,80,FL_ACK,seq+1,theirs,NULL));
+check(!modelCollect(reply) && serverRole(48000)==MAX_TCP_ROLES,"Cookie with another sequence refused");
+
+spiCost(frame,tcpSegmentFrom(frame,48000,80,FL_ACK|FL_PSH,seq,theirs,get));
+role=serverRole(48000);
+check(role!=MAX_TCP_ROLES && TCB[role].mss==1460,"Cookie opens a TCB, with the MSS offered");
+while ((got=modelCollect(reply)))
+  if (get16(&reply[16])>40 && !memcmp(&reply[54],"HTTP/1.1 200 OK",15) &&
+      get32(&reply[42])==seq+strlen(get)) page=TRUE;
+check(page,"Browser served through the flood");
+spiCost(frame,tcpSegmentFrom(frame,48000,80,FL_RST,seq+strlen(get),0,NULL));
+
+for (ms=0;ms<20000;ms+=tcpWait(20000-ms)) while (modelCollect(reply)) ;
+spiCost(frame,tcpSegmentFrom(frame,48002,80,FL_ACK,seq,stale,NULL));
+check(!modelCollect(reply) && serverRole(48002)==MAX_TCP_ROLES,"Stale cookie refused");
+for (role=TCP_SERVER;role<MAX_TCP_ROLES;role++) 
+  check(TCB[role].status==TCP_CLOSED,"Flood's half open TCBs given up");
+}
+#endif
+// ----------------------------------------------------------------------------
+static void scenarioUnwanted(void)
+{ // Frames that pass the chip's filters, but that nothing here will act on
+static char data[UNWANTED_DATA+1];
+uint32_t cost;
+
+memset(data,'x',UNWANTED_DATA);
+cost=spiCost(frame,tcpSegment(frame,8080,FL_ACK|FL_PSH,1,1,data));
+printf("TCP to closed port   %6u SPI bytes\n",cost);
+check(!modelCollect(reply) && !modelPending(),"TCP to closed port ignored");
+
+uint16_t length=echoRequest(frame,0x4343,1,UNWANTED_DATA);
+frame[14+19]=200;     // Another host on the LAN
+put16(&frame[14+10],0);
+put16(&frame[14+10],fold(sum16(&frame[14],20,0)));
+cost=spiCost(frame,length);
+printf("Ping for another IP  %6u SPI bytes\n",cost);
+check(!modelCollect(reply) && !modelPending(),"Ping for another IP ignored");
+}
+// ----------------------------------------------------------------------------
+static uint16_t fromAfar(uint8_t * f,uint16_t length)
+{ // Readdresses a TCP segment from the peer as from farIP, the peer routing it
+memcpy(&f[14+12],farIP,4);
+put16(&f[14+10],0);
+put16(&f[14+10],fold(sum16(&f[14],20,0)));
+put16(&f[34+16],0);
+put16(&f[34+16],pseudoSum(&f[14],length-34));
+return (length);
+}
+// ----------------------------------------------------------------------------
+static uint8_t isRequestForPeer(const uint8_t * f,uint16_t length,const uint8_t * to)
+{ // ARP request, from us to MAC 'to', for the peer (our gateway)
+return (length>=42 && !memcmp(&f[0],to,6) && get16(&f[12])==0x0806 &&
+        get16(&f[20])==1 && !memcmp(&f[22],ourMAC,6) && !memcmp(&f[38],peerIP,4));
+}
+// ----------------------------------------------------------------------------
+static uint16_t arpReply(uint8_t * f)
+{ // The peer's answer to us
+uint16_t length=ethernet(f,ourMAC,0x0806);
+uint8_t * arp=&f[length];
+
+put16(&arp[0],1);
+put16(&arp[2],0x0800);
+arp[4]=6;
+arp[5]=4;
+put16(&arp[6],2);       // Reply
+memcpy(&arp[8],peerMAC,6);
+memcpy(&arp[14],peerIP,4);
+memcpy(&arp[18],ourMAC,6);
+memcpy(&arp[24],ourIP,4);
+return (length+28);
+}
+// ----------------------------------------------------------------------------
+#ifdef USE_TCP_STREAMS
+#define ECHO_BYTES   (3000)
+#define ECHO_SEGMENT (500)
+
+static uint16_t alphabet(uint16_t start,uint16_t length,uint8_t * result)
+{ // Callback data, as 'sent' in scenarioStreams() holds it
+for (uint16_t i=0;i<length;i++) result[i]='a'+(start+i)%26;
+return (length);
+}
+// ----------------------------------------------------------------------------
+static uint16_t echoRounds(uint32_t seq,uint32_t base,uint8_t * into,uint16_t length,
+                           uint16_t * segments)
+{ // The peer takes our segments in order, into 'into' from 'length' on, and ACKs
+  // them, until a round brings nothing.  Returns the new length.
+uint16_t got,n;
+uint32_t at;
+uint8_t  more=TRUE;
+
+while (more) {
+  more=FALSE;
+  while ((got=modelCollect(reply))) {
+    n=get16(&reply[16])-40;
+    at=get32(&reply[38])-base;
+    if (n && at==length) {
+      memcpy(&into[length],&reply[54],n);
+      length+=n;
+      (*segments)++;
+      more=TRUE;
+    }
+  }
+  spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK,seq,base+length,NULL));
+}
+return (length);
+}
+// ----------------------------------------------------------------------------
+static void scenarioStreams(void)
+{ // An echo server on the stream API : a line split across segments is read 
+  // whole, and what's written goes from the TX ring as the windows allow, small
+  // writes together.  Then a client, writing before it is even connected.
+extern TCP_TCB TCB[MAX_TCP_ROLES];
+static uint8_t sent[2*STREAM_RING],echo[2*STREAM_RING];
+static char piece[ECHO_SEGMENT+1];
+IP4_address to=MAKEIP4(peerIP[0],peerIP[1],peerIP[2],peerIP[3]);
+uint32_t seq=100000,theirs,edge;
+uint16_t got,n,i,length,segments=0;
+uint8_t  s;
+
+streamListen(7);
+for (i=0;i<sizeof(sent);i++) sent[i]='a'+i%26;
+
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_SYN,seq,0,NULL));
+got=modelCollect(reply);
+check(got && reply[47]==(FL_SYN|FL_ACK),"Listening port answers");
+theirs=get32(&reply[38])+1;
+seq++;
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK,seq,theirs,NULL));
+s=streamAccept();
+check(s!=STREAM_NONE && streamAccept()==STREAM_NONE,"Connection accepted, once");
+if (s==STREAM_NONE) return;
+
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK|FL_PSH,seq,theirs,"hello "));
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK|FL_PSH,seq+6,theirs,"world\r\n"));
+seq+=13;
+got=modelCollect(reply);
+check(got && get32(&reply[42])==seq && get16(&reply[48])==TCP_WINDOW_SYN-13,
+      "Window as offered, less what came");
+edge=get32(&reply[42])+get16(&reply[48]);
+n=streamRead(s,echo,sizeof(echo));
+check(n==13 && !memcmp(echo,"hello world\r\n",13) && !streamReadable(s),
+      "Line read whole, from two segments");
+
+for (i=0;i<ECHO_BYTES;i+=ECHO_SEGMENT) {
+  memcpy(piece,&sent[i],ECHO_SEGMENT);
+  spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK|FL_PSH,seq+i,theirs,piece));
+}
+seq+=ECHO_BYTES;
+while ((got=modelCollect(reply))) {
+  check(get32(&reply[42])+get16(&reply[48])>=edge && 
+        get16(&reply[48])<=STREAM_RING-(get32(&reply[42])-(seq-ECHO_BYTES)),
+        "Window within the RX ring's room, its edge never back");
+  edge=get32(&reply[42])+get16(&reply[48]);
+}
+n=streamRead(s,echo,sizeof(echo));
+check(n==ECHO_BYTES && !memcmp(echo,sent,ECHO_BYTES),"Bytes read as sent");
+
+check(streamWrite(s,echo,n)==n,"Echo written");
+length=echoRounds(seq,theirs,echo,0,&segments);
+check(length==ECHO_BYTES && !memcmp(echo,sent,ECHO_BYTES),"Echoed, from the TX ring");
+printf("Stream echo          %6u bytes in %u segments\n",length,segments);
+theirs+=length;
+
+for (i=0;i<200;i++) streamWrite(s,&sent[10*i],10);
+segments=0;
+length=echoRounds(seq,theirs,echo,0,&segments);
+check(length==2000 && !memcmp(echo,sent,2000),"Small writes all sent");
+check(segments<=4,"Small writes sent together");
+printf("Stream, 200 writes   %6u bytes in %u segments\n",length,segments);
+theirs+=length;
+
+check(streamWrite(s,sent,sizeof(sent))==STREAM_RING,"Write takes what the TX ring has room for");
+check(!streamWritable(s),"... and it's full");
+length=echoRounds(seq,theirs,echo,0,&segments);
+check(length==STREAM_RING && !memcmp(echo,sent,STREAM_RING),"Ring's worth sent");
+check(streamWritable(s)==STREAM_RING,"Ring empty once ACK'd");
+theirs+=length;
+
+// A write lost, and data from the peer meanwhile : made again by the callback,
+// with the ack and the window moved on, and its checksum to match
+streamWrite(s,sent,100);
+got=modelCollect(reply);
+n=get16(&reply[48]);
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK|FL_PSH,seq,theirs,"abc"));
+tcpWait(TCP_RTO_MAX);
+length=0;
+while ((got=modelCollect(reply)))
+  if (get16(&reply[16])-40==100) {
+    length=got;
+    check(goodTCP(reply,got) && get32(&reply[42])==seq+3 && get16(&reply[48])!=n,
+          "Resent from the ring, well formed, ack and window new");
+  }
+check(length,"Lost write resent");
+seq+=3;
+theirs+=100;
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK,seq,theirs,NULL));
+check(streamRead(s,echo,sizeof(echo))==3,"What came meanwhile read");
+run();
+while (modelCollect(reply)) ;  // Any window update
+
+// The peer's window shut, TCP's queue fills behind a write : more is refused,
+// not sent over the sequence numbers what's queued holds
+peerWindow=0;
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK,seq,theirs,NULL));
+check(streamWrite(s,sent,100)==100,"Written into a shut window");
+for (i=0,length=100;i<TCP_QUEUE && TCP_ComplexDataOut(&MashE,s,10,&alphabet,length+26*(i+1),TRUE);i++)
+  length+=10;  // The same bytes, but from offsets apart : an entry each
+n=streamWrite(s,sent,10);
+check(i<TCP_QUEUE && n==0 && !modelCollect(reply),"Queue full : nothing taken, nothing sent");
+peerWindow=1024;
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK,seq,theirs,NULL));
+n=echoRounds(seq,theirs,echo,0,&segments);
+check(n==length && !memcmp(echo,sent,length),"Then all queued goes, in order");
+theirs+=n;
+
+// The peer fills the RX ring : a zero window, which its probe finds shut.  
+// Then window updates as the application reads.
+for (i=0;i<STREAM_RING;i+=n) {
+  n=(STREAM_RING-i<ECHO_SEGMENT)?STREAM_RING-i:ECHO_SEGMENT;
+  memcpy(piece,&sent[i],n);
+  piece[n]=0;
+  spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK|FL_PSH,seq+i,theirs,piece));
+}
+seq+=STREAM_RING;
+tcpWait(TCP_RTO_MAX);  // The last one's ACK is delayed
+while ((got=modelCollect(reply))) n=get16(&reply[48]);
+check(got==0 && n==0 && get32(&reply[42])==seq,"RX ring full : zero window");
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK|FL_PSH,seq,theirs,"x"));
+got=modelCollect(reply);
+check(got && get32(&reply[42])==seq && get16(&reply[48])==0,"Probe ACK'd, not taken");
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK|FL_PSH,seq+1,theirs,"yz"));
+check(!modelCollect(reply),"Nor held beyond a gap");
+n=streamRead(s,echo,1000);
+run();
+got=modelCollect(reply);
+check(got && get32(&reply[42])==seq && get16(&reply[48])==1000,"Read : window update");
+n+=streamRead(s,&echo[n],sizeof(echo));
+check(n==STREAM_RING && !memcmp(echo,sent,STREAM_RING),"What filled it read");
+run();
+got=modelCollect(reply);
+check(got && get16(&reply[48])>1000 && !modelCollect(reply),"... and another, once");
+printf("TCP window update    %6u bytes, once the RX ring is read\n",get16(&reply[48]));
+
+// The peer half closes : its FIN is the end of the stream, but ours waits 
+// for the reply to be written
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_FIN|FL_ACK,seq,theirs,NULL));
+got=modelCollect(reply);
+check(got && !(reply[47]&FL_FIN) && get32(&reply[42])==seq+1 && streamEOF(s) && 
+      TCB[s].status==TCP_CLOSE_WAIT,"Peer's FIN : end of stream, ACK'd, not ours yet");
+n=streamWrite(s,(const uint8_t *)"reply",5);
+got=modelCollect(reply);
+check(n==5 && got && get16(&reply[16])-40==5 && !memcmp(&reply[54],"reply",5) &&
+      get32(&reply[38])==theirs,"Reply written after the peer's FIN");
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK,seq+1,theirs+5,NULL));
+streamClose(s);
+got=modelCollect(reply);
+check(got && (reply[47]&FL_FIN) && get32(&reply[38])==theirs+5 && 
+      TCB[s].status==TCP_LAST_ACK,"Then our FIN, on streamClose()");
+spiCost(frame,tcpSegmentFrom(frame,49000,7,FL_ACK,seq+1,theirs+6,NULL));
+check(TCB[s].status==TCP_CLOSED,"Stream closed");
+streamListen(0);
+
+// A client
+s=streamOpen(to,8000);
+got=modelCollect(reply);
+if (got && isRequestForPeer(reply,got,BroadcastMAC.MAC)) {
+  modelInject(frame,arpReply(frame));
+  run();
+  tcpWait(TCP_RTO_MAX);
+  got=modelCollect(reply);
+}
+check(s==TCP_CLIENT && got && reply[47]==FL_SYN && get16(&reply[36])==8000,"Stream opened");
+uint16_t port=get16(&reply[34]);
+theirs=get32(&reply[38])+1;
+check(streamWrite(s,(const uint8_t *)"QUIT\r\n",6)==6 && !modelCollect(reply),
+      "Written before connected, held");
+spiCost(frame,tcpSegmentFrom(frame,8000,port,FL_SYN|FL_ACK,seq,theirs,NULL));
+seq++;
+uint8_t acked=FALSE,quit=FALSE;
+while ((got=modelCollect(reply))) {
+  if (get32(&reply[42])==seq) acked=TRUE;
+  if (get16(&reply[16])-40==6 && !memcmp(&reply[54],"QUIT\r\n",6)) quit=TRUE;
+}
+check(acked && quit,"Connected : what was written goes");
+spiCost(frame,tcpSegmentFrom(frame,8000,port,FL_ACK|FL_PSH,seq,theirs+6,"221 Bye\r\n"));
+n=streamRead(s,echo,sizeof(echo));
+check(n==9 && !memcmp(echo,"221 Bye\r\n",9),"Client reads");
+spiCost(frame,tcpSegmentFrom(frame,8000,port,FL_RST,seq+9,0,NULL));
+while (modelCollect(reply)) ;
+}
+#endif
+// ----------------------------------------------------------------------------
+static uint16_t parkedSYN(uint32_t seq)
+{ // A SYN from afar : the SYN-ACK must wait on ARP for the gateway
+uint16_t got,length=fromAfar(frame,tcpSegment(frame,80,FL_SYN,seq,0,NULL));
+
+modelInject(frame,length);
+run();
+got=modelCollect(reply);
+check(got && isRequestForPeer(reply,got,BroadcastMAC.MAC),"ARP for gateway");
+check(!modelCollect(reply),"SYN-ACK parked");
+return (length);
+}
+// ----------------------------------------------------------------------------
+static void scenarioColdARP(void)
+{ // A host beyond the gateway, whose MAC has been forgotten.  The reply is 
+  // parked while ARP runs : other traffic carries on meanwhile.
+static uint8_t sent[MODEL_MAX_FRAME];
+uint16_t got,length,retries=0;
+uint8_t i;
+
+modelInject(frame,tcpSegment(frame,80,FL_RST,0,0,NULL));  // Free the server
+run();
+for (i=0;i<=TICKS_TO_HOLD_MAC;i++) refreshMACList();  // Cache ages out
+
+parkedSYN(7000);   // 1. Gateway never answers
+for (i=0;i<TICKS_TO_PARK;i++) {
+  refreshMACList();
+  run();
+  while ((got=modelCollect(reply))) {
+    check(isRequestForPeer(reply,got,BroadcastMAC.MAC),"Only ARP while parked");
+    retries++;
+  }
+}
+check(retries==TICKS_TO_PARK-1,"ARP asked again each tick");
+modelInject(frame,fromAfar(frame,tcpSegment(frame,80,FL_RST,7001,0,NULL)));
+run();
+check(!modelCollect(reply),"Parked frame dropped");
+
+parkedSYN(8000);   // 2. Gateway answers, after a ping
+length=echoRequest(frame,0x4444,1,56);
+modelInject(frame,length);
+run();
+got=modelCollect(reply);
+check(got && goodEchoReply(frame,length,reply,got),"Ping answered while parked");
+
+modelInject(frame,arpReply(frame));
+run();
+got=modelCollect(reply);
+check(got && goodTCP(reply,got) && !memcmp(&reply[0],peerMAC,6),"Parked SYN-ACK released");
+check(reply[47]==(FL_SYN|FL_ACK) && get32(&reply[42])==8001,"Released SYN-ACK flags, ack");
+check(!memcmp(&reply[30],farIP,4),"Released SYN-ACK to far host");
+memcpy(sent,reply,got);  // Lost on the way : not kept, so made again when due
+tcpWait(3*TCP_RTO_INITIAL);
+got=modelCollect(reply);
+check(got && goodTCP(reply,got) && reply[47]==(FL_SYN|FL_ACK),"Parked SYN-ACK resent");
+check(got && !memcmp(&reply[34],&sent[34],got-34) && !modelCollect(reply),
+      "Resent as released");
+modelInject(frame,fromAfar(frame,tcpSegment(frame,80,FL_RST,8001,0,NULL)));
+run();
+check(!modelCollect(reply),"Single frame released");
+
+printf("Cold ARP             frame parked, %u retries then dropped; released on reply, resent\n",
+       retries);
+}
+// ----------------------------------------------------------------------------
+static uint8_t directSYN(uint32_t seq)
+{ // A SYN from afar, answered at once (the gateway's MAC is known).  Then reset.
+uint16_t got;
+uint8_t ok;
+
+modelInject(frame,fromAfar(frame,tcpSegment(frame,80,FL_SYN,seq,0,NULL)));
+run();
+got=modelCollect(reply);
+ok=(got && goodTCP(reply,got) && !memcmp(&reply[0],peerMAC,6) && !modelCollect(reply));
+modelInject(frame,fromAfar(frame,tcpSegment(frame,80,FL_RST,seq+1,0,NULL)));
+run();
+return (ok);
+}
+// ----------------------------------------------------------------------------
+static void scenarioARPRefresh(void)
+{ // The gateway, in use, is asked after (unicast) before it would expire 
+uint16_t got,tick=0,asked=0;
+
+check(directSYN(9000),"Gateway MAC cached");
+while (tick<TICKS_TO_HOLD_MAC && !asked) {
+  tick++;
+  refreshMACList();
+  run();
+  while ((got=modelCollect(reply))) {
+    check(isRequestForPeer(reply,got,peerMAC),"Unicast refresh");
+    asked=tick;
+  }
+}
+check(asked==TICKS_TO_HOLD_MAC-TICKS_TO_REFRESH,"Refresh near expiry");
+modelInject(frame,arpReply(frame));
+run();
+for (got=0;got<=TICKS_TO_REFRESH;got++) refreshMACList();  // Would have expired
+check(directSYN(9100),"Gateway MAC still cached");
+
+printf("ARP refresh          unicast ARP %u ticks before expiry\n",TICKS_TO_HOLD_MAC-asked);
+}
+// ----------------------------------------------------------------------------
+#ifdef USE_FRAGMENTS
+static const uint8_t LLMNRmac[6]={0x01,0x00,0x5E,0x00,0x00,0xFC};
+static const uint8_t LLMNRip[4]={224,0,0,252};
+static uint8_t datagram[FRAG_MAX_SIZE];  // UDP header and payload, to fragment
+static uint16_t datagramLength;
+
+static void llmnrQuery(uint16_t padding)
+{ // A large LLMNR query for our name : "host-model" A IN, then an EDNS0 OPT 
+  // record padded (RFC 7830) to make it several fragments long
+static const uint8_t question[]={10,'h','o','s','t','-','m','o','d','e','l',0, 0,1, 0,1};
+uint8_t * dns=&datagram[8];
+uint16_t at=12;
+
+memset(datagram,0,sizeof(datagram));
+put16(&datagram[0],50100);
+put16(&datagram[2],5355);
+put16(&dns[0],0x4C4C);  // Id
+put16(&dns[4],1);       // QDCOUNT
+put16(&dns[10],1);      // ARCOUNT
+memcpy(&dns[at],question,sizeof(question));
+at+=sizeof(question);
+at++;                   // OPT : root name
+put16(&dns[at],41);   at+=2;
+put16(&dns[at],4096); at+=2;
+at+=4;                  // Extended RCODE, flags
+put16(&dns[at],4+padding); at+=2;
+put16(&dns[at],12);   at+=2;
+put16(&dns[at],padding); at+=2;
+for (uint16_t i=0;i<padding;i++) dns[at++]=(uint8_t)(i*13);
+datagramLength=8+at;
+put16(&datagram[4],datagramLength);
+
+uint32_t sum=sum16(peerIP,4,0)+sum16(LLMNRip,4,0)+17+datagramLength;
+uint16_t csum=fold(sum16(datagram,datagramLength,sum));
+put16(&datagram[6],csum?csum:0xFFFF);
+}
+// ----------------------------------------------------------------------------
+static uint16_t fragment(uint8_t * f,uint16_t id,uint16_t offset,uint16_t length)
+{ // Part [offset,offset+length) of the datagram, multicast from the peer
+uint8_t * ip=&f[14];
+
+if (offset+length>datagramLength) length=datagramLength-offset;
+ethernet(f,LLMNRmac,0x0800);
+ip[0]=0x45;
+ip[1]=0;
+put16(&ip[2],20+length);
+put16(&ip[4],id);
+put16(&ip[6],(offset/8)|((offset+length<datagramLength)?0x2000:0));
+ip[8]=1;
+ip[9]=17;
+put16(&ip[10],0);
+memcpy(&ip[12],peerIP,4);
+memcpy(&ip[16],LLMNRip,4);
+put16(&ip[10],fold(sum16(ip,20,0)));
+memcpy(&f[34],&datagram[offset],length);
+return (34+length);
+}
+// ----------------------------------------------------------------------------
+static uint8_t llmnrAnswered(void)
+{ // Our address, in a reply to the query, whatever the ARP needed to send it
+uint16_t got;
+uint8_t ok=FALSE;
+
+while ((got=modelCollect(reply))) {
+  if (isRequestForPeer(reply,got,BroadcastMAC.MAC)) {
+    modelInject(frame,arpReply(frame));
+    run();
+    continue;
+  }
+  if (got>=42 && get16(&reply[12])==0x0800 && reply[23]==17 && 
+      get16(&reply[34])==5355 && get16(&reply[36])==50100 &&
+      !memcmp(&reply[got-4],ourIP,4)) ok=TRUE;
+  else return (FALSE);
+}
+return (ok);
+}
+// ----------------------------------------------------------------------------
+static void sendFragments(uint16_t id,const uint16_t * offsets,uint8_t count,uint16_t size)
+{
+for (uint8_t i=0;i<count;i++) {
+  modelInject(frame,fragment(frame,id,offsets[i],size));
+  run();
+}
+}
+// ----------------------------------------------------------------------------
+static void scenarioFragments(void)
+{ // A query bigger than a frame : fragmented, reassembled in the 23LC1024
+static const uint16_t inOrder[]={0,1480};
+static const uint16_t backwards[]={1536,1024,512,1024,0};   // And a duplicate
+static const uint16_t overlap[]={0,256,512,1024,1536};      // [256,768) straddles
+uint32_t cost;
+uint8_t i;
+
+llmnrQuery(1949);       // 2000 byte datagram
+
+modelResetStats();
+sendFragments(0x1001,inOrder,2,1480);
+cost=modelStats.spiBytes;
+printf("Fragmented LLMNR     %6u SPI bytes, %u SRAM bytes, 2 fragments\n",
+       (unsigned)cost,(unsigned)modelStats.sramBytes);
+check(llmnrAnswered(),"Reassembled query answered");
+
+sendFragments(0x1002,backwards,5,512);
+check(llmnrAnswered(),"Out of order, duplicated fragments answered");
+
+sendFragments(0x1003,overlap,5,512);
+check(!modelCollect(reply),"Overlapping fragments discarded");
+for (i=0;i<FRAG_TICKS;i++) fragmentTick();  // Clear up the remains
+
+sendFragments(0x1004,inOrder,1,1480);       // Two never finished ...
+sendFragments(0x1005,inOrder,1,1480);
+sendFragments(0x1006,inOrder,2,1480);       // ... so no room for a third
+check(!modelCollect(reply),"No room : dropped");
+for (i=0;i<FRAG_TICKS;i++) fragmentTick();
+sendFragments(0x1006,inOrder,2,1480);
+check(llmnrAnswered(),"Room after timeout");
+check(!modelPending(),"Fragments consumed");
+
+printf("Fragments            in order, reversed, duplicate answered; overlap, no room dropped\n");
+}
+#endif
+// ----------------------------------------------------------------------------
+#ifdef SEND_FRAGMENTS
+#define BIG_UDP_DATA (4001)   // Three fragments, the last odd
+
+static void bigData(uint16_t start,uint16_t length,uint8_t * result)
+{ // launchUDP() callback : a pattern that shows up misplaced blocks
+for (uint16_t i=0;i<length;i++) result[i]=(uint8_t)((start+i)*7+(start+i)/251);
+}
+// ----------------------------------------------------------------------------
+static void scenarioSendFragments(void)
+{ // A UDP datagram too big for a frame, its data from a callback : sent as 
+  // fragments, last first, which put back together make the datagram
+static uint8_t whole[8+BIG_UDP_DATA],expect[BIG_UDP_DATA];
+IP4_address to=MAKEIP4(peerIP[0],peerIP[1],peerIP[2],peerIP[3]);
+uint16_t got,frames=0,held=0,total=0,last=0xFFFF,id=0;
+uint8_t ok=TRUE;
+uint32_t cost;
+
+modelResetStats();
+launchUDP(&MashE,&to,50200,50201,BIG_UDP_DATA,bigData,0);
+got=modelCollect(reply);
+if (got && isRequestForPeer(reply,got,BroadcastMAC.MAC)) {  // Not parked : only 
+  modelInject(frame,arpReply(frame));                       // ARP, then resend
+  run();
+  modelResetStats();
+  launchUDP(&MashE,&to,50200,50201,BIG_UDP_DATA,bigData,0);
+  got=modelCollect(reply);
+}
+cost=modelStats.spiBytes;
+
+while (got) {
+  const uint8_t * ip=&reply[14];
+  uint16_t word=get16(&ip[6]),offset=(word&0x1FFF)*8,length=get16(&ip[2])-20;
+
+  if (got>14+IP4_MTU || memcmp(&reply[0],peerMAC,6) || get16(&reply[12])!=0x0800 ||
+      ip[0]!=0x45 || ip[9]!=17 || fold(sum16(ip,20,0)) || 
+      memcmp(&ip[12],ourIP,4) || memcmp(&ip[16],peerIP,4)) ok=FALSE;
+  if (frames && get16(&ip[4])!=id) ok=FALSE;   // One datagram
+  if (offset>=last || offset+length>sizeof(whole)) ok=FALSE;  // Last first
+  if (!(word&0x2000)) total=offset+length;
+  else if (length%8) ok=FALSE;
+  if (!ok) break;
+  id=get16(&ip[4]);
+  last=offset;
+  memcpy(&whole[offset],&ip[20],length);
+  held+=length;
+  frames++;
+  got=modelCollect(reply);
+}
+check(ok && frames==3 && !last,"Fragments well formed, last first");
+check(total==sizeof(whole) && held==total,"Fragments cover the datagram");
+check(get16(&whole[0])==50200 && get16(&whole[2])==50201 && 
+      get16(&whole[4])==sizeof(whole),"UDP header in first fragment");
+
+uint32_t sum=sum16(ourIP,4,0)+sum16(peerIP,4,0)+17+sizeof(whole);
+check(!fold(sum16(whole,sizeof(whole),sum)),"UDP checksum across fragments");
+bigData(0,BIG_UDP_DATA,expect);
+check(!memcmp(&whole[8],expect,BIG_UDP_DATA),"Callback data in place");
+
+printf("UDP %u data bytes  %6u SPI bytes, %u fragments\n",BIG_UDP_DATA,(unsigned)cost,frames);
+}
+#endif
+// ----------------------------------------------------------------------------
+#if STORE_SPACE
+static void storeData(uint16_t start,uint16_t length,uint8_t * result)
+{ // launchUDP() callback, as power.c's
+linkStoreRead(start,result,length);
+}
+// ----------------------------------------------------------------------------
+static void scenarioStore(void)
+{ // Data kept in the ENC28J60 (a word at a time, as power.c samples), past frames
+  // received meanwhile, then sent from there by a callback
+IP4_address to=MAKEIP4(peerIP[0],peerIP[1],peerIP[2],peerIP[3]);
+uint8_t expect[STORE_SPACE];
+uint16_t i,got;
+
+for (i=0;i<STORE_SPACE;i+=2) {
+  expect[i]=i>>1;
+  expect[i+1]=~i;
+  linkStoreWrite(i,&expect[i],2);
+  if (i==STORE_SPACE/2) scenarioPing(1000);  // The RX ring stops short of it
+}
+launchUDP(&MashE,&to,50300,50301,STORE_SPACE,storeData,0);
+got=modelCollect(reply);
+uint32_t sum=sum16(ourIP,4,0)+sum16(peerIP,4,0)+17+8+STORE_SPACE;
+check(got==14+20+8+STORE_SPACE && get16(&reply[36])==50301 && 
+      !memcmp(&reply[42],expect,STORE_SPACE) && !fold(sum16(&reply[34],8+STORE_SPACE,sum)),
+      "Sent from the ENC28J60 store, as kept");
+}
+#endif
+// ----------------------------------------------------------------------------
+static void scenarioStress(void)
+{ // Random bursts of random sized pings : ring wraps, sometimes overflows
+static uint8_t sent[STRESS_BURST][MODEL_MAX_FRAME];
+uint16_t sentLength[STRESS_BURST];
+uint32_t accepted=0,replies=0,wraps=0,bytesIn=0;
+uint16_t seq=0,lastWrite=modelRxWritePointer();
+
+modelResetStats();
+while (seq<STRESS_PINGS) {
+  uint8_t burst=1+random32()%STRESS_BURST,queued=0;
+
+  for (uint8_t i=0;i<burst && seq<STRESS_PINGS;i++) {
+    uint16_t data=random32()%(MAX_ICMP_DATA+1);
+    uint16_t length=echoRequest(sent[queued],0x5151,++seq,data);
+    if (modelInject(sent[queued],length)) {
+      sentLength[queued++]=length;
+      bytesIn+=length;
+    }
+    if (modelRxWritePointer()<lastWrite) wraps++;
+    lastWrite=modelRxWritePointer();
+  }
+  accepted+=queued;
+  run();
+
+  for (uint8_t i=0;i<queued;i++) {
+    uint16_t got=modelCollect(reply);
+    if (got && goodEchoReply(sent[i],sentLength[i],reply,got)) replies++;
+  }
+  check(!modelCollect(reply),"No unexpected frames");
+  if (failures>10) break;
+}
+
+printf("Ring stress          %u pings, %u accepted, %u overflowed, %u ring wraps\n",
+        (unsigned)seq,(unsigned)accepted,(unsigned)modelStats.framesOverflow,(unsigned)wraps);
+uint32_t perByte=(100*(uint64_t)modelStats.spiBytes)/(bytesIn?bytesIn:1);
+printf("                     %u.%02u SPI bytes per received byte, %u DMA copies\n",
+        (unsigned)(perByte/100),(unsigned)(perByte%100),(unsigned)modelStats.dmaCopies);
+check(replies==accepted,"Every accepted ping answered correctly");
+check(wraps>10,"Ring wrapped");
+}
+// ----------------------------------------------------------------------------
+int main(void)
+{
+#ifdef ETH_INTERRUPT
+modelIntHook(INT0_vect);
+#endif
+
+myIP=MAKEIP4(OCT0,OCT1,OCT2,OCT3);
+GWIP=MAKEIP4(OCT0,OCT1,OCT2,1);
+subnetMask=MAKEIP4(0xFF,0xFF,0xFF,0);
+subnetBroadcastIP=((~subnetMask)|myIP);
+MyState.IP=IP_SET;
+
+linkInitialise(myMAC);
+bindCoreUDP();
+#ifdef USE_TCP
+initialiseTCP();
+#endif
+modelTxWireTime(50);
+
+scenarioChecksum();
+scenarioARP();
+scenarioPing(56);
+scenarioPing(MAX_ICMP_DATA);
+scenarioUDP();
+scenarioBind();
+scenarioIPOptions();
+#ifdef USE_TCP
+scenarioTCP();
+scenarioConcurrent();
+scenarioRetransmit();
+scenarioRTO();
+scenarioStream();
+#ifdef USE_TCP_REORDER
+scenarioReorder();
+#endif
+scenarioDelayedACK();
+scenarioRxWindow();
+#ifdef USE_SYN_COOKIES
+scenarioSynFlood();
+#endif
+#ifdef USE_TCP_STREAMS
+scenarioStreams();
+#endif
+scenarioUnwanted();
+scenarioColdARP();
+scenarioARPRefresh();
+#endif
+#ifdef USE_FRAGMENTS
+scenarioFragments();
+#endif
+#ifdef SEND_FRAGMENTS
+scenarioSendFragments();
+#endif
+#if STORE_SPACE
+scenarioStore();
+#endif
+scenarioStress();
+
+#ifdef STATS
+extern uint16_t linkEarlyDrops;
+extern uint32_t linkBytesSaved;
+printf("Dropped part read    %u frames, %u SPI bytes saved each\n",linkEarlyDrops,
+       (unsigned)(linkEarlyDrops?(linkBytesSaved/linkEarlyDrops):0));
+extern uint16_t ARP_hits,ARP_misses,ARP_refreshes;
+printf("ARP cache            %u hits, %u misses, %u refreshes\n",ARP_hits,ARP_misses,
+       ARP_refreshes);
+#ifdef USE_TCP_REORDER
+extern uint16_t reorderHeld,reorderDropped;
+printf("TCP reordering       %u segments held, %u dropped\n",reorderHeld,reorderDropped);
+#endif
+#ifdef USE_FRAGMENTS
+extern uint16_t fragReassembled,fragDiscarded;
+printf("Fragments            %u datagrams reassembled, %u discarded\n",fragReassembled,
+       fragDiscarded);
+#endif
+#endif
+
+printf("%s : %u failed checks\n",failures?"FAILED":"PASSED",failures);
+return (failures);
+}
@@ -0,0 +1,2 @@
+/* Case-sensitive file systems : the stack includes "transport.h" */
+#include "../Transport.h"
@@ -0,0 +1,8 @@
+/* Host build stand-in for <util/delay.h> : time is not modelled */
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+#define _delay_ms(x)
+#define _delay_us(x)
+
+#endif
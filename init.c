@@ -45,7 +45,6 @@ extern volatile uint8_t timecount;
 extern   MAC_address myMAC;
 
 uint16_t IP4_ID;     // IP4 Packet ID
-uint16_t UDP_Port[MAX_UDP_PORTS];
 uint16_t UDP_low_port;
 
 // ----------------------------------------------------------------------------
@@ -203,6 +202,7 @@ delay_ms(150);
 #endif
 
 InitialiseADC();
+udpBind(POWER_MY_PORT,udpPower);
 
 // Startup complete (Two long flashes)
 for (i=0;i<2;i++) {
@@ -16,15 +16,32 @@
 #define CS_UDP  (1<<3)
 #define CS_DHCP (1<<4)  // For DHCP, not really a checksum - just tests the magic no
 
+#define LINK_NOT_HELD (0xFF) // linkPacketHold() or linkKeepSent() had no room
+
 void     linkInitialise(MAC_address myMAC);
 void     linkPacketSend(uint8_t * buffer, uint16_t length, uint8_t checksums,
             void (* callback)(uint16_t start,uint16_t length,uint8_t * result),
             uint16_t offset);
+uint8_t  linkPacketHold(uint8_t * buffer, uint16_t length, uint8_t checksums,
+            void (* callback)(uint16_t start,uint16_t length,uint8_t * result),
+            uint16_t offset);
+void     linkFragmentSend(uint8_t * buffer, uint16_t length,
+            void (* callback)(uint16_t start,uint16_t length,uint8_t * result),
+            uint16_t offset);
+void     linkHeldSend(uint8_t slot,const MAC_address * MAC);
+void     linkHeldDrop(uint8_t slot);
+uint8_t  linkKeepSent(void);
+void     linkKeptPatch(uint8_t slot,uint16_t at,const uint8_t * bytes,uint8_t length);
+void     linkKeptSend(uint8_t slot);
+void     linkKeptDrop(uint8_t slot);
+void     linkStoreWrite(uint16_t at,const uint8_t * bytes,uint16_t length);
+void     linkStoreRead(uint16_t at,uint8_t * bytes,uint16_t length);
 uint8_t  linkNextByte(void);
 void     linkReadBufferMemoryArray(uint16_t len,uint8_t * buffer); 
 uint16_t linkPacketHeader(uint16_t maxSize,uint8_t * buffer,uint8_t * flags);
 void     linkDoneWithPacket(void);
 void     linkReadRandomAccess(uint16_t offset);
+uint16_t linkRxRoom(void);
 
 #ifdef USE_ENC28J60
 #include "linkENC28J60.h"
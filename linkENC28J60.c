@@ -98,13 +98,19 @@ Copyright (C) 2016-19  S Combes
 
 #include <avr/io.h>
 #include <util/delay.h>
-#include <avr/eeprom.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef ETH_INTERRUPT
+#include <avr/interrupt.h>
+#endif
 
 #include "network.h"
 #include "transport.h"
 #include "link.h"
+#ifdef USE_FRAGMENTS
+#include "fragment.h"
+#include "mem23SRAM.h"
+#endif
 
 #ifdef USE_DHCP
 uint8_t magic_cookie[4]={99,130,83,99};
@@ -118,17 +124,58 @@ uint8_t dhcp_option_overload;
 // MACROS
 #define SPIN_SPI(X)    SPDR=(X);WAIT_SPI()   // One spin cycle, sending X (No closing ;)
 #define WAIT_SPI()     while(!(SPSR&(1<<SPIF)))
+#ifdef HOST_MODEL  // Chip select goes to the ENC28J60 model (host/model.c)
+#include "host/model.h"
+#define ETH_ACTIVATE    (modelSelect(TRUE))
+#define ETH_DEACTIVATE  (modelSelect(FALSE))
+#else
 #define ETH_ACTIVATE    (ETH_SPI_SEL_PORT&=(~(1<<ETH_SPI_SEL_CS)))
 #define ETH_DEACTIVATE  (ETH_SPI_SEL_PORT|=  (1<<ETH_SPI_SEL_CS))
+#endif
 
 extern IP4_address myIP;
 extern MAC_address myMAC;
+extern Status MyState;
  
 static uint16_t ptrNextPacket;  // ptr variables are pointers into ENC28J60 memory
 static uint16_t ptrThisPacket;
+static uint16_t ptrFreed=ERXST;   // RX ring freed up to here : ERXRDPT as last written
 static uint8_t inProgress=FALSE;  // Am I processing a packet?
 static uint8_t currentBank=99;    // Force an initial setting
 static uint16_t IPoptlen;         // IPv4 option length
+static uint16_t ptrTX=ETXST;      // TX slot now being written
+static uint16_t lengthTX;         // and its frame length
+static uint8_t slotTX;            // and its number
+static uint16_t heldLength[TX_SLOTS]; // Frames parked awaiting ARP, by slot.  0 if not
+static uint8_t held;              // Slots so parked
+static uint8_t keepable;          // Frame in ptrTX was just sent by linkPacketSend()
+#ifdef USE_TCP
+static uint16_t keptAt[KEEP_SLOTS];     // TCP segments kept for retransmission : where
+static uint16_t keptLength[KEEP_SLOTS]; // and frame length.  0 if slot unused
+#endif
+static uint16_t fetched;          // Bytes of this packet so far in caller's buffer
+#ifdef USE_FRAGMENTS
+static uint8_t reassembled;       // Packet in hand is a datagram in the 23LC1024 ...
+static uint32_t ptrSRAM,sramBase; // ... read from here, starting here
+#endif
+#ifdef STATS
+uint16_t linkFilterCount[mDNS_MULTICAST+1]; // Frames reaching us, by MACForUs() class.  
+                                  // [0] is those not ours : hash filter false positives
+#endif
+#ifdef ETH_INTERRUPT
+static volatile uint8_t ethPending=TRUE; // INT seen : chip has news.  Look at start.
+static uint16_t idleCalls;        // Since last look, for backstop poll
+#ifdef STATS
+uint16_t linkRxErrors,linkTxErrors;  // RX overflows (frames lost), TX aborts
+#endif
+#endif
+#if defined ENC_DMA_CSUM & defined STATS
+uint16_t linkDMAcsumOverlaps;     // Frames that started during a DMA checksum
+#endif
+#ifdef STATS
+uint16_t linkEarlyDrops;          // Frames dropped part read ...
+uint32_t linkBytesSaved;          // ... and the SPI bytes not read as a result
+#endif
 
 union {  // Machine endianism solution
   uint16_t word;
@@ -197,45 +244,66 @@ while (readMACRegister(reg)!=data);
 // ---------------------------------------------------------------------------
 #define writeMIIRegister(X,Y) (writeEthRegister((X),(Y))) // Macro for zero call overhead
 // ---------------------------------------------------------------------------
-static void setBank(uint8_t bank) 
-{
-if (currentBank!=bank) {
-  uint8_t dummy=readEthRegister(ETH_ECON1) & 0xFC;   
-  currentBank=(bank & 0x03);
-  writeEthRegister(ETH_ECON1,(dummy | currentBank));
-}
-}
+// SPI burst engine.  The AVR SPI data register is single buffered for transmit
+// but the received byte is held until the next transfer completes, so the next
+// byte can be loaded the moment SPIF sets.  The store (or fetch) of one byte
+// then overlaps the shifting of the next, instead of the CPU stalling on every
+// byte as SPIN_SPI() does.  At SPI2X (clk/2) a byte shifts in 16 cycles, which
+// is about what the loop itself costs, so the bus runs close to back-to-back.
 // ---------------------------------------------------------------------------
-void linkReadBufferMemoryArray(uint16_t len,uint8_t * dataBuffer) 
+static void readBufferMemoryArray(uint16_t len,uint8_t * dataBuffer) 
 { 
 // Needs AUTOINC set.  If so, will just keep reading consecutive bytes,
 // without resending 0x3A, as long as CS held low (i.e. no ETH_DEACTIVATE ).
 
+if (!len) return;
+
 ETH_ACTIVATE ;
 SPIN_SPI(0x3A);
-while (len--) { 
-  SPIN_SPI(0);
-  *(dataBuffer++)=SPDR;
+SPDR=0;                  // Start the first byte
+while (--len) { 
+  WAIT_SPI();
+  uint8_t data=SPDR;
+  SPDR=0;                // Next byte shifts while we store this one
+  *(dataBuffer++)=data;
 }
+WAIT_SPI();
+*dataBuffer=SPDR;
 ETH_DEACTIVATE ;
 }
 // ---------------------------------------------------------------------------
-static void readBufferByte(uint8_t * data) { linkReadBufferMemoryArray(1,data); }
+void linkReadBufferMemoryArray(uint16_t len,uint8_t * dataBuffer) 
+{
+#ifdef USE_FRAGMENTS
+if (reassembled) {
+  memReadBufferMemoryArray(ptrSRAM,len,dataBuffer);
+  ptrSRAM+=len;
+  return;
+}
+#endif
+readBufferMemoryArray(len,dataBuffer); 
+}
 // ---------------------------------------------------------------------------
 uint8_t linkNextByte(void) 
           { uint8_t data; linkReadBufferMemoryArray(1,&data); return data; }
 // ---------------------------------------------------------------------------
-static void writeBufferMemoryArray(uint16_t len,uint8_t * dataBuffer) 
+static void writeBufferMemoryArray(uint16_t len,const uint8_t * dataBuffer) 
 { 
 // Needs AUTOINC set.  If so, will just keep writing consecutive bytes,
-// without resending 0x&A, as long as CS held low (i.e. no ETH_DEACTIVATE ).
+// without resending 0x7A, as long as CS held low (i.e. no ETH_DEACTIVATE ).
 
 ETH_ACTIVATE ;
-SPIN_SPI(0x7A);
-while (len--) {  SPIN_SPI(*(dataBuffer++)); }
+SPDR=0x7A;
+while (len--) {  
+  uint8_t data=*(dataBuffer++);  // Fetch while the previous byte shifts
+  WAIT_SPI();
+  SPDR=data;
+}
+WAIT_SPI();
 ETH_DEACTIVATE ;
 }
 // ---------------------------------------------------------------------------
+#ifdef USE_DHCP
 static void writeBufferMemoryZeros(uint16_t len) 
 { 
 // Needs AUTOINC set. 
@@ -245,6 +313,7 @@ SPIN_SPI(0x7A);
 while (len--) {  SPIN_SPI(0); }
 ETH_DEACTIVATE ;
 }
+#endif
 // ---------------------------------------------------------------------------
 static void writeBufferByte(uint8_t data) {writeBufferMemoryArray(1,&data); }
 // ---------------------------------------------------------------------------
@@ -264,6 +333,16 @@ SPIN_SPI(mask);
 ETH_DEACTIVATE ;
 }
 // ---------------------------------------------------------------------------
+static void setBank(uint8_t bank) 
+{ // Bit field operations on BSEL only.  A read-modify-write of ECON1 could
+  // write back a TXRTS that the chip cleared in between, sending a frame twice.
+if (currentBank!=bank) {
+  currentBank=(bank & 0x03);
+  ethBitFieldClr(ETH_ECON1,(~currentBank) & 0x03);
+  if (currentBank) ethBitFieldSet(ETH_ECON1,currentBank);
+}
+}
+// ---------------------------------------------------------------------------
 static uint16_t readPhyRegister(uint8_t reg)
 {  // Note changes bank.  Datasheet p19.
 
@@ -351,10 +430,98 @@ csum+=(csum>>16);   // Could have regenerated a carry by the last add
 return (((uint16_t)csum)^0xFFFF);  
 }
 // ---------------------------------------------------------------------------
+static uint32_t pktCsumSPI(uint16_t ptrStart,uint16_t bytes,uint8_t isReadBuffer) 
+{ // Software checksum of ENC28J60 memory, read over SPI.  See pktCsumRaw().
+
+setBank(0);
+setReadPointer(ptrStart,isReadBuffer); // Handles wrap, if required
+uint32_t result=0;
+
+if (!bytes) return (result);
+
+// One burst read, summing on the fly, rather than a 2 byte SPI transaction 
+// (3 bytes on the bus and a CS cycle) per word.
+uint8_t high=FALSE;  // Which half of the word the next byte fills
+
+ETH_ACTIVATE ;
+SPIN_SPI(0x3A);
+SPDR=0;
+while (--bytes) {
+  WAIT_SPI();
+  uint8_t data=SPDR;
+  SPDR=0;            // Next byte shifts while we sum this one
+  if (high) { join.byte_2=data; result+=join.word; }
+  else        join.byte_1=data;
+  high=!high;
+}
+WAIT_SPI();
+if (high) join.byte_2=SPDR;
+else    { join.byte_1=SPDR; join.byte_2=0; } // Odd, so add a trailing zero
+result+=join.word;
+ETH_DEACTIVATE ;
+
+return (result);
+}
+#ifdef ENC_DMA_CSUM
+// ---------------------------------------------------------------------------
+static uint8_t pktCsumDMA(uint16_t ptrStart,uint16_t bytes,uint8_t isReadBuffer,
+                          uint32_t * result)
+{ // Checksum by the ENC28J60's own DMA engine (datasheet 14.2).  Returns FALSE,
+  // having changed nothing, if it can't be used safely - caller then uses SPI.
+  
+// Errata : a frame arriving while the DMA checksum runs can be silently lost.
+// So assert half-duplex backpressure first (the link partner sees a busy 
+// line and defers), let any frame already on the wire complete (RXBUSY), 
+// and only then start the DMA.  Give up if the line won't go quiet.
+
+if (isReadBuffer) {
+  wrapReadIndex(&ptrStart);
+  if (((uint32_t)ptrStart+bytes-1)>ERXND) return FALSE; // Wraps : leave to SPI
+}
+
+setBank(3);
+writeEthRegister(0x17,EFLOCON_BACKPRESSURE);  // EFLOCON
+
+uint16_t patience=DMA_CSUM_PATIENCE;
+while (readEthRegister(ETH_ESTAT)&ESTAT_RXBUSY) {
+  if (!(--patience)) {
+    writeEthRegister(0x17,0x00);  // EFLOCON : flow control off
+    return FALSE;
+  }
+}
+
+uint16_t ptrEnd=ptrStart+bytes-1;  // Inclusive
+
+setBank(0);
+writeEthRegister(0x10,ptrStart&0xFF);  // L,H EDMAST
+writeEthRegister(0x11,ptrStart>>8);
+writeEthRegister(0x12,ptrEnd&0xFF);    // L,H EDMAND
+writeEthRegister(0x13,ptrEnd>>8);
+
+ethBitFieldSet(ETH_ECON1,ECON1_CSUMEN|ECON1_DMAST);
+while (readEthRegister(ETH_ECON1)&ECON1_DMAST) ;  // Clears when done
+ethBitFieldClr(ETH_ECON1,ECON1_CSUMEN);  // So a later DMA is a copy
+
+// Hardware gives the complemented checksum, high byte (EDMACSH) first in the
+// packet.  We want the raw sum, in packet byte order, to add to our own.
+join.byte_1=readEthRegister(0x17)^0xFF;  // EDMACSH
+join.byte_2=readEthRegister(0x16)^0xFF;  // EDMACSL
+*result=join.word;
+
+#ifdef STATS
+if (readEthRegister(ETH_ESTAT)&ESTAT_RXBUSY) linkDMAcsumOverlaps++;  // Should not
+#endif
+
+setBank(3);
+writeEthRegister(0x17,0x00);  // EFLOCON : flow control off
+
+return TRUE;
+}
+#endif
+// ---------------------------------------------------------------------------
 static uint32_t pktCsumRaw(uint16_t ptrStart,uint16_t bytes,uint8_t isReadBuffer) 
 {
 // Gets a checksum from a (portion of) a packet in the ENC28J60 memory 
-// (i.e. access via SPI)
 // 'Raw' because adds to uint32 - result needs to pass to resolveCsum()
 
 // 'ptrStart' : index in ENC28J60 memory (Note may need to wrap - handled 
@@ -362,28 +529,20 @@ static uint32_t pktCsumRaw(uint16_t ptrStart,uint16_t bytes,uint8_t isReadBuffer
 // 'bytes' : number over which checksum is calculated (Copes with odd/even length)
 // 'isReadBuffer' : T/F whether we are in RX data (which may wrap around)
 
-setBank(0);
-setReadPointer(ptrStart,isReadBuffer); // Handles wrap, if required
-uint32_t result=0;
-
-uint16_t i;
-for (i=0;i<(bytes/2);i++) {
-  linkReadBufferMemoryArray(2,&join.byte_1);
-  result+=join.word;
-}
+#ifdef ENC_DMA_CSUM
+// Short runs are quicker over SPI than setting up the DMA
+uint32_t result;
+if (bytes>=DMA_CSUM_MIN && pktCsumDMA(ptrStart,bytes,isReadBuffer,&result)) 
+  return (result);
+#endif
 
-if (bytes%2) { // Odd, so add a trailing zero after byte read
-  readBufferByte(&join.byte_1);
-  join.byte_2=0;
-  result+=join.word;
-}
-return (result);
+return (pktCsumSPI(ptrStart,bytes,isReadBuffer));
 }
 // ---------------------------------------------------------------------------
 static uint16_t pktCsum(uint16_t ptrStart,uint16_t bytes,uint8_t isReadBuffer) 
 { // Gets a checksum from a packet in the ENC28J60 memory
-// N.B. Ideally would do in hardware, but current errata suggests this is dangerous
-// Therefore now not used.
+// N.B. Hardware only if ENC_DMA_CSUM : errata makes it dangerous unless 
+// reception is held off while it runs (see pktCsumDMA).
 return (resolveCsum(pktCsumRaw(ptrStart,bytes,isReadBuffer)));
 }
 // ----------------------------------------------------------------------------
@@ -413,8 +572,7 @@ static uint16_t TransportCsum(uint16_t ptrStart,uint8_t * dataBuffer,
   // Also - routines that construct the packet can help by pre-computing
   // checksum elements while in RAM.
   
-// N.B. Ideally would do in ENC28J60 hardware, but current errata suggests 
-// this is dangerous.
+// N.B. The part in ENC28J60 memory goes to its DMA engine if ENC_DMA_CSUM.
 
 // 'ptrStart' : (measured by index into ENC28J60 memory) should be the start
 // of the ethernet packet, because of the need to include pseudo header.
@@ -447,8 +605,9 @@ if (protocol==TCPinIP4) {
   checksumBare(&csum,(uint16_t *)&Mash->TCP,8); 
   // Count of words before csum (implicity sets csum to zero as we ignore it)
 
-  uint16_t payloadInBuffer=inBuffer-(ETH_HEADER_SIZE+Mash->IP4.headerLength*4+TCP_HEADER_SIZE);
-  uint16_t payloadToConsider=stopAt-(ETH_HEADER_SIZE+Mash->IP4.headerLength*4+TCP_HEADER_SIZE);
+  uint16_t payloadInBuffer=inBuffer-(ETH_HEADER_SIZE+IP_HEADER_SIZE+TCP_HEADER_SIZE);
+  uint16_t payloadToConsider=stopAt-(ETH_HEADER_SIZE+IP_HEADER_SIZE+TCP_HEADER_SIZE);
+  // In dataBuffer, as in 'size', the transport header follows a bare IP header
   if (payloadInBuffer>payloadToConsider) payloadInBuffer=payloadToConsider;
   checksumBare(&csum,&Mash->TCP.urgent,1+payloadInBuffer/2); 
   // Start at 1 word before data (the Urgent word) and add 1 word to length
@@ -469,8 +628,8 @@ if (protocol==TCPinIP4) {
   checksumBare(&csum,(uint16_t *)&Mash->UDP,3); 
   // Count of words before csum (implicity sets csum to zero as we ignore it)
  
-  uint16_t payloadInBuffer=inBuffer-(ETH_HEADER_SIZE+Mash->IP4.headerLength*4+UDP_HEADER_SIZE);
-  uint16_t payloadToConsider=stopAt-(ETH_HEADER_SIZE+Mash->IP4.headerLength*4+UDP_HEADER_SIZE);
+  uint16_t payloadInBuffer=inBuffer-(ETH_HEADER_SIZE+IP_HEADER_SIZE+UDP_HEADER_SIZE);
+  uint16_t payloadToConsider=stopAt-(ETH_HEADER_SIZE+IP_HEADER_SIZE+UDP_HEADER_SIZE);
   if (payloadInBuffer>payloadToConsider) payloadInBuffer=payloadToConsider;
   checksumBare(&csum,Mash->UDP_payload.words,payloadInBuffer/2); // Start at data
 
@@ -492,6 +651,26 @@ checksumBare(&csum,(uint16_t *)&dataBuffer[ETH_HEADER_SIZE+12],4);
 
 return (resolveCsum(csum));
 }
+#if defined USE_mDNS | defined USE_LLMNR
+// ---------------------------------------------------------------------------
+static void hashFilterAdd(const uint8_t * MAC)
+{ // Sets the EHT0-7 bit for destination 'MAC'.  Datasheet 8.3.3 : bin is bits
+  // 28:23 of the Ethernet CRC over the address, as sent (each byte LSb first).
+  // Bank 1 must be selected.
+
+uint32_t crc=0xFFFFFFFF;
+for (uint8_t i=0;i<6;i++) {
+  uint8_t octet=MAC[i];
+  for (uint8_t bit=0;bit<8;bit++,octet>>=1) {
+    uint8_t feedback=((crc>>31)^octet)&0x01;
+    crc<<=1;
+    if (feedback) crc^=0x04C11DB7;  // Ethernet polynomial
+  }
+}
+uint8_t bin=(crc>>23)&0x3F;    // e.g. mDNS 62 (EHT7 bit 6), LLMNR 53 (EHT6 bit 5)
+ethBitFieldSet(bin>>3,1<<(bin&0x07));  // EHTn is at 0x0n
+}
+#endif
 // ---------------------------------------------------------------------------
 void linkInitialise(MAC_address myMAC)
 { // Active - probably needs to happen after any other possible users of SPI have 
@@ -524,9 +703,11 @@ writeEthRegister(0x0B,ERXND>>8);
 
 writeEthRegister(0x0C,ERXST&0xFF);  // L,H RX read pointer (start of buffer)
 writeEthRegister(0x0D,ERXST>>8);
+ptrFreed=ERXST;
 
 // Datasheet 6.2 : Transmit Buffer
-// TX buffer needs no initialisation.  7 spare bytes included in .h file in ETXST
+// TX buffer needs no initialisation.  7 spare bytes included in .h file in each
+// TX slot, from ETXST up.
 
 // Datasheet 6.3 : Receive Filters
 setBank(1); 
@@ -536,75 +717,27 @@ setBank(1);
 
 #if defined USE_mDNS | defined USE_LLMNR
 
-// Use pattern match to accept mDNS and LLMNR packets (which are very similar) with
-// (most of) our hostname as remaining key.
+// Hash table filter admits the mDNS and LLMNR multicast MACs, alongside our 
+// unicasts and broadcasts.  It has only 64 bins, so another address sharing a
+// bin gets through too (MACForUs() still checks).  Pattern match was tried 
+// here first, but let other hosts' traffic through.
 
-// CSUM based on 1 : 1st 5 digits of destination MAC = (01 00) (5E 00) (00 ...
-//               2 : 1st 3 digits of destination IP  = ... E0) (00 00)
-//               3 : Hostname length (1 byte) & 1st character of hostname
-//               4 : Up to next 8 hostname characters in pairs
-  
-// *** TODO - this DESTROYS case insensitivity of hostname.  Can't really use HOSTNAME in patternmatch.
-  
-writeEthRegister(0x14, 0x00);
-writeEthRegister(0x15, 0x00); // Zero offset in EPMO
-
-writeEthRegister(0x08, 0x1f);  // Destination MAC (1st 5)
-writeEthRegister(0x09, 0x00);
-writeEthRegister(0x0A, 0x00);
-writeEthRegister(0x0B, 0xC0);  // Destination IP 1st 3
-writeEthRegister(0x0C, 0x01);  // ditto
-writeEthRegister(0x0D, 0x00);
-//writeEthRegister(0x0E, 0xC0);  // Length of HOSTNAME and 1st char (always assume >=1 char)
-writeEthRegister(0x0E, 0x00);  // Length of HOSTNAME and 1st char (always assume >=1 char)
-
-uint8_t pat=0;
-//uint32_t csum=0x0100 + 0x5E00 + 0x00E0 + (((uint16_t)strlen(HOSTNAME))<<8) + (uint8_t)HOSTNAME[0];
-uint32_t csum=0x0100 + 0x5E00 + 0x00E0;// + (((uint16_t)strlen(HOSTNAME))<<8) + (uint8_t)HOSTNAME[0];
-
-// Do in pairs as not convinced 00 padding works in Pmatch
-/*
-if (strlen(HOSTNAME)>2) {
-  pat|=(0x03);
-  csum+=(((uint16_t)HOSTNAME[1])<<8) + (uint8_t)HOSTNAME[2];
-}
-if (strlen(HOSTNAME)>4) {
-  pat|=(0x0C);
-  csum+=(((uint16_t)HOSTNAME[3])<<8) + (uint8_t)HOSTNAME[4];
-}
-if (strlen(HOSTNAME)>6) {
-  pat|=(0x30);
-  csum+=(((uint16_t)HOSTNAME[5])<<8) + (uint8_t)HOSTNAME[6];
-}
-if (strlen(HOSTNAME)>8) {
-  pat|=(0xC0);
-  csum+=(((uint16_t)HOSTNAME[7])<<8) + (uint8_t)HOSTNAME[8];
-}
-*/
-writeEthRegister(0x0F,pat);
+for (uint8_t i=0;i<8;i++) writeEthRegister(i,0x00);  // EHT0-7 : empty table
 
-uint32_t carry=(csum&0xFFFF0000)>>16;
-csum =(csum&0x0000FFFF)+carry; 
-csum+=(csum>>16);   // Could have regenerated a carry by the last add
-// (see Internetworking with TCP/IP Comer & Stevens)
-
-uint16_t csum16=((uint16_t)csum^0xFFFF);  // 16 bit 1s complement (i.e. XOR 1111...1111);
-
-writeEthRegister(0x10,(uint8_t)(csum16&0xFF)); 
-writeEthRegister(0x11,(uint8_t)(csum16>>8));
-
-writeEthRegister(0x18, ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_BCEN|ERXFCON_PMEN);
-
-// *** Pattern match does not seem to work - allows other hosts through *** 
+#ifdef USE_mDNS
+static const uint8_t mDNSmac[6]={0x01,0x00,0x5E,0x00,0x00,0xFB};
+hashFilterAdd(mDNSmac);
+#endif
+#ifdef USE_LLMNR
+static const uint8_t LLMNRmac[6]={0x01,0x00,0x5E,0x00,0x00,0xFC};
+hashFilterAdd(LLMNRmac);
+#endif
 
-// Instead of pattern match above, Could allow multicast (mDNS and LLMNR) and 
-// broadcast (some DHCP), not pattern match.  Using instead  :  
-//   writeEthRegister(0x18, ERXFCON_UCEN|ERXFCON_MCEN|ERXFCON_BCEN|ERXFCON_CRCEN);
+writeEthRegister(0x18, ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_BCEN|ERXFCON_HTEN);
 
 // On the assumption that most packets not for us are filtered by the switch
 // these days, suppressing multicast to a narrow window helps reduce remaining 
 // processing load on the microcontroller.
-// However experiments suggest load is not that bad anyway.
 
 #else
 
@@ -652,8 +785,205 @@ ethBitFieldSet(ETH_ECON2,ECON2_AUTOINC); // Reset should have set anyway
 
 delay_ms(5);  // Just in case
 
-writeEthRegister(ETH_ECON1,ECON1_RXEN);  // Start receiving
+#ifdef ETH_INTERRUPT
+// ENC28J60 INT is active low : falling edge on INT0 (PD2)
+DDRD&=(~(1<<DDD2));
+EICRA=(EICRA&(~((1<<ISC01)|(1<<ISC00))))|(1<<ISC01);
+EIFR=(1<<INTF0);   // Clear any stale edge
+EIMSK|=(1<<INT0);
+writeEthRegister(ETH_EIE,EIE_INTIE|EIE_PKTIE|EIE_RXERIE|EIE_TXERIE);
+sei();
+#endif
+
+ethBitFieldSet(ETH_ECON1,ECON1_RXEN);  // Start receiving (keeps bank bits, so currentBank holds)
+}
+// ---------------------------------------------------------------------------
+#define CTRL_HEADER_SIZE (1)  // 1 byte header, precedes each TX frame
+// ---------------------------------------------------------------------------
+static void waitTX(void)
+{ // Waits for the frame being sent, if any
+while (readEthRegister(ETH_ECON1) & ECON1_TXRTS) { // Probably something being sent
+// Errata point 12.
+  if ((readEthRegister(ETH_EIR) & EIR_TXERIF) ) {
+    ethBitFieldSet(ETH_ECON1,ECON1_TXRST);
+    ethBitFieldClr(ETH_ECON1,ECON1_TXRST);
+  }
+}
+}
+// ---------------------------------------------------------------------------
+static void prepareTX(uint16_t length)
+{ // Moves to the next TX slot for a frame of 'length' bytes and writes its 
+  // control byte.  Write pointer is left at the start of the frame, ready for
+  // the caller.  The slot is never the one on the wire (launchTX() only ever
+  // has one in flight) so no need to wait : SPI writes overlap transmission.
+  // Slots parked by linkPacketHold() are stepped over.
+
+do {
+  if (++slotTX==TX_SLOTS) slotTX=0;  // Round robin
+} while (heldLength[slotTX]);
+ptrTX=ETXST+slotTX*TX_SLOT_SIZE;
+lengthTX=length;
+keepable=FALSE;
+
+if (held==TX_SLOTS-1) waitTX();  // One slot : can only overwrite the frame in flight once sent
+
+setBank(0);
+writeEthRegister(0x02,ptrTX&0xFF);           // L,H write pointer - put packet here
+writeEthRegister(0x03,ptrTX>>8);    
+
+writeBufferByte(0x00);  // 1st byte is Control; zero is to follow MACON3
+}
+// ---------------------------------------------------------------------------
+static void launchTX(void)
+{ // Sends the frame set up by prepareTX(), once the previous one has gone
+
+waitTX();
+
+setBank(0);
+writeEthRegister(0x04,ptrTX&0xFF);             // L,H TX buffer start
+writeEthRegister(0x05,ptrTX>>8);    
+
+writeEthRegister(0x06,(lengthTX+ptrTX)&0xFF);  // L,H TX buffer end
+writeEthRegister(0x07,(lengthTX+ptrTX)>>8);    
+
+ethBitFieldSet(ETH_ECON1,ECON1_TXRTS); // launch the packet
+}
+#if defined IMPLEMENT_PING || defined USE_TCP
+// ---------------------------------------------------------------------------
+static void dmaCopy(uint16_t ptrSrc,uint16_t length,uint16_t ptrDst,uint8_t isReadBuffer)
+{ // Copies 'length' (>0) bytes within ENC28J60 memory (datasheet 14.1).  
+  // If isReadBuffer, source is in the RX ring and may wrap, which the DMA 
+  // follows by itself.
+
+uint16_t ptrEnd=ptrSrc+length-1;  // Inclusive
+if (isReadBuffer) {
+  wrapReadIndex(&ptrSrc);
+  wrapReadIndex(&ptrEnd);
+}
+
+setBank(0);
+writeEthRegister(0x10,ptrSrc&0xFF);  // L,H EDMAST
+writeEthRegister(0x11,ptrSrc>>8);
+writeEthRegister(0x12,ptrEnd&0xFF);  // L,H EDMAND
+writeEthRegister(0x13,ptrEnd>>8);
+writeEthRegister(0x14,ptrDst&0xFF);  // L,H EDMADST
+writeEthRegister(0x15,ptrDst>>8);
+
+ethBitFieldClr(ETH_ECON1,ECON1_CSUMEN);  // Copy, not checksum
+ethBitFieldSet(ETH_ECON1,ECON1_DMAST);
+while (readEthRegister(ETH_ECON1)&ECON1_DMAST) ;  // Clears when done
+}
+#endif
+#ifdef IMPLEMENT_PING
+// ---------------------------------------------------------------------------
+static void sendPong(MergedPacket * mp,uint16_t ptrICMP,uint16_t ICMPlength)
+{ // Echo reply with no payload through the microcontroller : headers rewritten
+  // in RAM, payload copied RX->TX by the ENC28J60 DMA and the ICMP checksum 
+  // adjusted for the changed type alone (RFC 1624).  Any size of ping is thus
+  // answered, touching only the first 42 bytes of 'mp'.  The IP checksum is
+  // adjusted likewise, unless there were options to drop.
+  // 'ptrICMP' : start of ICMP message in RX ring (unwrapped)
+
+uint16_t was;
+uint16_t * IPwords=(uint16_t *)&mp->IP4;
+
+join.byte_1=mp->ICMP.messagetype;  // The type/code word
+join.byte_2=mp->ICMP.code;
+was=join.word;
+mp->ICMP.messagetype=PONG;  // Set packet as reply
+join.byte_1=PONG;
+mp->ICMP.checksum=checksumAdjust(mp->ICMP.checksum,&was,&join.word,1);
+
+// Addresses swap (only unicasts to us get here, so our IP is the old 
+// destination) : no change to the sum
+copyIP4(&mp->IP4.destination,&mp->IP4.source);  
+copyIP4(&mp->IP4.source,&myIP);
+copyMAC(&mp->Ethernet.destinationMAC,&mp->Ethernet.sourceMAC);
+copyMAC(&mp->Ethernet.sourceMAC,&myMAC);
+was=IPwords[4];          // The TTL/protocol word
+mp->IP4.TTL=0x80;        
+if (IPoptlen) {
+  mp->IP4.headerLength=5; // No IP options in reply
+  mp->IP4.totalLength=BYTESWAP16((IP_HEADER_SIZE+ICMPlength));
+  mp->IP4.checksum=0;
+  mp->IP4.checksum=IP4checksum(mp);
+} else mp->IP4.checksum=checksumAdjust(mp->IP4.checksum,&was,&IPwords[4],1);
+
+#define PONG_HEADERS (ETH_HEADER_SIZE+IP_HEADER_SIZE+ICMP_HEADER_SIZE)
+
+prepareTX(ETH_HEADER_SIZE+IP_HEADER_SIZE+ICMPlength);
+writeBufferMemoryArray(PONG_HEADERS,(uint8_t *)mp);
+if (ICMPlength>ICMP_HEADER_SIZE) 
+  dmaCopy(ptrICMP+ICMP_HEADER_SIZE,ICMPlength-ICMP_HEADER_SIZE,
+          ptrTX+CTRL_HEADER_SIZE+PONG_HEADERS,TRUE);
+
+launchTX();
 }
+#endif
+// ---------------------------------------------------------------------------
+static void releaseFrame(void);
+#ifdef USE_FRAGMENTS
+static uint16_t deliverReassembled(uint16_t maxSize,uint8_t * dataBuffer,uint8_t * flags);
+#endif
+// ---------------------------------------------------------------------------
+static void fetch(uint8_t * dataBuffer,uint16_t upTo)
+{ // Staged read of the packet in hand : brings the caller's buffer up to 'upTo'
+  // bytes, carrying on from where the last stage left the read pointer.
+if (upTo>fetched) {
+  linkReadBufferMemoryArray(upTo-fetched,&dataBuffer[fetched]);
+  fetched=upTo;
+}
+}
+// ---------------------------------------------------------------------------
+static uint16_t dropEarly(uint16_t size,uint16_t maxSize)
+{ // Done with a packet no layer wants, before fetching the rest of it.
+  // Returns 0 : nothing for the caller.
+#ifdef STATS
+linkEarlyDrops++;
+linkBytesSaved+=((size<maxSize)?size:maxSize)-fetched;  // Old fixed prefetch
+#endif
+linkDoneWithPacket();
+return (0);
+}
+#ifdef USE_FRAGMENTS
+// ---------------------------------------------------------------------------
+static uint16_t deliverReassembled(uint16_t maxSize,uint8_t * dataBuffer,uint8_t * flags)
+{ // The datagram fragmentAdd() just completed becomes the packet in hand : 
+  // read from the 23LC1024 until linkDoneWithPacket().  Its IP header has no
+  // options and fragmentAdd() has already checked the UDP checksum.
+MergedPacket * mp=(MergedPacket *)dataBuffer;
+uint16_t size;
+
+sramBase=fragmentDatagram(&size);
+ptrSRAM=sramBase;
+reassembled=TRUE;
+inProgress=TRUE;
+IPoptlen=0;
+fetched=0;
+
+fetch(dataBuffer,ETH_HEADER_SIZE+IP_HEADER_SIZE+UDP_HEADER_SIZE);
+if (!UDP_Wanted(BYTESWAP16(mp->UDP.destinationPort),BYTESWAP16(mp->UDP.sourcePort)))
+  return (dropEarly(size,maxSize));
+fetch(dataBuffer,(size<maxSize)?size:maxSize);
+
+*flags|=(CS_IP4|CS_UDP);
+
+#ifdef USE_DHCP
+if ((mp->UDP.destinationPort==BYTESWAP16(DHCP_CLIENT_PORT)) &&
+    (mp->UDP.sourcePort     ==BYTESWAP16(DHCP_SERVER_PORT))) {
+
+  linkReadRandomAccess(DHCP_MAGIC_COOKIE_OFFSET);
+  uint8_t tmp[4];
+  linkReadBufferMemoryArray(4,tmp);
+  if (!memcmp(tmp,magic_cookie,4)) {
+    *flags|=(CS_DHCP);
+    dhcp_option_overload=DHCP_NO_OVERLOAD;
+  }
+}
+#endif
+return (size);
+}
+#endif
 // ---------------------------------------------------------------------------
 uint16_t linkPacketHeader(uint16_t maxSize,uint8_t * dataBuffer,uint8_t * flags) 
 { // Gets the next packet, or at least size header bytes.  
@@ -662,6 +992,12 @@ uint16_t linkPacketHeader(uint16_t maxSize,uint8_t * dataBuffer,uint8_t * flags)
   // See also linkMorePacket();
   // Should call packetDone() before next one, but automates this on next call.
   // Consequence is that if called twice on 'same' packet, actually moves to next.
+
+  // Fetch is staged : each layer's header is read only once the layer below
+  // has found the packet to be for us, and the payload only once a protocol
+  // handler is known to want it (UDP_Wanted(), TCP_Wanted()).  Anything else
+  // is dropped with the rest unread.  Any IP options are skipped in the
+  // fetch, so the transport header is always where MergedPacket expects.
  
 (*flags)=0;  // Clear on entry
 IPoptlen=0;  // ditto
@@ -679,39 +1015,44 @@ ptrThisPacket=ptrNextPacket;
 setBank(0);
 setReadPointer(ptrThisPacket,TRUE);
 
-linkReadBufferMemoryArray(2,&join.byte_1);   // Note Next Packet pointer is little endian
-ptrNextPacket=join.byte_1|((uint16_t)(join.byte_2)<<8);  // Our endianism is known by our compiler
+uint8_t preamble[ENC28J60_PREAMBLE];  // Next packet pointer, size, status : one burst
+readBufferMemoryArray(ENC28J60_PREAMBLE,preamble);
 
-linkReadBufferMemoryArray(2,(uint8_t *)&join.byte_1); // Also Littleendian
-size=(join.byte_1|((uint16_t)(join.byte_2)<<8))-4;    // -4 to drop CRC bytes
+ptrNextPacket=preamble[0]|((uint16_t)(preamble[1])<<8);  // Note little endian
+size=(preamble[2]|((uint16_t)(preamble[3])<<8))-4;       // Also. -4 to drop CRC bytes
 
-uint8_t status[2];
-linkReadBufferMemoryArray(2,status);
-if (!(status[0]&RX_OK)) {  // Dud packet
+if (!(preamble[4]&RX_OK)) {  // Dud packet
   linkDoneWithPacket();
   return (0);
 }
 inProgress=TRUE;
+fetched=0;
 
-uint16_t toRead=(size<MAX_HEADER_SIZE)?size:MAX_HEADER_SIZE;
-
-linkReadBufferMemoryArray(toRead,dataBuffer);
-// MAX_HEADER_SIZE(=42) reads Ethernet and IP headers and, as long as there
-// are no IP options, will have read an ICMP or UDP header as well.
+if (size<ETH_HEADER_SIZE) {  // Runt : give what there is
+  fetch(dataBuffer,size);
+  return (size);
+}
+fetch(dataBuffer,ETH_HEADER_SIZE);  // Stage 1 : Ethernet header
 
-if (size<14) return (size);
+uint8_t MACclass=MACForUs(&mp->Ethernet.destinationMAC);
+#ifdef STATS
+linkFilterCount[MACclass]++;
+#endif
+if (!MACclass) return (dropEarly(size,maxSize));  // Hash filter false positive
 
 uint16_t protocol=BYTESWAP16(mp->Ethernet.type);
 
 // if (protocol<=1500) return (protocol+14); // Non standard protocol, treated as length
-if (protocol<=1500) { linkDoneWithPacket(); return (0);} // Non standard protocol, to ignore
+if (protocol<=1500) return (dropEarly(size,maxSize)); // Non standard protocol, to ignore
 
 switch (protocol) {
 
   case ARPinETHERNET: // Fully handle ARP replies at the link level -------------------
     
-    if (MACForUs(&mp->Ethernet.destinationMAC) &&  // Only reply to ours
-        IP4ForUs(&mp->ARP.destinationIP) &&
+    if (size<MAX_HEADER_SIZE || maxSize<MAX_HEADER_SIZE) return (dropEarly(size,maxSize));
+    fetch(dataBuffer,MAX_HEADER_SIZE);  // Stage 2 : the ARP message
+
+    if (IP4ForUs(&mp->ARP.destinationIP) &&
         mp->ARP.type==BYTESWAP16(ARP_REQUEST)) {
 
       mp->ARP.type=BYTESWAP16(ARP_REPLY);
@@ -731,186 +1072,308 @@ switch (protocol) {
       mp->ARP.protocol_size=4;	// Length of IP V4
 
       linkPacketSend(dataBuffer,42,NO_CSUM,NULL,0);
+    } else if (mp->ARP.type==BYTESWAP16(ARP_REPLY)) {
+      handleARP((MergedARP *)dataBuffer);  // Learn it : may release parked frames
     }
     linkDoneWithPacket(); // Done with any ARP we heard, whether we replied or not.
     return (0);
 
-  case IP4inETHERNET: // ---------------------------------------------------------------
+  case IP4inETHERNET: { // -------------------------------------------------------------
 
-    // So, are there IP options?
+    if (size<ETH_HEADER_SIZE+IP_HEADER_SIZE || maxSize<MAX_HEADER_SIZE)
+      return (dropEarly(size,maxSize));
+    fetch(dataBuffer,ETH_HEADER_SIZE+IP_HEADER_SIZE);  // Stage 2 : IP header
+
+    // So, are there IP options?  Fetched (into where the transport header will
+    // go) only for the header checksum.
     IPoptlen=4*mp->IP4.headerLength-20;
+    uint16_t headers=ETH_HEADER_SIZE+IP_HEADER_SIZE+IPoptlen;
 
-    // We probably have the IP header in memory, so we can do a quick checksum.
-    // However if it had a lot of opions, it might not all be in memory.
+    if (mp->IP4.headerLength<5 || headers>size || headers>maxSize)
+      return (dropEarly(size,maxSize));
+    fetch(dataBuffer,headers);
 
-    int16_t topUp=(IPoptlen+ETH_HEADER_SIZE+IP_HEADER_SIZE)-MAX_HEADER_SIZE;
-    if ((topUp+toRead)>maxSize) topUp=maxSize-toRead;  // Stops buffer overflow
-    // if header read is larger than allocated buffer, but will then fail checksum.
-    // Unlikely to arise (IP options are rare) and impossible if buffer is 
-    // > (128+14+20)bytes (max IP4 headers + ethernet + IP4 header).
-    // Hence 162 is safe buffer length.  TODO - make more robust.
+    if (IP4checksum(mp)) return (dropEarly(size,maxSize));
+    *flags|=(CS_IP4); // Valid IP4
   
-    if (topUp>0) linkReadBufferMemoryArray(topUp,&dataBuffer[toRead]);
+    uint8_t protocol2=mp->IP4.protocol;
 
-    if (!IP4checksum(mp)) { 
-      *flags|=(CS_IP4); // Valid IP4
-      // Now does it contain something else?
+    // Only UDP matters until we have an address (DHCP) : see handlePacket()
+    if (!IP4ForUs(&mp->IP4.destination) &&
+        (MyState.IP==IP_SET || protocol2!=UDPinIP4)) return (dropEarly(size,maxSize));
 
-      if (size>=(ETH_HEADER_SIZE+IP_HEADER_SIZE+IPoptlen)) {
-        uint8_t protocol2=mp->IP4.protocol;
+    if (IPoptlen) { // Step over the options : transport header follows IP4 in MergedPacket
+      fetched=ETH_HEADER_SIZE+IP_HEADER_SIZE;
+      linkReadRandomAccess(headers);
+    }
 
-        // Now read rest of requested bytes of packet
-        uint16_t remainingRead=((size<maxSize)?size:maxSize)-toRead;
-        linkReadBufferMemoryArray(remainingRead,&dataBuffer[toRead]); // TODO is this right if options existed? ****
-        // N.B. This read now overwrites previous IP4 Options (if any existed)
+    if (IP4_FRAGMENT(mp)&BYTESWAP16((IP4_MF|IP4_OFFSET_MASK))) { // Part of a datagram
+#ifdef USE_FRAGMENTS
+      uint16_t payload=BYTESWAP16(mp->IP4.totalLength)-(IP_HEADER_SIZE+IPoptlen);
+      if (protocol2!=UDPinIP4 || headers+payload>size) return (dropEarly(size,maxSize));
 
-        if (protocol2==UDPinIP4) { 
+      uint8_t state=fragmentAdd(mp,payload,&dataBuffer[fetched],maxSize-fetched);
+      releaseFrame();  // It's in the 23LC1024 now
+      if (state!=FRAG_COMPLETE) return (0);
+      return (deliverReassembled(maxSize,dataBuffer,flags));
+#else
+      return (dropEarly(size,maxSize));  // Can't reassemble : don't let a part through
+#endif
+    }
 
-          uint16_t ibegin=ptrThisPacket+ENC28J60_PREAMBLE; 
-          wrapReadIndex(&ibegin);
-          uint16_t csum=TransportCsum(ibegin,dataBuffer,toRead+remainingRead,0,0,UDPinIP4,TRUE);
-          if (csum==mp->UDP.UDP_checksum) { 
-            *flags|=(CS_UDP);
+    // Bytes of the frame, less options, that there are and that we have room for
+    uint16_t available=size-IPoptlen;
+    if (available>maxSize) available=maxSize;
 
-#ifdef USE_DHCP 
-            if ((mp->UDP.destinationPort==BYTESWAP16(DHCP_CLIENT_PORT)) &&
-                (mp->UDP.sourcePort     ==BYTESWAP16(DHCP_SERVER_PORT))) {
-
-              setBank(0);
-              setReadPointer(ibegin+IPoptlen+DHCP_MAGIC_COOKIE_OFFSET,TRUE);  
-              uint8_t tmp;
-              readBufferByte(&tmp);
-              if (tmp!=magic_cookie[0]) break;
-              readBufferByte(&tmp);
-              if (tmp!=magic_cookie[1]) break;
-              readBufferByte(&tmp);
-              if (tmp!=magic_cookie[2]) break;
-              readBufferByte(&tmp);
-              if (tmp!=magic_cookie[3]) break;
- 
-              *flags|=(CS_DHCP);
-              // NB. Read pointer now in right place
-              dhcp_option_overload=DHCP_NO_OVERLOAD; // Default.  Overwritten when options read.
-            } 
-#endif          
-          } else {
-            LEDON; // Debug - should not reach
-            eeprom_write_word((uint16_t *)0,mp->UDP.UDP_checksum);
-            eeprom_write_word((uint16_t *)2,csum);
-            eeprom_write_word((uint16_t *)4,ibegin);
-            eeprom_write_word((uint16_t *)6,size);
-            eeprom_write_word((uint16_t *)8,toRead);
-            eeprom_write_word((uint16_t *)10,remainingRead);
-            eeprom_write_word((uint16_t *)12,0);
-            
-            eeprom_write_block((uint8_t *)dataBuffer,(void *)32,size);        
-            
-            while (1); 
-          }
-        }
-        else if (protocol2==TCPinIP4) { 
-          uint16_t ibegin=ptrThisPacket+ENC28J60_PREAMBLE;  
-          wrapReadIndex(&ibegin);
-          uint16_t csum=TransportCsum(ibegin,dataBuffer,toRead+remainingRead,0,0,TCPinIP4,TRUE);
-          if (csum==mp->TCP.TCP_checksum) {
-            *flags|=(CS_TCP);
-          } else {
-            LEDON; // Debug - should not reach
-            eeprom_write_word((uint16_t *)0,mp->TCP.TCP_checksum);
-            eeprom_write_word((uint16_t *)2,csum);
-            eeprom_write_word((uint16_t *)4,ibegin);
-            eeprom_write_word((uint16_t *)6,size);
-            eeprom_write_word((uint16_t *)8,toRead);
-            eeprom_write_word((uint16_t *)10,remainingRead);
-            eeprom_write_word((uint16_t *)12,0);
-            
-            eeprom_write_block((uint8_t *)dataBuffer,(void *)32,size);        
-            
-            while (1); 
-          }
-        }
+    uint16_t ibegin=ptrThisPacket+ENC28J60_PREAMBLE;
+    wrapReadIndex(&ibegin);
 
-        else if (protocol2==ICMPinIP4) {
-          if (!ICMPchecksum(mp)) {
-            *flags|=(CS_ICMP);
+    if (protocol2==UDPinIP4) {
 
-            if (IP4ForUs(&mp->IP4.destination)==OUR_IP_UNICAST) { 
-  
-              // Needs all of packet in memory, hence size limited.  Could be designed 
-              // otherwise, but doesn't really need to be for routine use.
-              // Note that in theory ICMP packets can be very large. ~64kB  For now, 
-              // just do the small (but usual) ones.  Corner case not really 
-              // relevant to PING (what OS uses huge ping packet?)              
+      if (available<ETH_HEADER_SIZE+IP_HEADER_SIZE+UDP_HEADER_SIZE)
+        return (dropEarly(size,maxSize));
+      fetch(dataBuffer,ETH_HEADER_SIZE+IP_HEADER_SIZE+UDP_HEADER_SIZE);  // Stage 3
 
-#ifdef IMPLEMENT_PING
-              if (mp->ICMP.messagetype == PING) { 
-
-                mp->ICMP.messagetype = PONG;  // Set packet as reply
-                copyIP4(&mp->IP4.destination,&mp->IP4.source);  
-                copyIP4(&mp->IP4.source,&myIP);
-                copyMAC(&mp->Ethernet.destinationMAC,&mp->Ethernet.sourceMAC);
-                copyMAC(&mp->Ethernet.sourceMAC,&myMAC);
-                mp->IP4.headerLength=5; // No IP options in reply
-                mp->IP4.TTL=0x80;        
-
-                linkPacketSend(dataBuffer,size<maxSize?size:maxSize,(CS_IP4 | CS_ICMP),NULL,0);
-                // Avoid heartbleed-like behaviour, potentially at the risk of an invalid response
-                // Although checksum test probably stops large incoming packets.
-
-                linkDoneWithPacket(); 
-                return (0);
-              }
-#endif  // Doing PING
-            }
-          }
+      if (!UDP_Wanted(BYTESWAP16(mp->UDP.destinationPort),BYTESWAP16(mp->UDP.sourcePort)))
+        return (dropEarly(size,maxSize));
+      fetch(dataBuffer,available);  // Stage 4 : payload, as much as will fit
+
+      uint16_t csum=TransportCsum(ibegin,dataBuffer,fetched,0,0,UDPinIP4,TRUE);
+      if (csum==mp->UDP.UDP_checksum) {
+        *flags|=(CS_UDP);
+
+#ifdef USE_DHCP 
+        if ((mp->UDP.destinationPort==BYTESWAP16(DHCP_CLIENT_PORT)) &&
+            (mp->UDP.sourcePort     ==BYTESWAP16(DHCP_SERVER_PORT))) {
+
+          setBank(0);
+          setReadPointer(ibegin+IPoptlen+DHCP_MAGIC_COOKIE_OFFSET,TRUE);
+          uint8_t tmp[4];
+          readBufferMemoryArray(4,tmp);
+          if (memcmp(tmp,magic_cookie,4)) break;
+ 
+          *flags|=(CS_DHCP);
+          // NB. Read pointer now in right place
+          dhcp_option_overload=DHCP_NO_OVERLOAD; // Default.  Overwritten when options read.
         }
+#endif          
+      } else {  // Corrupt, or not what it claims to be : dropped
+        linkDoneWithPacket();
+        return (0);
+      }
+    }
+#ifdef USE_TCP
+    else if (protocol2==TCPinIP4) {
+
+      if (available<ETH_HEADER_SIZE+IP_HEADER_SIZE+TCP_HEADER_SIZE)
+        return (dropEarly(size,maxSize));
+      fetch(dataBuffer,ETH_HEADER_SIZE+IP_HEADER_SIZE+TCP_HEADER_SIZE);  // Stage 3
+
+      if (!TCP_Wanted(BYTESWAP16(mp->TCP.destinationPort)))
+        return (dropEarly(size,maxSize));
+      fetch(dataBuffer,available);  // Stage 4 : options and payload
+
+      uint16_t csum=TransportCsum(ibegin,dataBuffer,fetched,0,0,TCPinIP4,TRUE);
+      if (csum==mp->TCP.TCP_checksum) {
+        *flags|=(CS_TCP);
+      } else {  // Ditto
+        linkDoneWithPacket();
+        return (0);
       }
     }
+#endif
+#ifdef IMPLEMENT_PING
+    else if (protocol2==ICMPinIP4) { // Only echo requests to us get past here
+      uint16_t ICMPlength=BYTESWAP16(mp->IP4.totalLength)-(IP_HEADER_SIZE+IPoptlen);
+
+      if (IP4ForUs(&mp->IP4.destination)!=OUR_IP_UNICAST ||
+          ICMPlength<ICMP_HEADER_SIZE || (headers+ICMPlength)>size ||  // Truncated
+          (ETH_HEADER_SIZE+IP_HEADER_SIZE+ICMPlength)>MAX_TX_PACKET ||
+          available<ETH_HEADER_SIZE+IP_HEADER_SIZE+ICMP_HEADER_SIZE)
+        return (dropEarly(size,maxSize));
+      fetch(dataBuffer,ETH_HEADER_SIZE+IP_HEADER_SIZE+ICMP_HEADER_SIZE);  // Stage 3
+
+      if (mp->ICMP.messagetype!=PING) return (dropEarly(size,maxSize));
+
+      // Small ones are quickest fetched and checked in RAM.  Otherwise the 
+      // message is checked where it lies, so the payload never crosses SPI
+      // twice.  Note that in theory ICMP packets can be very large (~64kB),
+      // but we only take what fits a frame.
+      uint16_t ptrICMP=ptrThisPacket+ENC28J60_PREAMBLE+headers;
+      uint16_t csum;
+      if (!IPoptlen && (ETH_HEADER_SIZE+IP_HEADER_SIZE+ICMPlength)<=available) {
+        fetch(dataBuffer,ETH_HEADER_SIZE+IP_HEADER_SIZE+ICMPlength);
+        csum=ICMPchecksum(mp);
+      } else csum=pktCsum(ptrICMP,ICMPlength,TRUE);
+      if (csum) return (dropEarly(size,maxSize));
+      *flags|=(CS_ICMP);
+
+      sendPong(mp,ptrICMP,ICMPlength);  // Payload stays in the ENC28J60
+
+      linkDoneWithPacket();
+      return (0);
+    }
+#endif
+    else return (dropEarly(size,maxSize));  // Nothing here wants it
 
     break;
-
+  }
   default: //-------------------------------------------------------------------------
     // What are you sending me that's not IP4 or ICMP?
-    linkDoneWithPacket(); 
-    return (0);
+    return (dropEarly(size,maxSize));
     break;
 }
 return size;  // Flags return the checksum state
 }
 // ---------------------------------------------------------------------------
 void linkReadRandomAccess(uint16_t offset) 
-  { setBank(0); setReadPointer(ptrThisPacket+offset+ENC28J60_PREAMBLE,TRUE); }
+{ 
+#ifdef USE_FRAGMENTS
+if (reassembled) {
+  ptrSRAM=sramBase+offset;
+  return;
+}
+#endif
+setBank(0); 
+setReadPointer(ptrThisPacket+offset+ENC28J60_PREAMBLE,TRUE); 
+}
 // ---------------------------------------------------------------------------
 void linkDoneWithPacket(void) 
 {
+#ifdef USE_FRAGMENTS
+if (reassembled) { // Its last frame went as it was read
+  reassembled=FALSE;
+  fragmentDone();
+  inProgress=FALSE;
+  return;
+}
+#endif
+releaseFrame();
+}
+// ---------------------------------------------------------------------------
+static void releaseFrame(void) 
+{ // Frees the packet in hand from the RX ring
 uint16_t oddERXRDPT;
 if (ptrNextPacket==ERXST) oddERXRDPT=ERXND;        // Compensate for errata 14 - must be odd.
 else                      oddERXRDPT=ptrNextPacket-1; // Method needs ERXND to be odd
 
+setBank(0);
 writeEthRegister(0x0C,oddERXRDPT&0xFF);  // L,H RX read pointer (must write low first)
 writeEthRegister(0x0D,oddERXRDPT>>8);    // Frees the space
+ptrFreed=oddERXRDPT;
 
 ethBitFieldSet(ETH_ECON2,ECON2_PKTDEC);  // Decrement packet counter   
 
 inProgress=FALSE;
 }
 // ---------------------------------------------------------------------------
+#ifdef ETH_INTERRUPT
+ISR(INT0_vect)
+{ // ENC28J60 INT pin has fallen : a packet, or an error.  No SPI here (the main
+  // line may be mid-transaction), just note it for linkPacketsAvailable().
+ethPending=TRUE;
+}
+// ---------------------------------------------------------------------------
+static void serviceInterrupt(void)
+{ // Deal with errors flagged, and re-arm.  Datasheet 12.0 : clearing INTIE 
+  // and setting it again forces a fresh INT edge if anything is still 
+  // pending, so nothing arriving while we work is missed.
+
+ethBitFieldClr(ETH_EIE,EIE_INTIE);
+
+uint8_t eir=readEthRegister(ETH_EIR);
+if (eir&EIR_RXERIF) {  // RX buffer full, frame(s) dropped
+#ifdef STATS
+  linkRxErrors++;
+#endif
+  ethBitFieldClr(ETH_EIR,EIR_RXERIF);
+}
+if (eir&EIR_TXERIF) {  // Errata point 12 : reset TX logic, abandon frame
+#ifdef STATS
+  linkTxErrors++;
+#endif
+  ethBitFieldSet(ETH_ECON1,ECON1_TXRST);
+  ethBitFieldClr(ETH_ECON1,ECON1_TXRST);
+  ethBitFieldClr(ETH_ECON1,ECON1_TXRTS);
+  ethBitFieldClr(ETH_EIR,EIR_TXERIF);
+}
+
+ethBitFieldSet(ETH_EIE,EIE_INTIE);
+}
+#endif
+// ---------------------------------------------------------------------------
 uint8_t linkPacketsAvailable(void) // Acts as boolean and count
 {
+#ifdef ETH_INTERRUPT
+// Only talk to the chip when it has signalled - but occasionally anyway, in
+// case a PKTIF edge was missed (errata 6).
+if (!ethPending && (++idleCalls<ETH_POLL_BACKSTOP)) return (0);
+idleCalls=0;
+ethPending=FALSE;  // Before we look : any INT from here on will set it again
+serviceInterrupt();
+#endif
+
 setBank(1);
-return (readEthRegister(0x19)); 
+uint8_t count=readEthRegister(0x19);
+
+#ifdef ETH_INTERRUPT
+if (count) ethPending=TRUE;  // No new edge while PKTIF stays set, so remember
+#endif
+
+return (count); 
 }
 // ---------------------------------------------------------------------------
-void linkPacketSend(uint8_t * dataBuffer,uint16_t length,uint8_t checksums,
+uint16_t linkRxRoom(void)
+{ // Bytes free in the RX ring now : from where the chip writes next (ERXWRPT) 
+  // round to what we have freed (ERXRDPT), as datasheet 6.1.  Frames waiting,
+  // and the one in hand, are not free until linkDoneWithPacket().
+uint16_t write;
+
+setBank(0);
+write=readEthRegister(0x0E);                // L,H RX write pointer
+write|=(uint16_t)readEthRegister(0x0F)<<8;
+
+if (write>ptrFreed)  return ((ERXND-ERXST)-(write-ptrFreed));
+if (write==ptrFreed) return (ERXND-ERXST);
+return (ptrFreed-write-1);
+}
+// ---------------------------------------------------------------------------
+#define BLOCK_SIZE (MAX_STORED_SIZE-(ETH_HEADER_SIZE+IP_HEADER_SIZE+TCP_HEADER_SIZE)) 
+// Quickest if even no., achieved by MAX STORED even
+
+static void writeFromCallback(uint8_t * scratch,uint16_t dataLen,
+            void (* callback)(uint16_t start,uint16_t length,uint8_t * result),
+            uint16_t offset,uint32_t * sum)
+{ // Moves payload in intervals of BLOCK_SIZE, retrieving data from callback and
+  // passing it to the ENC28J60 memory (write pointer already in place).  Scratch
+  // is reused for each.  The payload csum is added to sum meanwhile (faster, SRAM).
+
+for (uint16_t i=0;i<dataLen;i+=BLOCK_SIZE) {
+  uint16_t blen=dataLen-i;
+  if (blen>BLOCK_SIZE) blen=BLOCK_SIZE;
+  callback(offset+i,blen,scratch);
+  checksumBare(sum,(uint16_t *)scratch,blen/2);  // Precompute its checksum while in RAM
+  if (blen%2) {
+    join.word=((uint16_t *)scratch)[blen/2]; 
+    join.byte_2=0;
+    *sum+=join.word;
+  }
+  writeBufferMemoryArray(blen,scratch);
+}
+}
+// ---------------------------------------------------------------------------
+static uint8_t writeFrame(uint16_t ptr,uint8_t * dataBuffer,uint16_t length,
+            uint8_t checksums,
             void (* callback)(uint16_t start,uint16_t length,uint8_t * result),
             uint16_t offset)
-{
+{ // Writes the frame, with the checksums asked for, into the TX slot whose control
+  // byte is at ptr (write pointer just after it).  FALSE if not a frame we can build.
+
 // N.B. Cannot assume whole packet is in dataBuffer because of 'oversize' technique.
 // Note that packet is preceded by single byte instruction (allows override of
-// default tx settings).  Hence dataBuffer[0] aligns with ETXST+1.  Often obscured
+// default tx settings).  Hence dataBuffer[0] aligns with TX slot start+1.  Often obscured
 // by un-indexed 'stream' access.
 
-#define CTRL_HEADER_SIZE (1)  // 1 byte header
 #define IP_CHECKSUM_AT   (CTRL_HEADER_SIZE+ETH_HEADER_SIZE+10)
 #define ICMP_CHECKSUM_AT (CTRL_HEADER_SIZE+ETH_HEADER_SIZE+IP_HEADER_SIZE+2)
 #define UDP_CHECKSUM_AT  (CTRL_HEADER_SIZE+ETH_HEADER_SIZE+IP_HEADER_SIZE+6)
@@ -918,33 +1381,9 @@ void linkPacketSend(uint8_t * dataBuffer,uint16_t length,uint8_t checksums,
 
 MergedPacket * mp=(MergedPacket *)dataBuffer;
 
-if (length==0) return;
-if (length>MAX_TX_PACKET) length=MAX_TX_PACKET;  // Truncate better than drop?
-
 uint16_t forCsum=0;    // Transport csums : Default zero=full packet
 uint32_t precompute=0; // Transport csums : precomputed portion
 
-// Wait for last one
-while (readEthRegister(ETH_ECON1) & ECON1_TXRTS) { // Probably something being sent
-// Errata point 12.
-  if ((readEthRegister(ETH_EIR) & EIR_TXERIF) ) {
-    ethBitFieldSet(ETH_ECON1,ECON1_TXRST);
-    ethBitFieldClr(ETH_ECON1,ECON1_TXRST);
-  }
-}
-
-setBank(0);
-writeEthRegister(0x04,ETXST&0xFF);           // L,H TX buffer start
-writeEthRegister(0x05,ETXST>>8);    
-
-writeEthRegister(0x06,(length+ETXST)&0xFF);  // L,H TX buffer end
-writeEthRegister(0x07,(length+ETXST)>>8);    
-
-writeEthRegister(0x02,ETXST&0xFF);           // L,H write pointer - put packet here
-writeEthRegister(0x03,ETXST>>8);    
-
-writeBufferByte(0x00);  // 1st byte is Control; zero is to follow MACON3
-
 if ((mp->UDP.destinationPort==BYTESWAP16(DHCP_SERVER_PORT)) && // Order for speed
     (mp->UDP.sourcePort     ==BYTESWAP16(DHCP_CLIENT_PORT)) &&
     (mp->Ethernet.type==BYTESWAP16(IP4inETHERNET)) &&
@@ -992,30 +1431,14 @@ if ((mp->UDP.destinationPort==BYTESWAP16(DHCP_SERVER_PORT)) && // Order for spee
     uint16_t dataAt;
     if      (mp->IP4.protocol==UDPinIP4) dataAt=ETH_HEADER_SIZE+IP_HEADER_SIZE+UDP_HEADER_SIZE;
     else if (mp->IP4.protocol==TCPinIP4) dataAt=ETH_HEADER_SIZE+IP_HEADER_SIZE+TCP_HEADER_SIZE;
-    else return; // No other protocols handled (ICMP elsewhere).
+    else return (FALSE); // No other protocols handled (ICMP elsewhere).
     
-    // Now move in intervals of size BLOCK_SIZE, retrieving data from callback and passing
-    // it to the ENC28J60 memory.  Use top half of dataBuffer as temp storage (repeated reuse).
-    // Do payload csum at this point (faster, SRAM) 
+    // Use top half of dataBuffer as temp storage for the payload (repeated reuse).
 
     writeBufferMemoryArray(dataAt,dataBuffer);  // All headers, no data
-    #define BLOCK_SIZE (MAX_STORED_SIZE-(ETH_HEADER_SIZE+IP_HEADER_SIZE+TCP_HEADER_SIZE)) 
-    // Quickest if even no., achieved by MAX STORED even
-    uint16_t dataLen=length-dataAt;
-    for (uint16_t i=0;i<dataLen;i+=BLOCK_SIZE) {
-      uint16_t blen=dataLen-i;
-      if (blen>BLOCK_SIZE) blen=BLOCK_SIZE;
-      callback(offset+i,blen,&dataBuffer[dataAt]);
-      checksumBare(&precompute,(uint16_t *)&dataBuffer[dataAt],blen/2);  // Precompute its checksum while in RAM
-      if (blen%2) {
-        join.word=mp->words[(dataAt+blen)/2]; 
-        join.byte_2=0;
-        precompute+=join.word;
-      }
-      writeBufferMemoryArray(blen,&dataBuffer[dataAt]);
-    }
+    writeFromCallback(&dataBuffer[dataAt],length-dataAt,callback,offset,&precompute);
     forCsum=dataAt;    
-  } else return; // Ditto
+  } else return (FALSE); // Ditto
     
 } else { // Short packet within RAM array
   writeBufferMemoryArray(length,dataBuffer);  
@@ -1027,8 +1450,8 @@ if (checksums & CS_ICMP) {
   mp->ICMP.checksum=0;  // 0 does not suffer from endianism
   join.word=ICMPchecksum(mp);  
 
-  writeEthRegister(0x02,(ETXST+ICMP_CHECKSUM_AT)&0xFF);  // Put in the packet
-  writeEthRegister(0x03,(ETXST+ICMP_CHECKSUM_AT)>>8);    
+  writeEthRegister(0x02,(ptr+ICMP_CHECKSUM_AT)&0xFF);  // Put in the packet
+  writeEthRegister(0x03,(ptr+ICMP_CHECKSUM_AT)>>8);    
 
   writeBufferMemoryArray(2,&join.byte_1);  // Same (unknown) endianism as the calculator
 }
@@ -1038,11 +1461,11 @@ if (checksums & CS_IP4) {  // IPv4 checksum is wanted.  Starts at byte 14 and is
 // Option A - slow - read back from ENC28J60. Tested OK.
 
 /*
-  writeEthRegister(0x02,(ETXST+IP_CHECKSUM_AT)&0xFF);  // L,H write pointer - checksum goes here.  Start as zero.
-  writeEthRegister(0x03,(ETXST+IP_CHECKSUM_AT)>>8);  
+  writeEthRegister(0x02,(ptr+IP_CHECKSUM_AT)&0xFF);  // L,H write pointer - checksum goes here.  Start as zero.
+  writeEthRegister(0x03,(ptr+IP_CHECKSUM_AT)>>8);  
   writeBufferMemoryZeros(2);
 
-  join.csum=pktCsum((CTRL_HDR_SIZE+ETXST+ETH_HEADER_SIZE),IP_HEADER_SIZE,FALSE);
+  join.csum=pktCsum((CTRL_HDR_SIZE+ptr+ETH_HEADER_SIZE),IP_HEADER_SIZE,FALSE);
 */
 
 // Option B - we know we have it in RAM, so do quick read.  Tested OK.
@@ -1052,34 +1475,355 @@ if (checksums & CS_IP4) {  // IPv4 checksum is wanted.  Starts at byte 14 and is
 
 //Back to common code.
 
-  writeEthRegister(0x02,(ETXST+IP_CHECKSUM_AT)&0xFF);  // Put in the packet
-  writeEthRegister(0x03,(ETXST+IP_CHECKSUM_AT)>>8);    
+  writeEthRegister(0x02,(ptr+IP_CHECKSUM_AT)&0xFF);  // Put in the packet
+  writeEthRegister(0x03,(ptr+IP_CHECKSUM_AT)>>8);    
 
   writeBufferMemoryArray(2,&join.byte_1);  // Same (unknown) endianism as the calculator
 }
 
 if (checksums & CS_UDP) {
 
-  join.word=TransportCsum(CTRL_HEADER_SIZE+ETXST,dataBuffer,
+  join.word=TransportCsum(CTRL_HEADER_SIZE+ptr,dataBuffer,
      (length<MAX_STORED_SIZE)?length:MAX_STORED_SIZE,forCsum,precompute,UDPinIP4,FALSE);  
-  writeEthRegister(0x02,(ETXST+UDP_CHECKSUM_AT)&0xFF);  // Put into packet
-  writeEthRegister(0x03,(ETXST+UDP_CHECKSUM_AT)>>8);    
+  writeEthRegister(0x02,(ptr+UDP_CHECKSUM_AT)&0xFF);  // Put into packet
+  writeEthRegister(0x03,(ptr+UDP_CHECKSUM_AT)>>8);    
   //join.word=0; // Testing override - works 'cos UDP CSUM is allowed to be zero
   writeBufferMemoryArray(2,&join.byte_1);  // Same (unknown) endianism as the calculator
 }
 if (checksums & CS_TCP) {
 
-  join.word=TransportCsum(CTRL_HEADER_SIZE+ETXST,dataBuffer,
+  join.word=TransportCsum(CTRL_HEADER_SIZE+ptr,dataBuffer,
              (length<MAX_STORED_SIZE)?length:MAX_STORED_SIZE,forCsum,precompute,TCPinIP4,FALSE);  
-  writeEthRegister(0x02,(ETXST+TCP_CHECKSUM_AT)&0xFF);  // Put back where it came from
-  writeEthRegister(0x03,(ETXST+TCP_CHECKSUM_AT)>>8);    
+  writeEthRegister(0x02,(ptr+TCP_CHECKSUM_AT)&0xFF);  // Put back where it came from
+  writeEthRegister(0x03,(ptr+TCP_CHECKSUM_AT)>>8);    
   writeBufferMemoryArray(2,&join.byte_1);  // Same (unknown) endianism as the calculator  
+  mp->TCP.TCP_checksum=join.word;  // And in RAM : a retransmission need only adjust it
 }
 
-ethBitFieldSet(ETH_ECON1,ECON1_TXRTS); // launch the packet
+return (TRUE);
+}
+// ---------------------------------------------------------------------------
+void linkPacketSend(uint8_t * dataBuffer,uint16_t length,uint8_t checksums,
+            void (* callback)(uint16_t start,uint16_t length,uint8_t * result),
+            uint16_t offset)
+{
+if (length==0) return;
+if (length>MAX_TX_PACKET) length=MAX_TX_PACKET;  // Truncate better than drop?
 
-return;
+prepareTX(length);  // Next slot - last one may still be sending
+
+if (writeFrame(ptrTX,dataBuffer,length,checksums,callback,offset)) {
+  launchTX();  // Waits for last one
+  keepable=TRUE;
+}
 }
+#ifdef SEND_FRAGMENTS
+// ---------------------------------------------------------------------------
+void linkFragmentSend(uint8_t * dataBuffer,uint16_t length,
+            void (* callback)(uint16_t start,uint16_t length,uint8_t * result),
+            uint16_t offset)
+{ // A UDP datagram too big for one frame : Ethernet, IP and UDP headers in 
+  // dataBuffer (as for linkPacketSend()), the UDP data from the callback.  Sent
+  // as IP4 fragments, last first, so that the UDP checksum - summed as each is
+  // written - is complete when the first, which carries it, is written.  
+  // Receivers reassemble in any order.  Nothing beyond BLOCK_SIZE held in RAM.
+  // Each fragment's IP checksum is the caller's, adjusted for the two words
+  // that differ (RFC 1624).
+
+MergedPacket * mp=(MergedPacket *)dataBuffer;
+uint16_t * IPwords=(uint16_t *)&mp->IP4;
+uint16_t was[2]={IPwords[1],IPwords[3]};    // Total length, fragment : restored after
+uint16_t IPchecksum=mp->IP4.checksum;       // Ditto
+uint16_t payload=length-(ETH_HEADER_SIZE+IP_HEADER_SIZE);  // UDP header and data
+uint16_t at=((payload-1)/IP4_FRAGMENT_DATA)*IP4_FRAGMENT_DATA; // Last fragment's offset
+uint16_t part;
+uint32_t sum=0;
+
+mp->UDP.UDP_checksum=0;
+checksumBare(&sum,(uint16_t *)&mp->IP4.source,4);  // Pseudo header ...
+sum+=BYTESWAP16(UDPinIP4);
+sum+=mp->UDP.messageLength;
+checksumBare(&sum,(uint16_t *)&mp->UDP,UDP_HEADER_SIZE/2);  // ... and UDP header
+
+while (1) {
+  part=payload-at;
+  if (part>IP4_FRAGMENT_DATA) part=IP4_FRAGMENT_DATA;
+
+  mp->IP4.totalLength=BYTESWAP16((IP_HEADER_SIZE+part));
+  IP4_FRAGMENT(mp)=BYTESWAP16(((at/8)|((at+part<payload)?IP4_MF:0)));
+  uint16_t now[2]={IPwords[1],IPwords[3]};
+  mp->IP4.checksum=checksumAdjust(IPchecksum,was,now,2);
+
+  prepareTX(ETH_HEADER_SIZE+IP_HEADER_SIZE+part);
+  if (at) {  // Offsets count the UDP header : callback's don't
+    writeBufferMemoryArray(ETH_HEADER_SIZE+IP_HEADER_SIZE,dataBuffer);
+    writeFromCallback(&dataBuffer[ETH_HEADER_SIZE+IP_HEADER_SIZE+UDP_HEADER_SIZE],part,
+                      callback,offset+at-UDP_HEADER_SIZE,&sum);
+  } else {   // The first : checksum goes in once all the data is summed
+    writeBufferMemoryArray(ETH_HEADER_SIZE+IP_HEADER_SIZE+UDP_HEADER_SIZE,dataBuffer);
+    writeFromCallback(&dataBuffer[ETH_HEADER_SIZE+IP_HEADER_SIZE+UDP_HEADER_SIZE],
+                      part-UDP_HEADER_SIZE,callback,offset,&sum);
+
+    join.word=resolveCsum(sum);
+    if (!join.word) join.word=0xFFFF;  // Zero means none was computed
+    writeEthRegister(0x02,(ptrTX+UDP_CHECKSUM_AT)&0xFF);
+    writeEthRegister(0x03,(ptrTX+UDP_CHECKSUM_AT)>>8);    
+    writeBufferMemoryArray(2,&join.byte_1);
+  }
+  launchTX();  // Waits for last one
+
+  if (!at) break;
+  at-=IP4_FRAGMENT_DATA;
+}
+
+IPwords[1]=was[0];  // As the caller left it
+IPwords[3]=was[1];
+mp->IP4.checksum=IPchecksum;
+}
+#endif
+// ---------------------------------------------------------------------------
+uint8_t linkPacketHold(uint8_t * dataBuffer,uint16_t length,uint8_t checksums,
+            void (* callback)(uint16_t start,uint16_t length,uint8_t * result),
+            uint16_t offset)
+{ // As linkPacketSend(), but the frame is parked in its TX slot rather than sent : 
+  // for when the destination MAC is still to be found (ARP).  Returns the slot to 
+  // pass to linkHeldSend() or linkHeldDrop(), or LINK_NOT_HELD if none can be spared.
+  // One slot is always left for sending.  Rare, so just wait for any frame in flight.
+
+uint8_t slot;
+
+keepable=FALSE;
+if (length==0 || held>=TX_SLOTS-1) return (LINK_NOT_HELD);
+if (length>MAX_TX_PACKET) length=MAX_TX_PACKET; 
+
+for (slot=0;heldLength[slot];slot++) ;  // There is a free one
+
+uint16_t ptr=ETXST+slot*TX_SLOT_SIZE;
+
+waitTX();
+setBank(0);
+writeEthRegister(0x02,ptr&0xFF);  // L,H write pointer
+writeEthRegister(0x03,ptr>>8);    
+writeBufferByte(0x00);            // Control byte, as prepareTX()
+
+if (!writeFrame(ptr,dataBuffer,length,checksums,callback,offset)) return (LINK_NOT_HELD);
+
+heldLength[slot]=length;
+held++;
+return (slot);
+}
+// ---------------------------------------------------------------------------
+void linkHeldSend(uint8_t slot,const MAC_address * MAC)
+{ // Completes a parked frame with its destination MAC and sends it.  Frees the slot,
+  // which becomes the current one : prepareTX() moves on from the frame in flight.
+
+if (slot>=TX_SLOTS || !heldLength[slot]) return;
+
+slotTX=slot;
+ptrTX=ETXST+slot*TX_SLOT_SIZE;
+lengthTX=heldLength[slot];
+heldLength[slot]=0;
+held--;
+keepable=FALSE;
+
+setBank(0);
+writeEthRegister(0x02,(ptrTX+CTRL_HEADER_SIZE)&0xFF);  // Destination MAC leads the frame
+writeEthRegister(0x03,(ptrTX+CTRL_HEADER_SIZE)>>8);    
+writeBufferMemoryArray(sizeof(MAC_address),(uint8_t *)MAC);
+
+launchTX();
+}
+// ---------------------------------------------------------------------------
+void linkHeldDrop(uint8_t slot)
+{ // Gives up on a parked frame
+if (slot<TX_SLOTS && heldLength[slot]) {
+  heldLength[slot]=0;
+  held--;
+}
+}
+#ifdef USE_TCP
+// ---------------------------------------------------------------------------
+uint8_t linkKeepSent(void)
+{ // Keeps a copy of the frame linkPacketSend() has just sent, for linkKeptSend() to 
+  // send again : TCP retransmission with neither a copy in our RAM nor the frame 
+  // crossing SPI twice.  The copy is by the ENC28J60's own DMA, into the first 
+  // gap in KEEPST..ETXST that fits.  Returns the slot to pass to linkKeptSend() or 
+  // linkKeptDrop(), or LINK_NOT_HELD if there is no room (or the frame was parked).
+
+uint8_t slot,i,moved;
+uint16_t at=KEEPST;
+uint16_t size=lengthTX+8;  // As a TX slot : control byte, frame, status vector
+
+if (!keepable) return (LINK_NOT_HELD);
+
+for (slot=0;slot<KEEP_SLOTS && keptLength[slot];slot++) ;
+if (slot==KEEP_SLOTS) return (LINK_NOT_HELD);
+
+do {  // Step past any kept frame in the way, until none is
+  moved=FALSE;
+  for (i=0;i<KEEP_SLOTS;i++)
+    if (keptLength[i] && at<keptAt[i]+keptLength[i]+8 && keptAt[i]<at+size) {
+      at=keptAt[i]+keptLength[i]+8;
+      moved=TRUE;
+    }
+} while (moved);
+if (at+size>ETXST) return (LINK_NOT_HELD);
+
+dmaCopy(ptrTX,CTRL_HEADER_SIZE+lengthTX,at,FALSE);
+
+keptAt[slot]=at;
+keptLength[slot]=lengthTX;
+return (slot);
+}
+// ---------------------------------------------------------------------------
+void linkKeptPatch(uint8_t slot,uint16_t at,const uint8_t * bytes,uint8_t length)
+{ // Rewrites 'length' bytes of a kept frame, 'at' bytes in (e.g. an ack that has
+  // moved on, and its checksum).  Only these cross SPI.
+
+if (slot>=KEEP_SLOTS || !keptLength[slot]) return;
+
+waitTX();  // It may itself still be on the wire
+setBank(0);
+writeEthRegister(0x02,(keptAt[slot]+CTRL_HEADER_SIZE+at)&0xFF);  // L,H write pointer
+writeEthRegister(0x03,(keptAt[slot]+CTRL_HEADER_SIZE+at)>>8);    
+writeBufferMemoryArray(length,bytes);
+}
+// ---------------------------------------------------------------------------
+void linkKeptSend(uint8_t slot)
+{ // Sends a kept frame again, from where it is kept.  It stays kept.
+
+if (slot>=KEEP_SLOTS || !keptLength[slot]) return;
+
+ptrTX=keptAt[slot];
+lengthTX=keptLength[slot];
+keepable=FALSE;
+
+launchTX();
+}
+// ---------------------------------------------------------------------------
+void linkKeptDrop(uint8_t slot)
+{ // Done with a kept frame (ACK'd, or given up on) : its space is free
+if (slot<KEEP_SLOTS) keptLength[slot]=0;
+}
+#endif
+#if STORE_SPACE
+// ---------------------------------------------------------------------------
+void linkStoreWrite(uint16_t at,const uint8_t * bytes,uint16_t length)
+{ // Into the STORE_SPACE bytes an application keeps in the ENC28J60, 'at' bytes
+  // in : data too big for our RAM, e.g. to send later from a callback.  Beyond
+  // the store, nothing is written.
+
+if (at>=STORE_SPACE || !length) return;
+if (length>STORE_SPACE-at) length=STORE_SPACE-at;
+
+setBank(0);
+writeEthRegister(0x02,(STOREST+at)&0xFF);  // L,H write pointer
+writeEthRegister(0x03,(STOREST+at)>>8);    
+writeBufferMemoryArray(length,bytes);
+}
+// ---------------------------------------------------------------------------
+void linkStoreRead(uint16_t at,uint8_t * bytes,uint16_t length)
+{ // Back from the store.  Only the read pointer moves, so this may feed a frame
+  // being written (a callback of linkPacketSend()).
+
+if (at>=STORE_SPACE || !length) return;
+if (length>STORE_SPACE-at) length=STORE_SPACE-at;
+
+setBank(0);
+setReadPointer(STOREST+at,FALSE);
+readBufferMemoryArray(length,bytes);
+}
+#endif
+#ifdef REGRESS
+// ---------------------------------------------------------------------------
+void linkBenchmarkSPI(uint8_t * scratch,uint16_t * results)
+{ // Cycle counts (TIMER1 at clk/1) to move BENCH_SPI_BYTES over SPI, comparing the
+  // original byte-at-a-time SPIN_SPI loop with the burst engine.  Results are :
+  // [0] RX legacy, [1] RX burst, [2] TX legacy, [3] TX burst.  Bytes per second
+  // is then F_CPU*BENCH_SPI_BYTES/cycles.  Uses the TX area, so call when idle.
+  // Scratch must hold BENCH_SPI_BYTES (contents are overwritten).
+
+uint16_t len;
+uint8_t * p;
+
+waitTX();
+
+TCCR1A=0;
+TCCR1B=(1<<CS10);   // clk/1
+
+setBank(0);
+setReadPointer(ETXST,FALSE);
+TCNT1=0;
+ETH_ACTIVATE ;
+SPIN_SPI(0x3A);
+for (len=BENCH_SPI_BYTES,p=scratch;len;len--) {
+  SPIN_SPI(0);
+  *(p++)=SPDR;
+}
+ETH_DEACTIVATE ;
+results[0]=TCNT1;
+
+setReadPointer(ETXST,FALSE);
+TCNT1=0;
+readBufferMemoryArray(BENCH_SPI_BYTES,scratch);
+results[1]=TCNT1;
+
+writeEthRegister(0x02,ETXST&0xFF);  
+writeEthRegister(0x03,ETXST>>8);    
+TCNT1=0;
+ETH_ACTIVATE ;
+SPIN_SPI(0x7A);
+for (len=BENCH_SPI_BYTES,p=scratch;len;len--) { SPIN_SPI(*(p++)); }
+ETH_DEACTIVATE ;
+results[2]=TCNT1;
+
+writeEthRegister(0x02,ETXST&0xFF);  
+writeEthRegister(0x03,ETXST>>8);    
+TCNT1=0;
+writeBufferMemoryArray(BENCH_SPI_BYTES,scratch);
+results[3]=TCNT1;
+
+TCCR1B=0;
+}
+// ---------------------------------------------------------------------------
+void linkBenchmarkTX(uint8_t * scratch,uint16_t * results)
+{ // TIMER1 counts (clk/64) to send BENCH_TX_FRAMES full size frames, as a long
+  // HTTP response would, written in BENCH_SPI_BYTES blocks as the callback path
+  // does.  [0] waits for each frame to go before writing the next (the single
+  // buffer behaviour), [1] writes the next while the last is on the wire.
+  // Frames are broadcast with the IEEE local experimental Ethertype, so are
+  // harmless, from 'scratch' (BENCH_SPI_BYTES) whose first 14 bytes are set.
+
+#define BENCH_TX_LENGTH (ETH_HEADER_SIZE+1500)
+
+MergedPacket * mp=(MergedPacket *)scratch;
+memset(&mp->Ethernet.destinationMAC,0xFF,sizeof(MAC_address));  // Broadcast
+copyMAC(&mp->Ethernet.sourceMAC,&myMAC);
+mp->Ethernet.type=BYTESWAP16(0x88B5);  // IEEE 802 local experimental
+
+TCCR1A=0;
+TCCR1B=(1<<CS11)|(1<<CS10);   // clk/64
+
+for (uint8_t pass=0;pass<2;pass++) {
+  waitTX();
+  TCNT1=0;
+  for (uint8_t f=0;f<BENCH_TX_FRAMES;f++) {
+    if (!pass) waitTX();
+    prepareTX(BENCH_TX_LENGTH);
+    for (uint16_t i=0;i<BENCH_TX_LENGTH;i+=BENCH_SPI_BYTES) {
+      uint16_t blen=BENCH_TX_LENGTH-i;
+      if (blen>BENCH_SPI_BYTES) blen=BENCH_SPI_BYTES;
+      writeBufferMemoryArray(blen,scratch);
+    }
+    launchTX();
+  }
+  waitTX();
+  results[pass]=TCNT1;
+}
+
+TCCR1B=0;
+}
+#endif
 #endif
 // ---------------------------------------------------------------------------
 
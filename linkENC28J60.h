@@ -8,21 +8,53 @@
 #define LINKENC28J60_H
 
 #define ENC28J60_PREAMBLE (6)  // 6 bytes
+#define RX_FRAME_OVERHEAD (ENC28J60_PREAMBLE+4+1) // A frame in the RX ring : preamble, 
+                                                  // CRC, padding to even
 
 // Optimisations
 
 #define MAX_TX_PACKET  (1518) // Ethernet maximum.  Keep even - or see below.
 #define MAX_RX_PACKET  (1518) // Ethernet maximum
+#define TX_SLOTS       (2)    // TX frames in ENC28J60 memory : next is written while 
+                              // last is sent.  Each costs the RX ring 1526 bytes.
+                              // All but one may be parked awaiting ARP (network.c).
+#define TX_HELD   (TX_SLOTS)  // Slot numbers linkPacketHold() may give
+
+#ifdef USE_TCP
+#define KEEP_SPACE     (1536) // ENC28J60 memory for TCP segments awaiting their ACK
+                              // (linkKeepSent()), taken from the RX ring.  Even.
+#define KEEP_SLOTS     (8)    // Segments kept there at most
+#else
+#define KEEP_SPACE     (0)
+#endif
+#ifndef STORE_SPACE
+#define STORE_SPACE    (0)    // ENC28J60 memory an application keeps data in 
+#endif                        // (linkStoreWrite()), taken from the RX ring.  Even.
+
+//#define ENC_DMA_CSUM         // Checksum in-chip packet data with the ENC28J60 DMA.
+                               // Holds off reception (backpressure) while it runs.
+#define DMA_CSUM_MIN   (64)    // Fewer bytes than this are quicker over SPI
+#define DMA_CSUM_PATIENCE (1000) // Polls (~5us) waiting for RX to go idle
+
+#define ETH_POLL_BACKSTOP (1024) // With ETH_INTERRUPT : idle calls between 
+                                 // safety polls (errata 6 : PKTIF unreliable)
+
+#define BENCH_SPI_BYTES (MAX_STORED_SIZE) // REGRESS : bytes moved per SPI benchmark
+#define BENCH_TX_FRAMES (8)      // REGRESS : full size frames per TX benchmark
 
 // No routine need to alter below.  Also alter only with care.
 // RX start (ERXST) is ideally zero.
 // ERXND should be odd - only for convenience to ensure Errata 14 is sustained.
-// ETXST= (0x1FFF - (even+7)) and ERXND = ETXST-1 ensures this.
+// ETXST= (0x2000 - slots*even), KEEPST=ETXST-even, STOREST=KEEPST-even and 
+// ERXND = STOREST-1 ensures this.
 
 #define ERXST (0x00)   // RX Start is always zero (see errata)
-#define ETXST (0x1FFF - (MAX_TX_PACKET + 7))    
-// TX Start.  7 bytes spare for status (p33 datasheet)
-#define ERXND (ETXST - 1)  // RX End (inclusive in FIFO buffer, datasheet 3.2.1)
+#define TX_SLOT_SIZE (MAX_TX_PACKET + 8)  
+// Control byte, frame and 7 bytes spare for status (p33 datasheet)
+#define ETXST (0x2000 - TX_SLOTS*TX_SLOT_SIZE)  // TX Start (of first slot)   
+#define KEEPST (ETXST - KEEP_SPACE)  // Kept TCP segments, each as a TX slot's content
+#define STOREST (KEEPST - STORE_SPACE)  // An application's own data (linkStoreWrite())
+#define ERXND (STOREST - 1)  // RX End (inclusive in FIFO buffer, datasheet 3.2.1)
 
 #define RX_OK  (1<<7)
 
@@ -32,14 +64,26 @@
 #define ETH_ECON2 (0x1E)
 #define ETH_ECON1 (0x1F)
 
+#define EIE_RXERIE   (1<<0)
+#define EIE_TXERIE   (1<<1)
+#define EIE_PKTIE    (1<<6)
+#define EIE_INTIE    (1<<7)
+
+#define EIR_RXERIF   (1<<0)
 #define EIR_TXERIF   (1<<1)
 #define ECON1_RXEN   (1<<2)
 #define ECON1_TXRTS  (1<<3)
+#define ECON1_CSUMEN (1<<4)
+#define ECON1_DMAST  (1<<5)
 #define ECON1_TXRST  (1<<7)
 
 #define ECON2_PKTDEC   (1<<6)
 #define ECON2_AUTOINC  (1<<7)
 
+#define ESTAT_RXBUSY   (1<<2)
+
+#define EFLOCON_BACKPRESSURE (0x01) // Half-duplex flow control on
+
 #define ERXFCON_BCEN  (1<<0) // Broadcast enable
 #define ERXFCON_MCEN  (1<<1) // Multicast enable
 #define ERXFCON_HTEN  (1<<2) // Hash table filter enable
@@ -61,6 +105,11 @@ void setClockout8pt33MHz(void);
 void setClockout6pt25MHz(void);
 void setClockout3pt125MHz(void);
 
+#ifdef REGRESS
+void linkBenchmarkSPI(uint8_t * scratch,uint16_t * results);
+void linkBenchmarkTX(uint8_t * scratch,uint16_t * results);
+#endif
+
 #endif
 
 
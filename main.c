@@ -93,6 +93,9 @@ Copyright (C) 2009-20  S Combes
 #include "init.h"
 #include "w25q.h"
 #include "mem23SRAM.h"
+#ifdef USE_FRAGMENTS
+#include "fragment.h"
+#endif
 
 // For combined hex file see
 // https://www.kanda.com/blog/microcontrollers/avr-microcontrollers/atmel-studio-elf-production-files-avr/
@@ -196,6 +199,9 @@ uint32_t protect_time, time_set;  // Protect time allows clock when idle
 IP4_address myIP; 
 
 uint16_t lfsr=0xACE1u;  // Actually want random init, get later from clock
+#ifdef REGRESS
+uint16_t checksumCycles[CSUM_BENCH_RESULTS];  // Kept : look here from a simulator
+#endif
 #ifdef WHEREABOUTS
 uint8_t minute,hour;
 //uint8_t hstate=HAND_STOP,mstate=HAND_STOP;  // State for hour and minute hands
@@ -220,7 +226,11 @@ ISR(TIMER0_OVF_vect)
    //Increment our variable
    timecount++;
 
-   if(timecount>=205) {    // Tick over 1s
+#ifdef USE_TCP
+   tickTCP();  // Every tick : the clock for TCP's retransmission timers
+#endif
+
+   if(timecount>=TIMER_TICKS) {    // Tick over 1s
       timecount=0;
       time_now++;
 	  
@@ -254,6 +264,9 @@ ISR(TIMER0_OVF_vect)
       // protect_time allows message to be shown, then drop back to clock.
 
       refreshMACList();
+#ifdef USE_FRAGMENTS
+      fragmentTick();
+#endif
 
 //      Display_Time(time_now);
 
@@ -277,9 +290,6 @@ free(timereport);
 }
 */
 
-#ifdef USE_TCP
-      countdownTCP();  // Called 1 per sec.  Will determine whether retx ready.
-#endif
    }
 }
 #endif
@@ -371,6 +381,8 @@ InitEEPROM();
 #endif
 
 initLFSR(); // Random based on elapsed time
+
+bindCoreUDP();  // UDP services of config.h.  Applications bind theirs in Init...()
 	
 #ifdef USE_TCP
 initialiseTCP();
@@ -409,6 +421,10 @@ asm("WDR");  // watchdog as retx could take time
 
 handlePacket();
 
+#ifdef USE_TCP
+pumpTCP();  // Queued data the ACKs just received make room for
+#endif
+
 #ifdef MSF_CLOCK  
     if (PINB & (1<<0)) LEDON;
     else LEDOFF;
@@ -504,6 +520,18 @@ if (!(iCount%2000))  // Only check occasionally
 #ifdef USE_MD5
       //MDTestSuite();
 #endif      
+#if defined(REGRESS) && defined(USE_ENC28J60)
+      { uint16_t spiCycles[4];
+        linkBenchmarkSPI(MashE.bytes,spiCycles);
+        genericUDPBcast(spiCycles,4);
+        linkBenchmarkTX(MashE.bytes,spiCycles);
+        genericUDPBcast(spiCycles,2);
+      }
+#endif
+#ifdef REGRESS
+      checksumBenchmark((uint8_t *)RAMSTART,checksumCycles);  // Any RAM will do
+      genericUDPBcast(checksumCycles,CSUM_BENCH_RESULTS);
+#endif
       
       begun=TRUE;
     }
@@ -43,9 +43,17 @@ SRAM than strcpy to buffer                     */
 #include "stepper.h" 
 #include "link.h"
 #include "lfsr.h"
+#ifdef ARP_SPILL
+#include "mem23SRAM.h"
+#endif
 
 static void learnMAC(IP4_address IP,MAC_address MAC);
 static int8_t knownMAC(const IP4_address * target);
+static void requestMAC(const IP4_address * IP,const MAC_address * MAC);
+#ifdef ARP_SPILL
+static void spillMAC(uint8_t i);
+static int8_t unspillMAC(const IP4_address * IP);
+#endif
 static uint8_t MAC_match(const MAC_address * MAC1, const MAC_address * MAC2);
 
 extern MAC_address BroadcastMAC,myMAC;
@@ -53,22 +61,51 @@ extern IP4_address NullIP,BroadcastIP,myIP,GWIP,DNSIP,NTPIP,subnetMask,subnetBro
 extern char buffer[MSG_LENGTH]; // messages
 extern MergedPacket MashE;  // This is the ephemeral Mash.  Used for input, UDP and initial TCP
 extern Status MyState;
+#ifdef ARP_SPILL
+extern uint32_t time_now;
+#endif
 
-uint8_t known_IP_addresses=0;
 const IP4_address mDNS_IP4 =MAKEIP4(0xE0,0,0,0xFB); 
 const IP4_address LLMNR_IP4=MAKEIP4(0xE0,0,0,0xFC); 
 uint16_t IP4_ID;     // IP4 Packet ID
-uint16_t UDP_Port[MAX_UDP_PORTS];
 uint16_t UDP_low_port;
 uint8_t DHCP_lease[4];
 volatile uint8_t timecount;
-TCP_TCB TCB[MAX_TCP_ROLES];  // One for client, one for server
+TCP_TCB TCB[MAX_TCP_ROLES];  // One for client, then the server pool
+
+// ARP cache : open addressed, hashed on the IP (see storeMAC(), knownMAC())
+#define ARP_HASH(IP) ((OCTET4(IP)^OCTET3(IP)^OCTET2(IP))&(MAX_ARP_HELD-1))
+#define ARP_USED  (1<<0)  // Looked up since learnt : worth refreshing
+#define ARP_ASKED (1<<1)  // Refresh (unicast ARP) sent
 
 struct ARP_store {
 	IP4_address knownIP[MAX_ARP_HELD];
 	MAC_address knownMAC[MAX_ARP_HELD];
-	int8_t ticks[MAX_ARP_HELD];
+	volatile uint8_t ticks[MAX_ARP_HELD];  // Left to live.  0 is a free entry
+	uint8_t flags[MAX_ARP_HELD];
 } ARP_held;
+static volatile uint8_t ARP_refreshDue;   // Something for serviceARP() to refresh
+
+#ifdef ARP_SPILL
+#define SPILL_HASH(IP) ((OCTET4(IP)|((uint16_t)OCTET3(IP)<<8))&(ARP_SPILL_SIZE-1))
+typedef struct {  // An entry evicted from ARP_held, as kept in the 23LC1024
+	IP4_address IP;
+	MAC_address MAC;
+	uint8_t ticks;   // Left to live
+	uint32_t at;     // time_now when spilt
+} ARP_spilt;
+#endif
+#ifdef STATS
+uint16_t ARP_hits,ARP_misses;  // resolveMAC() lookups of next hop (misses run ARP)
+uint16_t ARP_refreshes;        // Unicast ARPs sent to keep used MACs fresh
+uint16_t ARP_spillHits;        // Misses recovered from the 23LC1024 (ARP_SPILL)
+#endif
+
+struct ARP_park {  // Frames held in the link layer until ARP finds their next hop
+	IP4_address nextHop[TX_HELD];
+	volatile uint8_t ticks[TX_HELD];  // Left to wait, counted down by refreshMACList()
+	uint8_t asked[TX_HELD];           // ticks when last asked.  0 is a free slot
+} ARP_parked;
 
 // ----------------------------------------------------------------------------
 void copyIP4(IP4_address * IPTo, const IP4_address * IPFrom)
@@ -118,24 +155,65 @@ uint8_t LLMNR_MAC(const MAC_address * MAC)
 // ----------------------------------------------------------------------------------
 
 /*static*/ void refreshMACList(void)
-{ // Called every tick to decrement tics and throw away expired addresses
+{ // Called every tick to decrement tics, so expiring addresses (at 0).  Flags
+  // those in use that are near expiry, to be asked after by serviceARP().
+  // Also counts down parked frames : but from an interrupt, so no SPI here.
 
-uint8_t i,j;
+uint8_t i;
 
-for (i=0;i<known_IP_addresses;i++)
-{
-  if (!(ARP_held.ticks[i]--)) // time expired at 0
-  {
-    known_IP_addresses--;  // drop it and shuffle list down
-    for (j=i;j<known_IP_addresses;j++)
-	{
-	  ARP_held.knownIP[j]=ARP_held.knownIP[j+1];
-	  ARP_held.knownMAC[j]=ARP_held.knownMAC[j+1];
-	  ARP_held.ticks[j]=ARP_held.ticks[j+1];
-} } }
+for (i=0;i<TX_HELD;i++) 
+  if (ARP_parked.asked[i] && ARP_parked.ticks[i]) ARP_parked.ticks[i]--;
+
+for (i=0;i<MAX_ARP_HELD;i++) 
+  if (ARP_held.ticks[i] && (--ARP_held.ticks[i])==TICKS_TO_REFRESH && 
+      (ARP_held.flags[i]&ARP_USED)) ARP_refreshDue=TRUE;
 return;
 }
 // ----------------------------------------------------------------------------
+static void serviceARP(void)
+{ // Asks again for the MACs parked frames wait on, once a tick, and drops any
+  // that have waited too long.  Re-ARPs (unicast) MACs in use before they expire,
+  // so the gateway (say) never misses on the way out.
+
+uint8_t i;
+
+for (i=0;i<TX_HELD;i++) {
+  if (!ARP_parked.asked[i] || ARP_parked.asked[i]==ARP_parked.ticks[i]) continue;
+  if (ARP_parked.ticks[i]) {
+    ARP_parked.asked[i]=ARP_parked.ticks[i];
+    requestMAC(&ARP_parked.nextHop[i],&BroadcastMAC);
+  } else {
+    ARP_parked.asked[i]=0;
+    linkHeldDrop(i);  // Given up
+  }
+}
+
+if (!ARP_refreshDue) return;
+ARP_refreshDue=FALSE;
+
+for (i=0;i<MAX_ARP_HELD;i++) 
+  if (ARP_held.ticks[i] && ARP_held.ticks[i]<=TICKS_TO_REFRESH &&
+      (ARP_held.flags[i]&(ARP_USED|ARP_ASKED))==ARP_USED) {
+    ARP_held.flags[i]|=ARP_ASKED;  // Once : if no answer, it expires as usual
+    requestMAC(&ARP_held.knownIP[i],&ARP_held.knownMAC[i]);
+#ifdef STATS
+    ARP_refreshes++;
+#endif
+  }
+}
+// ----------------------------------------------------------------------------
+static void releaseParked(const IP4_address * IP,const MAC_address * MAC)
+{ // A MAC has been learnt : send whatever was waiting on it
+
+uint8_t i;
+
+for (i=0;i<TX_HELD;i++) 
+  if (ARP_parked.asked[i] && IP4_match(IP,&ARP_parked.nextHop[i])) {
+    ARP_parked.asked[i]=0;
+    linkHeldSend(i,MAC);
+  }
+}
+// ----------------------------------------------------------------------------
 void IP4_Endianism(MergedPacket * Mash)
 { // Converts an IP4 packet to network byte order or vice-versa
 Mash->IP4.totalLength=BYTESWAP16(Mash->IP4.totalLength);
@@ -150,47 +228,142 @@ void Error(void)  { // Print message and hang
   while (1) {};
 }
 // ----------------------------------------------------------------------------
+static int8_t storeMAC(const IP4_address * IP,const MAC_address * MAC,uint8_t ticks)
+{ // Adds a MAC-IP pair to the cache, to expire after ticks.  Goes in the first free
+  // entry of the ARP_PROBE from its hash, else replaces the staleist of those.
+
+uint8_t h=ARP_HASH(*IP),i,j=h,n,staleist=0xFF;
+
+for (n=0;n<ARP_PROBE;n++) {
+  i=(h+n)&(MAX_ARP_HELD-1);
+  if (!ARP_held.ticks[i]) { j=i; break; }
+  if (ARP_held.ticks[i]<staleist) staleist=ARP_held.ticks[j=i];
+}
+#ifdef ARP_SPILL
+if (ARP_held.ticks[j]) spillMAC(j);  // Evicting a live one : keep it outside
+#endif
+copyIP4(&ARP_held.knownIP[j],IP);
+copyMAC(&ARP_held.knownMAC[j],MAC);
+ARP_held.flags[j]=0;
+ARP_held.ticks[j]=ticks;
+return (j);
+}
+// ----------------------------------------------------------------------------
 static void learnMAC(const IP4_address IP, const MAC_address MAC)
 { // Stores MAC-IP pairs and an expiry time for each
-int8_t i,j,staleist;
+int8_t i;
 
 i=knownMAC(&IP);
 
-if (i>MAX_ARP_HELD)
-{
-  sprintf(buffer,"i out %d",i);
-  Error();
-}
-
 if (i<(-1)) return; // Don't 'learn' a broadcast
 
 if (i>-1) // We already have it - reset counter as it's fresh
 {
+  copyMAC(&ARP_held.knownMAC[i],&MAC);  // Which may have changed
+  ARP_held.flags[i]=0;                   // Must be used again to be refreshed
   ARP_held.ticks[i]=TICKS_TO_HOLD_MAC; 
   return;
 }
-// Add new
-if (known_IP_addresses >= MAX_ARP_HELD)  // >= just in case
-{  // We're maxed out - replace the staleist
-  staleist=TICKS_TO_HOLD_MAC+1;
-  j=0;
-  for (i=0;i<known_IP_addresses;i++)
-  {
-    if (ARP_held.ticks[i]<staleist) staleist=ARP_held.ticks[j=i];
-  }
-  ARP_held.ticks[j]=TICKS_TO_HOLD_MAC;
-  copyIP4(&ARP_held.knownIP[j],&IP);
-  copyMAC(&ARP_held.knownMAC[j],&MAC);
+storeMAC(&IP,&MAC,TICKS_TO_HOLD_MAC);  // Add new
+return;
 }
-else  // Free to add it to end
-{
-  ARP_held.ticks[known_IP_addresses]=TICKS_TO_HOLD_MAC;
-  copyIP4(&ARP_held.knownIP[known_IP_addresses],&IP);
-  copyMAC(&ARP_held.knownMAC[known_IP_addresses],&MAC);
-  known_IP_addresses++;
+#ifdef ARP_SPILL
+// ----------------------------------------------------------------------------
+static void spillMAC(uint8_t i)
+{ // Writes cache entry i to the 23LC1024, from where unspillMAC() may recover it 
+
+ARP_spilt s;
+
+copyIP4(&s.IP,&ARP_held.knownIP[i]);
+copyMAC(&s.MAC,&ARP_held.knownMAC[i]);
+s.ticks=ARP_held.ticks[i];
+s.at=time_now;
+
+memWriteBufferMemoryArray(ARP_SPILL_BASE+(uint32_t)SPILL_HASH(s.IP)*sizeof(ARP_spilt),
+                          sizeof(ARP_spilt),(uint8_t *)&s);
 }
-return;
+// ----------------------------------------------------------------------------
+static int8_t unspillMAC(const IP4_address * IP)
+{ // A cache miss : was it spilt, and is it still in date?  If so, back into the
+  // cache (with whatever life it had left) and that index returned, else -1.
+
+ARP_spilt s;
+uint32_t age;
+
+memReadBufferMemoryArray(ARP_SPILL_BASE+(uint32_t)SPILL_HASH(*IP)*sizeof(ARP_spilt),
+                         sizeof(ARP_spilt),(uint8_t *)&s);
+age=time_now-s.at;
+
+if (!IP4_match(IP,&s.IP) || age>=s.ticks) return (-1);
+#ifdef STATS
+ARP_spillHits++;
+#endif
+return (storeMAC(&s.IP,&s.MAC,s.ticks-age));
+}
+#endif
+// ----------------------------------------------------------------------------
+#ifdef REGRESS
+volatile uint32_t checksumSink;
+#endif
+#if !defined(CSUM_ASM) || !defined(__AVR__) || defined(REGRESS)
+static uint32_t checksumAddC(uint32_t sum,uint16_t * words,int16_t length)
+{ // Portable checksum kernel : words into a 32 bit sum, carries folded by the
+  // caller.  Length is number of 16-bit words.
+
+for (;length>0;length--) sum+=*(words++);
+
+return (sum);
 }
+#endif
+#if defined(CSUM_ASM) && defined(__AVR__)
+// ----------------------------------------------------------------------------
+static uint32_t checksumAdd(uint32_t sum,uint16_t * words,int16_t length)
+{ // As checksumAddC(), hand scheduled (config.h : CSUM_ASM; REGRESS checks the
+  // two agree).  Four words a pass in one add-with-carry
+  // chain : the carry out of each word goes into the low byte of the next (end
+  // around carry, so the same sum once folded) and only the carry left at the
+  // end of a pass goes to the top 16 bits.  30 cycles per 8 bytes.
+
+uint16_t passes;
+uint8_t t0,t1;
+
+if (length<=0) return (sum);
+
+passes=length/4;
+if (passes) __asm__ volatile (
+  "1:                      \n\t"
+  "ld   %[t0],%a[p]+       \n\t"
+  "ld   %[t1],%a[p]+       \n\t"
+  "add  %A[s],%[t0]        \n\t"
+  "adc  %B[s],%[t1]        \n\t"
+  "ld   %[t0],%a[p]+       \n\t"
+  "ld   %[t1],%a[p]+       \n\t"
+  "adc  %A[s],%[t0]        \n\t"
+  "adc  %B[s],%[t1]        \n\t"
+  "ld   %[t0],%a[p]+       \n\t"
+  "ld   %[t1],%a[p]+       \n\t"
+  "adc  %A[s],%[t0]        \n\t"
+  "adc  %B[s],%[t1]        \n\t"
+  "ld   %[t0],%a[p]+       \n\t"
+  "ld   %[t1],%a[p]+       \n\t"
+  "adc  %A[s],%[t0]        \n\t"
+  "adc  %B[s],%[t1]        \n\t"
+  "adc  %C[s],__zero_reg__ \n\t"
+  "adc  %D[s],__zero_reg__ \n\t"
+  "sbiw %[n],1             \n\t"
+  "brne 1b                 \n\t"
+  : [s] "+r" (sum), [p] "+e" (words), [n] "+w" (passes), 
+    [t0] "=&r" (t0), [t1] "=&r" (t1)
+  :
+  : "memory");
+
+for (length&=3;length;length--) sum+=*(words++);  // 0-3 left
+
+return (sum);
+}
+#else
+#define checksumAdd checksumAddC  // The compiler does well enough
+#endif
 // ----------------------------------------------------------------------------
 uint16_t checksum(uint16_t * words, int16_t length)
 { // Standard checksum routine (16 bit 1s complement of ones complement sum
@@ -209,9 +382,7 @@ void checksumBare(uint32_t * scratch,uint16_t * words, int16_t length)
 //   Length is number of 16-bit words and words is a pointer to the words.
 //   Scratch is sum so far
 
-for (;length>0;length--) {
- *scratch+=(*(words++));
-}
+*scratch=checksumAdd(*scratch,words,length);
 
 return;  
 }
@@ -222,11 +393,8 @@ uint32_t checksumSupport(uint16_t * words, int16_t length)
 //   Length is number of 16-bit words and words is a pointer to the words.
 uint32_t scratch, carry;
 
-scratch=0x00;
+scratch=checksumAdd(0,words,length);
 
-for (;length>0;length--){
- scratch+=(*(words++));
-}
 carry  =(scratch&0xFFFF0000)>>16;
 scratch=(scratch&0x0000FFFF)+carry; 
 scratch+=(scratch>>16);   // Could have regenerated a carry by the last add
@@ -235,6 +403,90 @@ scratch+=(scratch>>16);   // Could have regenerated a carry by the last add
 return (scratch);  
 }
 // ----------------------------------------------------------------------------
+uint16_t checksumAdjust(uint16_t csum,const uint16_t * old,const uint16_t * new,
+                        int16_t length)
+{ // Incremental update (RFC 1624 eqn. 3) : HC' = ~(~HC + ~m + m'), for 'length'
+//   16-bit words of a checksummed header changed from 'old' to 'new'.  Cheaper 
+//   than summing it all again when a few fields are rewritten.  Words as they 
+//   lie in the packet (endian independent, as checksum()).  Words merely moved
+//   about (e.g. swapped source and destination addresses) need no adjustment.
+uint32_t sum=(uint16_t)~csum;
+
+for (;length>0;length--) sum+=(uint16_t)~*(old++)+(uint32_t)*(new++);
+
+sum=(sum&0xFFFF)+(sum>>16);
+sum+=(sum>>16);
+
+return ((uint16_t)~sum);
+}
+#ifdef REGRESS
+// ----------------------------------------------------------------------------
+static uint16_t checksumFold(uint32_t sum)
+{ // A sum from either kernel as 16 bits, 0xFFFF (1s complement -0) as 0 : 
+  // equal for the same words, however the carries went
+sum=(sum&0xFFFF)+(sum>>16);
+sum+=(sum>>16);
+return (((uint16_t)sum==0xFFFF)?0:(uint16_t)sum);
+}
+// ----------------------------------------------------------------------------
+static uint16_t checksumCheck(uint8_t * data)
+{ // How often the kernel in use and the portable C disagree : over 'data' from
+  // an even and an odd address, and over words of 0xFFFF, alone and with 
+  // 0x0001 between (carries ripple all the way), each for every length up to
+  // CSUM_CHECK_WORDS (odd, so 0-3 words are left after the passes of 4), from 
+  // a sum of 0 and one with carries of its own.
+
+static const uint32_t starts[]={0,0x0003FFFF};
+uint16_t edge[CSUM_CHECK_WORDS],bad=0;
+uint16_t * from[3]={(uint16_t *)data,(uint16_t *)(data+1),edge};
+uint8_t i,k,n,s;
+
+for (k=0;k<2;k++) {  
+  for (i=0;i<CSUM_CHECK_WORDS;i++) edge[i]=(k && (i&1))?0x0001:0xFFFF;
+  for (i=k?2:0;i<3;i++)  // 'data' only once
+    for (n=0;n<=CSUM_CHECK_WORDS;n++)
+      for (s=0;s<sizeof(starts)/sizeof(starts[0]);s++)
+        if (checksumFold(checksumAdd(starts[s],from[i],n))!=
+            checksumFold(checksumAddC(starts[s],from[i],n))) bad++;
+}
+return (bad);
+}
+// ----------------------------------------------------------------------------
+void checksumBenchmark(uint8_t * data,uint16_t * results)
+{ // Cycle counts (TIMER1 at clk/1, least of CSUM_BENCH_RUNS) for the checksum
+  // kernel over each of CSUM_BENCH_SIZES bytes from 'data' (contents don't 
+  // matter).  Results are [2i] the kernel in use, [2i+1] the portable C; cycles
+  // per byte is then results/size.  On the host, TIMER1 counts host cycles.
+  // The last is how often the two sums disagree (checksumCheck()) : should be 0.
+
+static const uint16_t sizes[]={CSUM_BENCH_SIZES};
+uint32_t sum=0;
+uint16_t t;
+
+TCCR1A=0;
+TCCR1B=(1<<CS10);   // clk/1
+
+for (uint8_t i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++) {
+  results[2*i]=results[2*i+1]=0xFFFF;
+  for (uint8_t run=0;run<CSUM_BENCH_RUNS;run++) {
+    TCNT1=0;
+    sum=checksumAdd(sum,(uint16_t *)data,sizes[i]/2);
+    t=TCNT1;
+    if (t<results[2*i]) results[2*i]=t;
+
+    TCNT1=0;
+    sum=checksumAddC(sum,(uint16_t *)data,sizes[i]/2);
+    t=TCNT1;
+    if (t<results[2*i+1]) results[2*i+1]=t;
+  }
+}
+TCCR1B=0;
+
+checksumSink=sum;  // So the sums aren't optimised away
+results[CSUM_BENCH_RESULTS-1]=checksumCheck(data);
+}
+#endif
+// ----------------------------------------------------------------------------
 uint16_t IP4checksum(MergedPacket * Mash) { 
 // Calculates checksum of IP4
 // NB. No Byteswap on header length because is 8 bit value
@@ -287,8 +539,8 @@ void ARP_Endianism(MergedARP * Mish)
 // ----------------------------------------------------------------------------
 void handleARP(MergedARP * Mish)
 { // We have heard an ARP.  From it we learn a MAC & IP pair.  If it was request 
-// for us, we reply.  It won't be a reply to a serious request from us (except one we 
-// have given up on) as that is handled in ResolveMAC().  It may be a reply to a
+// for us, we reply.  Replies come here from the link layer (which answers requests
+// itself) : they release frames parked waiting on them.  It may be a reply to a
 // forlorn request from us (i.e. checking that a IP is not used)
 
 uint8_t IPforus;
@@ -319,6 +571,7 @@ if (Mish->ARP.type == ARP_REQUEST)  // respond to unicasts and broadcasts (but t
 else if (Mish->ARP.type==ARP_REPLY) 
 {
   learnMAC(Mish->ARP.sourceIP,Mish->ARP.sourceMAC); // Even if it was a response we didn't ask for 
+  releaseParked(&Mish->ARP.sourceIP,&Mish->ARP.sourceMAC);
 #ifdef USE_APIPA  
   if (MyState.IP==APIPA_TRY) { // Is this a response to our test?
     if (IP4_match(&Mish->ARP.sourceIP,&myIP)) { // Someone already using my proposed IP
@@ -345,6 +598,8 @@ uint8_t IPforus,MACforus;
 
 NeedIP=(MyState.IP!=IP_SET);  // IP address as yet unset
 
+serviceARP();
+
 uint8_t flags;
 ilength=linkPacketHeader(MAX_STORED_SIZE,&MashE.bytes[0],&flags); 
 
@@ -397,100 +652,104 @@ return (0);   // Ignore other protocols
 
 static int8_t knownMAC(const IP4_address * target)
 {  // We have a target IP.  Do we already know the MAC?
-// -1 is a failure; -2 is Null; -3 is broadcast
+// -1 is a failure; -2 is Null; -3 is broadcast.  Only looks at the ARP_PROBE
+// entries from the hash : where storeMAC() would put it.
 
-uint8_t i;
+uint8_t h,i,n;
 
 if (IP4_match(target,&NullIP)) return (-2);
 if (IP4_match(target,&BroadcastIP)) return (-3);
 
-for (i=0;i < known_IP_addresses;i++) 
-  if (IP4_match(target,&ARP_held.knownIP[i])) return (i);
-
+h=ARP_HASH(*target);
+for (n=0;n<ARP_PROBE;n++) {
+  i=(h+n)&(MAX_ARP_HELD-1);
+  if (ARP_held.ticks[i] && IP4_match(target,&ARP_held.knownIP[i])) return (i);
+}
 return (-1);
 }
 // ----------------------------------------------------------------------------
 
-MAC_address resolveMAC(IP4_address * target)
-{  // We have a target IP.  Do we already know the MAC or can we get it with ARP?
+static void requestMAC(const IP4_address * IP,const MAC_address * MAC)
+{ // Sends an ARP request for IP, to MAC : broadcast, or the one we have for a 
+  // refresh.  The reply is heard by handleARP().
+
+MergedARP Mish;
+
+Mish.ARP.type=ARP_REQUEST;
+copyMAC(&Mish.ARP.destinationMAC,MAC);
+copyIP4(&Mish.ARP.destinationIP,IP);
+Mish.ARP.hardware=DLLisETHERNET;  
+Mish.ARP.protocol=ARPforIP;  	
+Mish.ARP.hardware_size=6;  	// Length of MAC
+Mish.ARP.protocol_size=4;	// Length of IP V4
+copyMAC(&Mish.ARP.sourceMAC,&myMAC);
+copyIP4(&Mish.ARP.sourceIP,&myIP);
+ 
+launchARP(&Mish);
+}
+// ----------------------------------------------------------------------------
+
+static uint8_t resolveMAC(IP4_address * target,MAC_address * MAC,IP4_address * nextHop)
+{  // We have a target IP.  Do we already know the MAC?  TRUE if so, and MAC is set.
+// If not, nextHop is who to ARP for (target, or gateway if not local).  Doesn't 
+// wait : launchIP4() parks the frame and the reply releases it (handleARP()).
 // We always know our own IP by this point (have run DHCP/APIPA/STATIC)
-// Stay blocked in this routine (DISCARDING other packets) until we have an ARP answer
-// Discarding isn't polite, but probably necessary in space limited situation
 
 int i,local;
-uint16_t ilength;
-MergedARP Mish;
 
 local=(((*target) & subnetMask) == (myIP & subnetMask));
  
-while (1)
-{
-
 #ifdef USE_LLMNR
-MAC_address m;
-
 if (*target==LLMNR_IP4) {
-  m.MAC[0]=01;
-  m.MAC[1]=00;
-  m.MAC[2]=0x5E;
-  m.MAC[3]=0x00;
-  m.MAC[4]=0x00;
-  m.MAC[5]=0xFC;
-  return (m);  
+  MAC->MAC[0]=01;
+  MAC->MAC[1]=00;
+  MAC->MAC[2]=0x5E;
+  MAC->MAC[3]=0x00;
+  MAC->MAC[4]=0x00;
+  MAC->MAC[5]=0xFC;
+  return (TRUE);  
 }
 #endif
 
 #ifdef USE_mDNS
 if (*target==mDNS_IP4) {
-  m.MAC[0]=01;
-  m.MAC[1]=00;
-  m.MAC[2]=0x5E;
-  m.MAC[3]=0x00;
-  m.MAC[4]=0x00;
-  m.MAC[5]=0xFB;
-  return (m);  
+  MAC->MAC[0]=01;
+  MAC->MAC[1]=00;
+  MAC->MAC[2]=0x5E;
+  MAC->MAC[3]=0x00;
+  MAC->MAC[4]=0x00;
+  MAC->MAC[5]=0xFB;
+  return (TRUE);  
 }
 #endif
 
-  i=knownMAC(target);
+i=knownMAC(target);
   
 // Get the broadcasts out of the way
-  if (i==(-2)) return (BroadcastMAC);  // -2 codes for broadcast MAC // TODO NULL?
-
-  if (i==(-3)) return (BroadcastMAC);  // -3 codes for broadcast MAC
-
-  // Override with the Gateway IP if it's not a local address
-  if (!local) i=knownMAC(&GWIP);  
-     
-  if (i>=0) return (ARP_held.knownMAC[i]);  // Because 0 is valid array element, fail is -1
-
-// OK.  We don't know it, so we better run an ARP
-// Prepare message
-    Mish.ARP.type=ARP_REQUEST;
-    copyMAC(&Mish.ARP.destinationMAC,&BroadcastMAC);
-    copyIP4(&Mish.ARP.destinationIP,((local)?(target):(&GWIP)));
-    Mish.ARP.hardware=DLLisETHERNET;  
-    Mish.ARP.protocol=ARPforIP;  	
-    Mish.ARP.hardware_size=6;  	// Length of MAC
-    Mish.ARP.protocol_size=4;	// Length of IP V4
-    copyMAC(&Mish.ARP.sourceMAC,&myMAC);
-    copyIP4(&Mish.ARP.sourceIP,&myIP);
- 
-    launchARP(&Mish);
+if (i==(-2) || i==(-3)) { // -2 codes for Null, -3 for broadcast // TODO NULL?
+  copyMAC(MAC,&BroadcastMAC);
+  return (TRUE);
+}
 
-    Mish.Ethernet.type=ARPinETHERNET-1; // Set to anything but ARP, so test below works
-    // TODO Make sure DO works, since byteswap has changed this
-    uint8_t flags;
-    do {
-  	  ilength=linkPacketHeader((ETH_HEADER_SIZE+ARP_HEADER_SIZE),&(Mish.bytes[0]),&flags); 
-      // Will only return the first part of a packet, enough for ARP.  Rest discarded
-	
-      Mish.Ethernet.type=BYTESWAP16(Mish.Ethernet.type);  // Ethernet endianism
+// Override with the Gateway IP if it's not a local address
+copyIP4(nextHop,((local)?(target):(&GWIP)));
+if (!local) i=knownMAC(&GWIP);  
+#ifdef ARP_SPILL
+if (i<0) i=unspillMAC(nextHop);
+#endif
 
- 	  if (Mish.Ethernet.type==ARPinETHERNET)  handleARP(&Mish);
-      
-	} while ((Mish.Ethernet.type!=ARPinETHERNET));  // Block until an ARP heard
-  }  // and repeat the while (1) until we get a match
+if (i>=0) { // Because 0 is valid array element, fail is -1
+  ARP_held.flags[i]|=ARP_USED;  // Keep it fresh : see serviceARP()
+  copyMAC(MAC,&ARP_held.knownMAC[i]);
+#ifdef STATS
+  ARP_hits++;
+#endif
+  return (TRUE);
+}
+#ifdef STATS
+ARP_misses++;
+#endif
+return (FALSE);  // We don't know it : need to run an ARP
 }
 // ----------------------------------------------------------------------------
 
@@ -521,12 +780,15 @@ uint8_t launchIP4(MergedPacket * Mash,uint8_t csums,
            void (* callback)(uint16_t start,uint16_t length,uint8_t * result),
            uint16_t offset)
 { // Takes IP4 datagram, adds checksum and hardware address (MAC) and 
-  // sends it to Ethernet.  Resolves unknown IP/MACs (with ARP) 
+  // sends it to Ethernet.  Resolves unknown IP/MACs (with ARP) : until the 
+  // answer comes, the frame is parked in the link layer (or dropped if no room).
 
-MAC_address targetMAC;
+MAC_address targetMAC={.MAC={0}};  // Placeholder while parked
+IP4_address nextHop=0;
+uint8_t known,i;
 
 // Make sure we know target MAC address
-targetMAC=resolveMAC(&(Mash->IP4.destination));  // Will look up, or run ARP if unknown
+known=resolveMAC(&(Mash->IP4.destination),&targetMAC,&nextHop); 
 
 copyIP4(&Mash->IP4.source,&myIP); //  Always force this even if already set 
 
@@ -540,8 +802,38 @@ Mash->IP4.checksum=0x0000;  // 0 does not suffer from endianism
 Mash->IP4.checksum=IP4checksum(Mash);  // Always last job to set checksum
 
 #ifndef DEBUGGER
+#ifdef SEND_FRAGMENTS
+// Too big for a frame : UDP from a callback goes as fragments, once we have
+// the MAC (not parked : needs more than one TX slot).  Anything else, truncated.
+uint8_t fragment=(BYTESWAP16(Mash->IP4.totalLength)>IP4_MTU && 
+                  Mash->IP4.protocol==UDPinIP4 && callback);
+if (known && fragment) 
+  linkFragmentSend((uint8_t *)Mash,ETH_HEADER_SIZE+BYTESWAP16(Mash->IP4.totalLength),
+               callback,offset);
+else
+#endif
+if (known) 
   linkPacketSend((uint8_t *)Mash,ETH_HEADER_SIZE+BYTESWAP16(Mash->IP4.totalLength),
                csums,callback,offset);   // Put it on the wire 
+else {
+  for (i=0;i<TX_HELD;i++)   // Ask, unless already waiting on the same MAC
+    if (ARP_parked.asked[i] && IP4_match(&nextHop,&ARP_parked.nextHop[i])) break;
+  if (i==TX_HELD) requestMAC(&nextHop,&BroadcastMAC);
+#ifdef SEND_FRAGMENTS
+  if (fragment) {  // Sender tries again
+    IP4_Endianism(Mash);
+    return (0);
+  }
+#endif
+
+  i=linkPacketHold((uint8_t *)Mash,ETH_HEADER_SIZE+BYTESWAP16(Mash->IP4.totalLength),
+               csums,callback,offset);   // Put it aside 
+  if (i!=LINK_NOT_HELD) {
+    copyIP4(&ARP_parked.nextHop[i],&nextHop);
+    ARP_parked.ticks[i]=TICKS_TO_PARK;
+    ARP_parked.asked[i]=TICKS_TO_PARK;
+  }
+}
 #endif
 
 IP4_Endianism(Mash);
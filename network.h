@@ -116,12 +116,33 @@ Copyright (C) 2009-20  S Combes
 
 #define MAX_HEADER_SIZE        (ETH_HEADER_SIZE+ARP_HEADER_SIZE) // 42 based on Eth (14)+ARP(28); 
 #define IP_HEADER_SIZE         (20)  // Without options (handled separately)
+#define ICMP_HEADER_SIZE       (8)   // Type, code, checksum, id, sequence
+
+#define CSUM_BENCH_SIZES 20,64,576,1460 // REGRESS : bytes checksummed per benchmark
+#define CSUM_BENCH_RUNS  (4)             // REGRESS : best of
+#define CSUM_BENCH_RESULTS (9)           // REGRESS : 2 per size, then kernels' mismatches
+#define CSUM_CHECK_WORDS (37)            // REGRESS : longest checked, kernel against C
+
+#define IP4_MTU         (1500)   // Largest datagram in one Ethernet frame
+#define IP4_FRAGMENT_DATA ((IP4_MTU-IP_HEADER_SIZE)&0xFFF8) // Payload per fragment, 
+                                 // when we fragment (SEND_FRAGMENTS)
+#define IP4_MF          (0x2000) // Host order IP4 flags and fragment offset word
+#define IP4_OFFSET_MASK (0x1FFF)
+#define IP4_FRAGMENT(MP) ((MP)->words[(ETH_HEADER_SIZE+6)/2]) // That word, as received
 
 //#define MAX_PENDING_STACK      (10)
 
+#define TIMER_TICKS           (205) // TIMER0 overflows a second (main.c) : ~4.9ms each
 #define TICKS_TO_HOLD_MAC     (120) // Seconds-ish
+#define TICKS_TO_REFRESH      (10)  // Seconds-ish left when a MAC in use is re-ARPed
+#define TICKS_TO_PARK         (3)   // Seconds-ish a frame waits for ARP.  Asks each tick.
 
-#define MAX_ARP_HELD  (3)  // Unlikely to need many (and they replace one another if required)  
+#define MAX_ARP_HELD  (8)  // ARP cache entries, 12 bytes each.  Power of 2 : hashed on IP
+#define ARP_PROBE     (4)  // Entries looked at for an IP, from its hash (<=MAX_ARP_HELD)
+//#define ARP_SPILL        // NET_PROG only : entries evicted from the cache are kept 
+                           // in the 23LC1024, and looked for there on a miss
+#define ARP_SPILL_BASE (0x1F000) // 23LC1024 address of spilt entries (top 4kB)
+#define ARP_SPILL_SIZE (256)     // Entries there (15 bytes each).  Power of 2.
 
 typedef uint32_t IP4_address;
 
@@ -250,6 +271,11 @@ void delay_ms(uint16_t ms);
 uint16_t checksum(uint16_t * words, int16_t length);
 uint32_t checksumSupport(uint16_t * words, int16_t length);
 void checksumBare(uint32_t * scratch,uint16_t * words, int16_t length);
+uint16_t checksumAdjust(uint16_t csum,const uint16_t * old,const uint16_t * new,
+                        int16_t length);
+#ifdef REGRESS
+void checksumBenchmark(uint8_t * data,uint16_t * results);
+#endif
 uint16_t IP4checksum(MergedPacket * Mash);
 int8_t mDNS(IP4_address * IP);
 int8_t LLMNR(IP4_address * IP);
@@ -260,6 +286,7 @@ uint8_t handlePacket(void);
 uint8_t launchIP4(MergedPacket *,uint8_t csums,
         void (* callback)(uint16_t start,uint16_t length,uint8_t * result),uint16_t offset);
 void launchARP(MergedARP * Mish);
+void handleARP(MergedARP * Mish);
 void prepareIP4(MergedPacket * Mash, 
                 uint16_t payload_length, IP4_address * ToIP, uint8_t protocol); 
 
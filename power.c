@@ -29,6 +29,7 @@ Fuses: avrdude -p atmega328p -c STK500 -P COM4 -U lfuse:w:0xFF:m -U hfuse:w:0xd9
 #include <avr/interrupt.h>
 #include <stdlib.h>
 #include "network.h"
+#include "link.h"
 
 #include "power.h"
 
@@ -54,10 +55,39 @@ result |= ((uint16_t)ADCH) << 8;
 return (result);
 }
 
+#if CYCLE>MAX_TIME_SAMPLES
+#error "The average is taken over the first CYCLE samples of the capture"
+#endif
+// --------------------------------------------------------------------------------
+static uint16_t captured(uint16_t i)
+{ // Waveform sample i, back from the ENC28J60
+uint16_t sample;
+
+linkStoreRead(2*(1+i),(uint8_t *)&sample,2);
+return (BYTESWAP16(sample));
+}
+// --------------------------------------------------------------------------------
+static void captureData(uint16_t start,uint16_t length,uint8_t * result)
+{ // launchUDP() callback : the reply, a block at a time, from the ENC28J60 
+  // (linkStoreWrite()), so no copy of the capture is held in RAM.  Start is in
+  // bytes.
+linkStoreRead(start,result,length);
+}
+// --------------------------------------------------------------------------------
+void udpPower(MergedPacket * Mash,uint8_t flags)
+{ // Bound to POWER_MY_PORT.  Message format is "POWER n" here n is an ASCII 
+  // digit 0,1,2 etc : test it begins "POWE", then convert n to 0-2 by 
+  // subtracting ASCII "0"
+if (Mash->UDP_payload.words[0]==BYTESWAP16(0x504F) &&  // "PO"
+    Mash->UDP_payload.words[1]==BYTESWAP16(0x5745))    // "WE" 
+  handlePower((Mash->UDP_payload.bytes[6]-0x30));  
+}
 // --------------------------------------------------------------------------------
 void handlePower(uint8_t myADC)
 { // Handle a received Power message request to read a specific ADC
 // ADC ranges from 0 to 2.  0 is current; 1 is voltage; 2 is current/2
+// One sweep, in time order, into the ENC28J60 as the reply will be (STORE_SPACE) :
+// word 0 the current, then MAX_TIME_SAMPLES of waveform, big endian.
 
 uint16_t i,tmp;
 uint32_t total;
@@ -74,8 +104,9 @@ LEDON;
 
 for (i=0;i<(MAX_TIME_SAMPLES);i++)
 {
-  tmp=ReadADC(SafeADC); // to slow down
-  MashE.Power.waveform[i]=tmp;
+  tmp=ReadADC(SafeADC);
+  tmp=BYTESWAP16(tmp);
+  linkStoreWrite(2*(1+i),(uint8_t *)&tmp,2);  // The same few SPI bytes every sample
   tmp=ReadADC(SafeADC); // to slow down
   tmp=ReadADC(SafeADC); // to slow down
 }
@@ -84,24 +115,21 @@ LEDOFF;
 
 total=0;
 for (i=0;i<CYCLE;i++) // Across the 50Hz cycle, get average
-  total+=MashE.Power.waveform[i];
+  total+=captured(i);
 average=(int16_t)(0.5+((float)total)/(float)CYCLE); 
 
 total=0;
 for (i=0;i<CYCLE;i++) // Divergence from average proportional to current
-  total+=abs((int16_t)(MashE.Power.waveform[i])-average); // Safe:spectrum is 10 bit
+  total+=abs((int16_t)(captured(i))-average); // Safe:spectrum is 10 bit
 
 tmp=(uint16_t)(0.5+((float)total)/(float)CYCLE); // Average divergence
 
-MashE.Power.current=BYTESWAP16(tmp);
-
-#ifdef  LITTLEENDIAN // Although implicit in BYTESWAP, this is faster
-for (i=0;i<(MAX_TIME_SAMPLES);i++) // Test MashE.Power.waveform[i]=BYTESWAP16(i*60);
-  MashE.Power.waveform[i]=BYTESWAP16(MashE.Power.waveform[i]);
-#endif
+tmp=BYTESWAP16(tmp);
+linkStoreWrite(0,(uint8_t *)&tmp,2);
 
-//launchUDP(&MashE,&his_IP4,POWER_MY_PORT,MashE.UDP.sourcePort,sizeof(MashE.Power),NULL,0);  // Prob OK
-launchUDP(&MashE,&his_IP4,POWER_MY_PORT,MashE.UDP.sourcePort,2*(1+MAX_TIME_SAMPLES),NULL,0);
+// Data from the callback, so not limited by RAM or MashE; as fragments if over a frame.
+launchUDP(&MashE,&his_IP4,POWER_MY_PORT,MashE.UDP.sourcePort,2*(1+MAX_TIME_SAMPLES),
+          captureData,0);
 
 delay_ms(10);
 LEDOFF;
@@ -14,5 +14,6 @@ void InitialiseADC(void);
 uint16_t ReadADC(uint8_t channel);
 void InitPower();
 void handlePower(uint8_t myADC);
+void udpPower(MergedPacket * Mash,uint8_t flags);
 
 #endif
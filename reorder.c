@@ -0,0 +1,155 @@
+/********************************************
+ Out-of-order TCP segment holding, in the 23LC1024 SPI SRAM
+
+ handleMetrics() takes only the next bytes expected.  A segment from beyond a
+ gap (one lost, or overtaken) would otherwise be thrown away, and sent again 
+ after it.  Instead its payload is copied from the ENC28J60 to the SRAM, and
+ delivered to TCP_DataIn() once the gap fills.
+
+ Each connection (role) has REORDER_SIZE bytes of the SRAM, at
+ REORDER_SRAM_BASE+role*REORDER_SIZE, indexed by sequence number modulo its 
+ size : a byte is always at the same place, however it arrived.  What is held
+ is a list here, in RAM, of up to REORDER_RUNS disjoint runs, as the low 16 bits
+ of sequence numbers ([start,end) : REORDER_SIZE is well short of the wrap).
+
+ Policy :
+ - Only within the window we advertised, from the next byte expected, and no
+   more than REORDER_SIZE : what we could take in order.  What's beyond is 
+   trimmed off, for the peer to send again.
+ - Overlaps are taken as the same bytes again : TCP sends no others.
+ - No run free, and no run it joins : dropped.
+ - Runs the in-order data overtakes are trimmed, or forgotten, on delivery.
+
+*********************************************/
+
+#include "config.h"
+
+#ifdef USE_TCP_REORDER
+
+#include <avr/io.h>
+#include "network.h"
+#include "link.h"
+#include "transport.h"
+#include "reorder.h"
+#include "fragment.h"
+#include "mem23SRAM.h"
+
+#if REORDER_SRAM_BASE+MAX_TCP_ROLES*REORDER_SIZE>FRAG_SRAM_BASE
+#error "What every role holds runs into fragment.c's SRAM"
+#endif
+
+typedef struct {
+  uint8_t  runs;                  // Used entries of start/end
+  uint16_t start[REORDER_RUNS];   // Sequence numbers held, [start,end), low 16 bits
+  uint16_t end[REORDER_RUNS];
+} Held;
+
+static Held held[MAX_TCP_ROLES];
+
+#ifdef STATS
+uint16_t reorderHeld,reorderDropped;  // Segments held; those beyond a gap dropped
+#endif
+
+#define REORDER_AT(R)    (REORDER_SRAM_BASE+(uint32_t)(R)*REORDER_SIZE)
+#define REORDER_POS(S)   ((uint16_t)(S)&(REORDER_SIZE-1))
+
+// ---------------------------------------------------------------------------
+static void forget(Held * h,uint8_t i)
+{ // Run i goes : the last takes its place
+h->runs--;
+h->start[i]=h->start[h->runs];
+h->end[i]=h->end[h->runs];
+}
+// ---------------------------------------------------------------------------
+static uint8_t dropped(void)
+{
+#ifdef STATS
+reorderDropped++;
+#endif
+return (FALSE);
+}
+// ---------------------------------------------------------------------------
+void reorderReset(uint8_t role)
+{ // New connection : nothing held
+held[role].runs=0;
+}
+// ---------------------------------------------------------------------------
+uint8_t reorderHold(uint8_t role,int32_t next,int32_t sequence,uint16_t length,
+                    uint16_t room,uint8_t * scratch,uint16_t scratchSize)
+{ // A segment from beyond the next byte expected, 'next' : its 'length' bytes
+  // of payload to come from linkReadBufferMemoryArray().  'room' is how far 
+  // from 'next' we can take bytes.  Scratch is for moving them.  Returns TRUE 
+  // if held (or already).
+
+Held * h=&held[role];
+int32_t ahead=sequence-next;
+uint16_t start,end,pos,n;
+uint8_t i,joins=FALSE;
+
+if (room>REORDER_SIZE) room=REORDER_SIZE;
+if (!length || ahead<=0 || ahead>=room) return (dropped());
+if (ahead+length>room) length=room-ahead;  // The rest the peer sends again
+start=sequence;
+end=sequence+length;
+
+for (i=0;i<h->runs;i++)
+  if ((int16_t)(start-h->end[i])<=0 && (int16_t)(h->start[i]-end)<=0) joins=TRUE;
+if (!joins && h->runs==REORDER_RUNS) return (dropped());
+
+pos=REORDER_POS(sequence);
+while (length) {
+  n=(length<scratchSize)?length:scratchSize;
+  if (n>REORDER_SIZE-pos) n=REORDER_SIZE-pos;  // The end of the space, then its start
+  linkReadBufferMemoryArray(n,scratch);
+  memWriteBufferMemoryArray(REORDER_AT(role)+pos,n,scratch);
+  pos=REORDER_POS(pos+n);
+  length-=n;
+}
+
+i=0;
+while (i<h->runs) {  // Join it with those it overlaps or meets
+  if ((int16_t)(start-h->end[i])<=0 && (int16_t)(h->start[i]-end)<=0) {
+    if ((int16_t)(h->start[i]-start)<0) start=h->start[i];
+    if ((int16_t)(h->end[i]-end)>0)     end=h->end[i];
+    forget(h,i);
+    i=0;
+  } else i++;
+}
+h->start[h->runs]=start;
+h->end[h->runs++]=end;
+#ifdef STATS
+reorderHeld++;
+#endif
+return (TRUE);
+}
+// ---------------------------------------------------------------------------
+uint16_t reorderNext(uint8_t role,int32_t next,uint8_t * data,uint16_t room)
+{ // Held bytes from 'next' on, as many as 'room', into data.  They are no longer
+  // held.  Returns how many (0 : the gap is still there).
+
+Held * h=&held[role];
+uint16_t from=next,pos,n,length;
+uint8_t i=0;
+
+while (i<h->runs) {  // Forget what the in-order data has overtaken
+  if ((int16_t)(h->end[i]-from)<=0) forget(h,i);
+  else i++;
+}
+for (i=0;i<h->runs;i++) if ((int16_t)(h->start[i]-from)<=0) break;
+if (i==h->runs) return (0);
+
+length=h->end[i]-from;
+if (length>room) length=room;
+h->start[i]=from+length;
+if (h->start[i]==h->end[i]) forget(h,i);
+
+pos=REORDER_POS(from);
+for (room=length;room;room-=n) {
+  n=(room<REORDER_SIZE-pos)?room:(REORDER_SIZE-pos);
+  memReadBufferMemoryArray(REORDER_AT(role)+pos,n,data);
+  data+=n;
+  pos=REORDER_POS(pos+n);
+}
+return (length);
+}
+#endif
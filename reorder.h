@@ -0,0 +1,22 @@
+/********************************************
+ Header code for out-of-order TCP segment holding (reorder.c)
+
+*********************************************/
+
+#ifndef REORDER_H
+#define REORDER_H
+
+#include "network.h"
+
+#define REORDER_SIZE      (4096)    // Bytes held ahead of the next expected, a 
+                                    // connection : the window we advertise.  Power of 2
+#define REORDER_RUNS      (4)       // Disjoint runs of bytes a connection may hold
+#define REORDER_SRAM_BASE (0x18000) // 23LC1024 address, below fragment.c's.  Role 
+                                    // r at +r*REORDER_SIZE
+
+void     reorderReset(uint8_t role);
+uint8_t  reorderHold(uint8_t role,int32_t next,int32_t sequence,uint16_t length,
+                     uint16_t room,uint8_t * scratch,uint16_t scratchSize);
+uint16_t reorderNext(uint8_t role,int32_t next,uint8_t * data,uint16_t room);
+
+#endif
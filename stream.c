@@ -0,0 +1,248 @@
+/********************************************
+ TCP stream API, with ring buffers in the 23LC1024 SPI SRAM
+
+ The rest of the stack hands an application each segment as it comes 
+ (TCP_DataIn()), and takes its output a segment's worth, or a callback, at a
+ time.  A protocol whose messages span segments must piece them together 
+ itself.  Instead, a connection can be a stream : what arrives is put in its
+ RX ring, to be read as and when the application likes (streamRead()), and 
+ what the application writes (streamWrite()) goes in its TX ring, for TCP to
+ send from as the windows allow, made again from there if lost.
+
+ Each connection (role) has a ring each way of STREAM_RING bytes, at
+ STREAM_SRAM_BASE+2*role*STREAM_RING (RX), then TX.  Here, in RAM, are only
+ counts of bytes in and out of each, modulo 2^16.
+
+ - A server : streamListen() a port, then streamAccept() each connection made
+   to it.  A client : streamOpen(), on TCP_CLIENT.  Either gives 's', its role.
+ - The window advertised is never more than the RX ring's room.
+ - TX bytes stay in the ring until ACK'd : streamWrite() takes no more than
+   there is room for, and says how much it took.
+ - Small writes while some are unACK'd wait to go together (pumpTCP(), Nagle).
+ - The peer's FIN only half closes : streamEOF() once all before it is read, 
+   but writes go on until streamClose() sends ours.
+ - A stream's role is only ever a stream : TCP_SimpleDataOut() and the like
+   must not be used on it.
+
+*********************************************/
+
+#include "config.h"
+
+#ifdef USE_TCP_STREAMS
+
+#include <avr/io.h>
+#include "network.h"
+#include "link.h"
+#include "transport.h"
+#include "application.h"
+#include "stream.h"
+#include "reorder.h"
+#include "mem23SRAM.h"
+
+#if STREAM_RING<TCP_WINDOW
+#error "STREAM_RING must hold all of the window we advertise"
+#endif
+#if MAX_TCP_ROLES*STREAM_RING>0x10000
+#error "streamFetch()'s offset, role*STREAM_RING+pos, must fit 16 bits"
+#endif
+#if STREAM_SRAM_BASE+2*MAX_TCP_ROLES*STREAM_RING>REORDER_SRAM_BASE
+#error "The rings, RX and TX for every role, run into reorder.c's SRAM"
+#endif
+
+typedef struct {
+  unsigned  open     :1;   // The role's data goes by the rings
+  unsigned  accepted :1;   // Handed to the application
+  uint16_t  rxIn,rxOut;    // Bytes into the RX ring, and read from it
+  uint16_t  txIn;          // Bytes into the TX ring
+  int32_t   txSequence;    // That of the TX ring's first byte ever
+} Stream;
+
+static Stream streams[MAX_TCP_ROLES];
+static uint16_t listenPort;  // 0 : none
+
+extern TCP_TCB TCB[MAX_TCP_ROLES];
+extern MergedPacket MashE;
+
+#define STREAM_RX_AT(R)  (STREAM_SRAM_BASE+(uint32_t)(R)*2*STREAM_RING)
+#define STREAM_TX_AT(R)  (STREAM_RX_AT(R)+STREAM_RING)
+#define STREAM_POS(N)    ((uint16_t)(N)&(STREAM_RING-1))
+
+static uint16_t streamFetch(uint16_t start,uint16_t length,uint8_t * result);
+
+// ---------------------------------------------------------------------------
+static void ringWrite(uint32_t ring,uint16_t pos,uint16_t length,uint8_t * data)
+{ // To the ring at 'pos' : at its end, on from its start
+uint16_t n=(length<STREAM_RING-pos)?length:(STREAM_RING-pos);
+
+memWriteBufferMemoryArray(ring+pos,n,data);
+if (length>n) memWriteBufferMemoryArray(ring,length-n,&data[n]);
+}
+// ---------------------------------------------------------------------------
+static uint16_t unacked(uint8_t s)
+{ // TX ring bytes the peer has still to ACK
+int32_t acked=TCB[s].lastAckReceived-streams[s].txSequence;
+uint16_t left;
+
+if (acked<0) return (streams[s].txIn);  // Not even the SYN yet
+left=streams[s].txIn-(uint16_t)acked;
+return ((left>STREAM_RING)?0:left);  // Beyond : our FIN, ACK'd
+}
+// ---------------------------------------------------------------------------
+void streamListen(uint16_t port)
+{ // Connections to 'port' are streams, to streamAccept().  0 : no more
+listenPort=port;
+}
+// ---------------------------------------------------------------------------
+uint8_t streamListening(uint16_t port)
+{ // TRUE if connections to 'port' (host order) are streams
+return (listenPort && port==listenPort);
+}
+// ---------------------------------------------------------------------------
+uint8_t streamAccept(void)
+{ // A stream newly connected to the port listened to : its 's'.  Else STREAM_NONE
+uint8_t i;
+
+for (i=TCP_SERVER;i<MAX_TCP_ROLES;i++)
+  if (streams[i].open && !streams[i].accepted && TCB[i].status>=TCP_ESTABLISHED) {
+    streams[i].accepted=TRUE;
+    return (i);
+  }
+return (STREAM_NONE);
+}
+// ---------------------------------------------------------------------------
+uint8_t streamOpen(IP4_address ToIP,uint16_t port)
+{ // A stream to 'port' at ToIP, as TCP_CLIENT.  STREAM_NONE if that's in use.
+  // Reads and writes may start at once : they wait on the connection.
+if (TCB[TCP_CLIENT].status!=TCP_CLOSED && TCB[TCP_CLIENT].status!=TCP_LISTEN) 
+  return (STREAM_NONE);
+
+initiate_TCP_connection(&MashE,newPort(TCP_PORT),port,ToIP,TCP_CLIENT);
+streamAttach(TCP_CLIENT);
+streams[TCP_CLIENT].accepted=TRUE;
+return (TCP_CLIENT);
+}
+// ---------------------------------------------------------------------------
+uint8_t isStream(uint8_t role)
+{ // TRUE if the connection on 'role' is a stream
+return (streams[role].open);
+}
+// ---------------------------------------------------------------------------
+void streamAttach(uint8_t role)
+{ // The connection just opened on 'role' is a stream, empty each way
+streams[role].open=TRUE;
+streams[role].accepted=FALSE;
+streams[role].rxIn=streams[role].rxOut=streams[role].txIn=0;
+streams[role].txSequence=TCB[role].lastByteSent;  // Next : the first of its data
+}
+// ---------------------------------------------------------------------------
+void streamReset(uint8_t role)
+{ // A new connection on 'role' : not a stream, unless streamAttach() says
+streams[role].open=FALSE;
+}
+// ---------------------------------------------------------------------------
+uint16_t streamRoom(uint8_t role)
+{ // Room in the RX ring, for the window we advertise.  0xFFFF : not a stream
+if (!streams[role].open) return (0xFFFF);
+return (STREAM_RING-(uint16_t)(streams[role].rxIn-streams[role].rxOut));
+}
+// ---------------------------------------------------------------------------
+uint8_t streamIn(MergedPacket * Mash,uint16_t newData,uint8_t role)
+{ // From TCP_DataIn() : the last 'newData' bytes of the segment's payload are
+  // new.  If a stream, they go in its RX ring (what's in Mash, else from the 
+  // ENC28J60) and TRUE.
+uint16_t length,offset,room,n,pos;
+
+if (!streams[role].open) return (FALSE);
+
+length=Mash->IP4.totalLength-(Mash->IP4.headerLength+Mash->TCP.headerLength)*4;
+if (newData>length) newData=length;  // A FIN's sequence number, not a byte
+offset=length-newData;
+room=streamRoom(role);
+if (newData>room) newData=room;  // Beyond the window we advertised : lost
+
+pos=STREAM_POS(streams[role].rxIn);
+streams[role].rxIn+=newData;
+if (offset+newData<=sizeof(Mash->TCP_payload)) 
+  ringWrite(STREAM_RX_AT(role),pos,newData,&Mash->TCP_payload.bytes[offset]);
+else {  // Not all fetched : Mash's payload is scratch for the move
+  linkReadRandomAccess(ETH_HEADER_SIZE+(Mash->IP4.headerLength+Mash->TCP.headerLength)*4+
+                       offset);
+  while (newData) {
+    n=(newData<sizeof(Mash->TCP_payload))?newData:sizeof(Mash->TCP_payload);
+    linkReadBufferMemoryArray(n,Mash->TCP_payload.bytes);
+    ringWrite(STREAM_RX_AT(role),pos,n,Mash->TCP_payload.bytes);
+    pos=STREAM_POS(pos+n);
+    newData-=n;
+  }
+}
+return (TRUE);
+}
+// ---------------------------------------------------------------------------
+uint16_t streamReadable(uint8_t s)
+{ // Bytes there are to read
+return (streams[s].open?(uint16_t)(streams[s].rxIn-streams[s].rxOut):0);
+}
+// ---------------------------------------------------------------------------
+uint16_t streamRead(uint8_t s,uint8_t * data,uint16_t room)
+{ // As many bytes as there are, up to 'room', into data.  Returns how many.
+uint16_t length=streamReadable(s),pos=STREAM_POS(streams[s].rxOut),n;
+
+if (length>room) length=room;
+n=(length<STREAM_RING-pos)?length:(STREAM_RING-pos);
+memReadBufferMemoryArray(STREAM_RX_AT(s)+pos,n,data);
+if (length>n) memReadBufferMemoryArray(STREAM_RX_AT(s),length-n,&data[n]);
+streams[s].rxOut+=length;
+return (length);
+}
+// ---------------------------------------------------------------------------
+uint16_t streamWritable(uint8_t s)
+{ // Room there is to write : 0 once closed
+uint8_t status=TCB[s].status;
+
+if (!streams[s].open || TCB[s].finQueued || 
+    (status!=TCP_SYN_SENT && status!=TCP_SYN_RCVD && status!=TCP_ESTABLISHED &&
+     status!=TCP_CLOSE_WAIT)) return (0);
+return (STREAM_RING-unacked(s));
+}
+// ---------------------------------------------------------------------------
+uint16_t streamWrite(uint8_t s,const uint8_t * data,uint16_t length)
+{ // Queues what there's room for to send.  Returns how many bytes that was : 
+  // fewer, even none, if TCP's queue is full.
+uint16_t room=streamWritable(s),pos,n,done;
+
+if (length>room) length=room;
+pos=STREAM_POS(streams[s].txIn);
+ringWrite(STREAM_TX_AT(s),pos,length,(uint8_t *)data);
+
+for (done=0;done<length;done+=n) {  // Each callback span within the ring
+  n=(length-done<STREAM_RING-pos)?(length-done):(STREAM_RING-pos);
+  if (!TCP_ComplexDataOut(&MashE,s,n,&streamFetch,s*STREAM_RING+pos,TRUE)) break;
+  pos=STREAM_POS(pos+n);
+}
+streams[s].txIn+=done;
+return (done);
+}
+// ---------------------------------------------------------------------------
+static uint16_t streamFetch(uint16_t start,uint16_t length,uint8_t * result)
+{ // The callback TCP makes its segments with : 'start' is role*STREAM_RING+pos
+memReadBufferMemoryArray(STREAM_TX_AT(start/STREAM_RING)+STREAM_POS(start),length,result);
+return (length);
+}
+// ---------------------------------------------------------------------------
+uint8_t streamEOF(uint8_t s)
+{ // TRUE once all the peer will send has been read
+uint8_t status=TCB[s].status;
+
+if (streamReadable(s)) return (FALSE);
+return (!streams[s].open || status==TCP_CLOSED || status==TCP_CLOSE_WAIT || 
+        status==TCP_LAST_ACK || status==TCP_TIME_WAIT || status==TCP_CLOSING);
+}
+// ---------------------------------------------------------------------------
+void streamClose(uint8_t s)
+{ // No more to write : FIN once what's written has gone.  Also once the peer
+  // has sent its FIN (CLOSE_WAIT), which is the only way the connection ends.
+if (streams[s].open && (TCB[s].status==TCP_ESTABLISHED || TCB[s].status==TCP_CLOSE_WAIT) && 
+    !TCB[s].finQueued) 
+  TCP_FIN(&MashE,s);
+}
+#endif
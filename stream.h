@@ -0,0 +1,34 @@
+/********************************************
+ Header code for the TCP stream API (stream.c)
+
+*********************************************/
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "network.h"
+
+#define STREAM_RING      (4096)    // Bytes each way, a connection : >=TCP_WINDOW.  Power of 2
+#define STREAM_SRAM_BASE (0x10000) // 23LC1024 address, below reorder.c's.  Role r's
+                                   // RX ring at +2r*STREAM_RING, its TX ring next
+#define STREAM_NONE      (0xFF)    // No stream
+
+void     streamListen(uint16_t port);
+uint8_t  streamAccept(void);
+uint8_t  streamOpen(IP4_address ToIP,uint16_t port);
+uint16_t streamRead(uint8_t s,uint8_t * data,uint16_t room);
+uint16_t streamReadable(uint8_t s);
+uint16_t streamWrite(uint8_t s,const uint8_t * data,uint16_t length);
+uint16_t streamWritable(uint8_t s);
+uint8_t  streamEOF(uint8_t s);
+void     streamClose(uint8_t s);
+
+// For transport.c
+uint8_t  streamListening(uint16_t port);
+uint8_t  isStream(uint8_t role);
+void     streamAttach(uint8_t role);
+void     streamReset(uint8_t role);
+uint8_t  streamIn(MergedPacket * Mash,uint16_t newData,uint8_t role);
+uint16_t streamRoom(uint8_t role);
+
+#endif
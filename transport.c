@@ -26,6 +26,7 @@ Define USE_TCP (from config.h) includes TCP code
 #include "config.h"
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <util/delay.h>
 #include <avr/eeprom.h>
@@ -37,37 +38,73 @@ Define USE_TCP (from config.h) includes TCP code
 #include "network.h"
 #include "transport.h"
 #include "application.h"
-#include "power.h"
 #include "lfsr.h" // available pseudorandomness
+#ifdef USE_TCP_REORDER
+#include "reorder.h"
+#endif
+#ifdef USE_TCP_STREAMS
+#include "stream.h"
+#endif
 
 extern IP4_address myIP;
 
 #ifdef USE_TCP
 TCP_TCB TCB[MAX_TCP_ROLES];
 Retransmit ReTx[MAX_RETX];
+static Queued TxQ[TCP_QUEUE];  // In sequence order within each role
+#ifdef USE_SYN_COOKIES
+static uint32_t cookieKey[2];  // Secret : a peer can't make a cookie without it
+static const uint16_t cookieMSS[8]={64,256,536,1024,1220,1360,1440,1460};  // What 3 bits say
+#endif
 #endif
-extern uint16_t UDP_Port[MAX_UDP_PORTS];
 extern uint16_t UDP_low_port;
+static UDP_binding UDP_bound[UDP_BINDINGS];  // Hashed on port : 0 is a free slot
+static UDP_handler UDP_anyHandler;           // UDP_ANY_PORT
 extern MergedPacket MashE;
 
 extern char buffer[MSG_LENGTH];
 
-#ifdef WHEREABOUTS
-extern uint8_t gis,ris,fis;  // Locations of G & R (0-11)
-extern uint8_t lastMode;
-#endif
-
 void TCP_Endianism(MergedPacket * Mash);
 void UDP_Endianism(UDP_header * Header);
+static UDP_binding * udpFind(uint16_t port);
 
 // Local functions
 #ifdef USE_TCP
 static void cancelAckdReTx(const uint8_t * role);
 static void cancelAllReTx(const uint8_t * role);
-static void scheduleReTx(MergedPacket * Mash, uint16_t payloadLength, uint16_t headerLength, 
+static void scheduleReTx(MergedPacket * Mash, uint16_t payloadLength,
    const uint8_t * role,void (* callback)(uint16_t start,uint16_t length,uint8_t * result),uint16_t offset);
 static uint16_t handleMetrics(MergedPacket * Mash, const uint8_t * role, uint8_t * ack);
 static void defaultHead(MergedPacket * Mash,const uint8_t * role);
+static void optionMSS(MergedPacket * Mash);
+static uint8_t findRole(MergedPacket * Mash);
+static uint8_t listening(uint16_t port);
+static uint16_t windowLeft(uint8_t role);
+static uint16_t roomFor(uint8_t role,uint16_t left);
+static uint16_t windowFor(uint8_t role);
+static uint16_t clockTCP(void);
+static void resetTCB(uint8_t role);
+static uint16_t peerMSS(MergedPacket * Mash);
+static void useMSS(uint8_t role,uint16_t mss);
+static void sampleRTT(uint8_t role,uint16_t rtt);
+static void openCwnd(uint8_t role,uint32_t acked);
+static void dropQueued(uint8_t role);
+static uint8_t queuedTCP(uint8_t role);
+static void pumpRole(uint8_t role);
+static void probeWindow(uint8_t role,uint8_t i,uint16_t done);
+#ifdef USE_TCP_REORDER
+static uint16_t heldIn(MergedPacket * Mash,uint8_t role);
+#endif
+#ifdef USE_SYN_COOKIES
+static uint32_t cookie(MergedPacket * Mash,uint32_t theirs,uint8_t slot,uint8_t mss);
+static void cookieSYN_ACK(MergedPacket * Mash);
+static uint8_t cookieRole(MergedPacket * Mash);
+#endif
+static uint16_t ackAdjust(uint16_t csum,uint32_t from,uint32_t to);
+static uint16_t windowAdjust(uint16_t csum,uint16_t from,uint16_t to);
+static void launchSegment(MergedPacket * Mash,uint16_t payloadLength,IP4_address * ToIP,
+              uint8_t csums,void (* callback)(uint16_t start,uint16_t length,uint8_t * result),
+              uint16_t offset);
 void TCP_SYN_ACK(MergedPacket * Mash, uint16_t sourcePort,
                    uint16_t destinationPort, IP4_address ToIP, uint8_t role);
 void TCP_FIN(MergedPacket * Mash, uint8_t role);
@@ -79,6 +116,9 @@ void MemOverflow()  { strcpy(buffer,"Malloc failed");  Error();  }
 
 #ifdef USE_TCP
 extern uint16_t FTP_passive_port;
+
+#define TICK_MS8 ((uint16_t)((1000UL*256+TIMER_TICKS/2)/TIMER_TICKS))  // ms a tick, <<8
+static volatile uint16_t TCP_ms;  // The TCP clock, ms : wraps every ~65s
 // ----------------------------------------------------------------------------
 void initialiseTCP(void)
 {
@@ -87,11 +127,111 @@ for (i=0;i<MAX_TCP_ROLES;i++)  {
   TCB[i].status=TCP_CLOSED;
   TCB[i].lastByteSent=Rnd32bit(); // New random seq	(If LFSR not present, can use fixed no)
 }
-for (i=0;i<MAX_RETX;i++) {  ReTx[i].retries=ReTx[i].timeout=ReTx[i].active=0; }
+for (i=0;i<MAX_RETX;i++) {  ReTx[i].retries=ReTx[i].active=0; }
+for (i=0;i<TCP_QUEUE;i++) TxQ[i].active=FALSE;
+#ifdef USE_SYN_COOKIES
+cookieKey[0]=Rnd32bit();
+cookieKey[1]=Rnd32bit();
+#endif
+}
+// ----------------------------------------------------------------------------
+void tickTCP(void) { // Called each TIMER0 tick from interrupt.  Keep short.
+  static uint8_t fraction;  // Of a ms, <<8
+  uint16_t ms8=fraction+TICK_MS8;
+  TCP_ms+=ms8>>8;
+  fraction=ms8&0xFF;
 }
 // ----------------------------------------------------------------------------
-void countdownTCP(void) { // Called 1 per sec from interrupt.  Keep short.
-  for (uint8_t i=0;i<MAX_RETX;i++) if (ReTx[i].active) ReTx[i].timeout--; 
+static uint16_t clockTCP(void)
+{ // The TCP clock (ms), read whole
+uint16_t now;
+
+cli();
+now=TCP_ms;
+sei();
+return (now);
+}
+// ----------------------------------------------------------------------------
+static void resetTCB(uint8_t role)
+{ // New connection : nothing measured or queued yet
+TCB[role].srtt=TCB[role].rttvar=0;
+TCB[role].rto=TCP_RTO_INITIAL;
+useMSS(role,TCP_MSS_DEFAULT);  // Until their SYN says
+TCB[role].ssthresh=0xFFFF;
+TCB[role].ackOwed=0;
+TCB[role].probes=0;
+dropQueued(role);
+#ifdef USE_TCP_REORDER
+reorderReset(role);
+#endif
+#ifdef USE_TCP_STREAMS
+streamReset(role);
+#endif
+}
+// ----------------------------------------------------------------------------
+static uint16_t peerMSS(MergedPacket * Mash)
+{ // The MSS option of a SYN (RFC 879), within what we can send.  Else the default.
+  // Options run on into the payload's space in Mash : up to 40 bytes of them.
+const uint8_t * o=Mash->TCP_options;
+uint16_t i=0,length=(Mash->TCP.headerLength>5)?4*Mash->TCP.headerLength-TCP_HEADER_SIZE:0;
+uint16_t mss=TCP_MSS_DEFAULT;
+
+while (i<length && o[i]) {  // 0 : end of options
+  if (o[i]==1) { i++; continue; }  // NOP
+  if (i+1>=length || o[i+1]<2) break;  // Malformed
+  if (o[i]==2 && o[i+1]==4 && i+4<=length) mss=((uint16_t)o[i+2]<<8)|o[i+3];
+  i+=o[i+1];
+}
+if (mss>MAX_PAYLOAD) mss=MAX_PAYLOAD;
+if (mss<TCP_MSS_MIN) mss=TCP_MSS_MIN;
+return (mss);
+}
+// ----------------------------------------------------------------------------
+static void useMSS(uint8_t role,uint16_t mss)
+{ // Segments of this size from now on : the initial window is counted in them
+TCB[role].mss=mss;
+TCB[role].cwnd=TCP_CWND_SEGMENTS*mss;
+}
+// ----------------------------------------------------------------------------
+static void sampleRTT(uint8_t role,uint16_t rtt)
+{ // Jacobson's estimator (RFC 6298), in fixed point : srtt is ms<<3 and rttvar
+  // ms<<2, so the gains of 1/8 and 1/4 are shifts.  rto=srtt+4*rttvar, not less
+  // than a tick, within TCP_RTO_MIN..TCP_RTO_MAX.
+int16_t delta;
+uint16_t rto;
+TCP_TCB * t=&TCB[role];
+
+if (rtt>TCP_RTT_MAX) rtt=TCP_RTT_MAX;
+
+if (!t->srtt) {  // First : srtt=rtt, rttvar=rtt/2
+  t->srtt  =rtt<<3;
+  t->rttvar=rtt<<1;
+} else {
+  delta=rtt-(t->srtt>>3);
+  t->srtt+=delta;
+  if (delta<0) delta=-delta;
+  t->rttvar+=delta-(t->rttvar>>2);
+}
+if (!t->srtt) t->srtt=1;  // Measured, even if under a tick
+
+rto=(t->rttvar>(TICK_MS8>>8))?t->rttvar:((TICK_MS8>>8)+1);  // 4*rttvar, or a tick
+rto+=t->srtt>>3;
+if (rto<TCP_RTO_MIN) rto=TCP_RTO_MIN;
+if (rto>TCP_RTO_MAX) rto=TCP_RTO_MAX;
+t->rto=rto;
+}
+// ----------------------------------------------------------------------------
+static void openCwnd(uint8_t role,uint32_t acked)
+{ // The congestion window grows as new data is ACK'd (RFC 5681) : by what was 
+  // ACK'd, up to a segment, in slow start; else by about a segment a round trip
+TCP_TCB * t=&TCB[role];
+uint16_t more;
+
+if (t->cwnd<t->ssthresh) more=(acked<t->mss)?acked:t->mss;
+else more=((uint32_t)t->mss*t->mss)/t->cwnd;
+if (!more) more=1;
+
+t->cwnd=(t->cwnd>0xFFFF-more)?0xFFFF:(t->cwnd+more);
 }
 // ----------------------------------------------------------------------------
 uint8_t ActiveReTx(uint8_t role) 
@@ -106,48 +246,82 @@ return (j);
 // ----------------------------------------------------------------------------
 void retxTCP(void) // Called from main loop.
 {
-uint8_t  i;
-uint16_t j;
+uint8_t  i,role;
+uint16_t now=clockTCP(),flight;
+uint32_t wait;
 
 // TODO cleanupOldTCP();  // Any old server ones, just kill.  Will cancel their retransmissions.
 
 for (i=0;i<MAX_RETX;i++) {
-  if ((ReTx[i].active) &&  (!ReTx[i].timeout)) {
+  if ((ReTx[i].active) && (int16_t)(now-ReTx[i].due)>=0) {
 // There is something to resend and now is the time
     if (ReTx[i].retries==0) {// That's enough
-      ReTx[i].active=0;
-      free(ReTx[i].data);
-      if (TCB[ReTx[i].role].status==TCP_TIME_WAIT)  {
-        TCB[ReTx[i].role].status=TCP_CLOSED; // All done
-      }
-      else {   // Send RST and time out
-        //TODO  TCP_RST(&MashE,TCB[ReTx[i].role].localPort,TCB[ReTx[i].role].remotePort,
-        //               TCB[ReTx[i].role].remoteIP,ReTx[i].role); 
-        //TCB[ReTx[i].role].status=TCP_TIME_WAIT; // Error (retries still zero)
-        //ReTx[i].timeout=TCP_TIMEOUT;
-    } }
+      role=ReTx[i].role;
+      // The other end has stopped answering (so a RST would be wasted) : close, 
+      // which frees the TCB and all its retransmissions.
+      TCB[role].status=TCP_CLOSED;
+      cancelAllReTx(&role);
+      dropQueued(role);
+    }
     else {
-      TCB[ReTx[i].role].age=TCP_MAX_AGE; // Keep alive	
-      ReTx[i].timeout=(TCP_TIMEOUT);
+      role=ReTx[i].role;
+      TCB[role].age=TCP_MAX_AGE; // Keep alive	
       ReTx[i].retries--;
 
-      for (j=0;j<(TCP_RETRIES-ReTx[i].retries);j++) ReTx[i].timeout*=2;
-      // Binary exponential increase
-
-      if (ReTx[i].data) {
-        for (j=0;j<(ReTx[i].payloadLength+ReTx[i].headerLength);j++)
-          MashE.bytes[ETH_HEADER_SIZE+IP_HEADER_SIZE+j]=ReTx[i].data[j];
-        launchTCP(&MashE,ReTx[i].payloadLength,&(TCB[ReTx[i].role].remoteIP),NULL,0);
+      // Taken as loss from congestion : back to slow start, from one segment, 
+      // with half what was in flight as the threshold (RFC 5681)
+      if (ReTx[i].retries==TCP_RETRIES-1) {
+        flight=TCB[role].lastByteSent-TCB[role].lastAckReceived;
+        TCB[role].ssthresh=(flight/2>2*TCB[role].mss)?(flight/2):(2*TCB[role].mss);
+      }
+      TCB[role].cwnd=TCB[role].mss;
+
+      // Binary exponential increase on the connection's RTO
+      wait=(uint32_t)TCB[ReTx[i].role].rto<<(TCP_RETRIES-ReTx[i].retries);
+      ReTx[i].due=now+((wait>TCP_RTO_MAX)?TCP_RTO_MAX:(uint16_t)wait);
+
+      // Only the ack and the window are new : the checksum as sent is adjusted
+      // for them, not summed again over the segment
+      if (ReTx[i].kept!=LINK_NOT_HELD) {  // Rewritten in place, and sent from there
+        if (ReTx[i].flags & FL_ACK) {
+          int32_t ack=TCB[ReTx[i].role].lastByteReceived+1;
+          uint16_t words[2];  // Window, checksum
+          words[0]=windowFor(ReTx[i].role);
+          words[1]=windowAdjust(ackAdjust(ReTx[i].checksum,0,ack),0,words[0]);
+          words[0]=BYTESWAP16(words[0]);
+          ack=BYTESWAP32(ack);
+          linkKeptPatch(ReTx[i].kept,TCP_FRAME_ACK,(uint8_t *)&ack,4);
+          linkKeptPatch(ReTx[i].kept,TCP_FRAME_WINDOW,(uint8_t *)words,4);
+          TCB[ReTx[i].role].ackOwed=0;  // It carries any ACK owed
+        }
+        linkKeptSend(ReTx[i].kept);
 	  } else if (ReTx[i].callback) {		  
 	    defaultHead(&MashE,&ReTx[i].role);
         MashE.TCP.sequence=ReTx[i].sequence;     // Override with original value  
 		MashE.TCP.headerLength=5;
         MashE.TCP.flags       =(FL_ACK);
-        MashE.TCP.windowSize  =MAX_PACKET_PAYLOAD;
-        //  Set checksum last (i.e. later)
+        MashE.TCP.windowSize  =windowFor(ReTx[i].role);
         MashE.TCP.urgent      =0;
-
-        launchTCP(&MashE,ReTx[i].payloadLength,&TCB[ReTx[i].role].remoteIP,(void *)ReTx[i].callback,ReTx[i].start); 
+        MashE.TCP.TCP_checksum=windowAdjust(ackAdjust(ReTx[i].checksum,0,MashE.TCP.ack),0,
+                                            MashE.TCP.windowSize);
+
+        launchSegment(&MashE,ReTx[i].payloadLength,&TCB[ReTx[i].role].remoteIP,0,
+                      (void *)ReTx[i].callback,ReTx[i].start); 
+      } else {  // A SYN, SYN-ACK or FIN not kept (parked awaiting ARP) : made again
+        defaultHead(&MashE,&role);
+        MashE.TCP.sequence=ReTx[i].sequence;
+        MashE.TCP.flags   =ReTx[i].flags;
+        MashE.TCP.urgent  =0;
+        if (ReTx[i].flags & FL_SYN) {
+          if (!(ReTx[i].flags & FL_ACK)) MashE.TCP.ack=0x0;
+          MashE.TCP.headerLength=6;
+          MashE.TCP.windowSize  =TCP_WINDOW_SYN;
+          optionMSS(&MashE);
+        } else {
+          MashE.TCP.headerLength=5;
+          MashE.TCP.windowSize  =windowFor(role);
+        }
+        launchTCP(&MashE,0,&TCB[role].remoteIP,NULL,0);
       }
     }
   }	
@@ -156,10 +330,12 @@ for (i=0;i<MAX_RETX;i++) {
 // ----------------------------------------------------------------------------
 void cleanupOldTCP()
 {
-if (TCB[TCP_SERVER].status >= TCP_ESTABLISHED) {
-  if (TCB[TCP_SERVER].age) TCB[TCP_SERVER].age--;
+uint8_t i;
+
+for (i=TCP_SERVER;i<MAX_TCP_ROLES;i++) if (TCB[i].status >= TCP_ESTABLISHED) {
+  if (TCB[i].age) TCB[i].age--;
   else { // Kill old ones off.  Age is renewed every time we use.
-    TCP_FIN(&MashE,TCP_SERVER); //  Should really do RST?
+    TCP_FIN(&MashE,i); //  Should really do RST?
 	// FIN will cancel relevant retransmissions
   }
 }
@@ -199,6 +375,10 @@ uint8_t pendingReTx(const uint8_t * role)
 void TCP_DataIn(MergedPacket * Mash,const uint16_t newData,const uint8_t role)
 {  // newData is TCP data (not header) that we haven't heard before (on simple ACK=0)
 
+#ifdef USE_TCP_STREAMS
+if (streamIn(Mash,newData,role)) return;  // To its RX ring, for streamRead()
+#endif
+
 #ifdef IS_HTTP_CLIENT
 if (Mash->TCP.sourcePort==HTTP_SERVER_PORT && role==TCP_CLIENT)
 { 
@@ -208,9 +388,9 @@ if (Mash->TCP.sourcePort==HTTP_SERVER_PORT && role==TCP_CLIENT)
 #endif
 
 #ifdef IS_HTTP_SERVER
-if (Mash->TCP.destinationPort==HTTP_SERVER_PORT && role==TCP_SERVER) 
+if (Mash->TCP.destinationPort==HTTP_SERVER_PORT && IS_SERVER_ROLE(role)) 
 {
-  sendHTML(Mash,newData);
+  sendHTML(Mash,newData,role);
   return;
 }
 #endif
@@ -231,9 +411,11 @@ if (Mash->TCP.sourcePort==FTP_SERVER_PORT && role==TCP_FTP_CLIENT)
 }
 // ----------------------------------------------------------------------------
 void cancelAckdReTx(const uint8_t * role)
-{ // Cancel those retransmissions for which we have had the packet ACK'd
+{ // Cancel those retransmissions for which we have had the packet ACK'd.  The
+  // most recently sent of them, unless it was resent (Karn), times the RTT.
 uint8_t i;
 int32_t delta;
+uint16_t now=clockTCP(),rtt=0xFFFF;
 
 for (i=0;i<MAX_RETX;i++)
   if (ReTx[i].active && (ReTx[i].role == (*role)))
@@ -242,10 +424,12 @@ for (i=0;i<MAX_RETX;i++)
     if (delta > 0) // >0 because last_ack is lastByte + 1
     {    
       ReTx[i].active=FALSE;
-      if (ReTx[i].data) free(ReTx[i].data);
-      if (ReTx[i].callback) free(ReTx[i].callback);
+      linkKeptDrop(ReTx[i].kept);
+      if (ReTx[i].retries==TCP_RETRIES && (uint16_t)(now-ReTx[i].sentAt)<rtt) 
+        rtt=now-ReTx[i].sentAt;
     }
   }
+if (rtt!=0xFFFF) sampleRTT(*role,rtt);
 }
 // ----------------------------------------------------------------------------
 void cancelAllReTx(const uint8_t * role)
@@ -256,22 +440,22 @@ for (i=0;i<MAX_RETX;i++)
   if (ReTx[i].active && (ReTx[i].role == (*role)))
   {
     ReTx[i].active=FALSE;
-    if (ReTx[i].data) free(ReTx[i].data);
-    if (ReTx[i].callback) free(ReTx[i].callback);
+    linkKeptDrop(ReTx[i].kept);
   }
 }
 // ----------------------------------------------------------------------------
 void scheduleReTx(MergedPacket * Mash, uint16_t payloadLength, 
-                  uint16_t headerLength,const uint8_t * role,
+                  const uint8_t * role,
 				  void (* callback)(uint16_t start,uint16_t length,uint8_t * result),
 				  uint16_t offset)
 { // For TCP retransmissions.
-//   Always call AFTER transmission, to save memory (transmisison might need to
-//   do an ARP, costing extra 42 ephemeral bytes).  
+//   Always call straight AFTER transmission : the frame as sent is kept where it
+//   is, in the ENC28J60, rather than in our RAM.  Unless a callback can make it
+//   again, which then does : that room is scarce, and streamed data (pumpTCP()) 
+//   would fill it.  Failing both (e.g. parked awaiting ARP), a SYN, SYN-ACK or 
+//   FIN is made again from the TCB when due; data, no retransmission.
 
-uint8_t i;
- 
-  return; // TODO testing
+uint8_t i,kept;
  
   i=0;
   while (i<MAX_RETX) {
@@ -280,34 +464,24 @@ uint8_t i;
   }
   if (i==MAX_RETX) return;  // No slot, so just try to cope
 
-//#ifdef RETX // TODO BREACH of protocol if defined, but risks memory overflow if it isn't
- uint8_t j;
+  kept=(callback)?LINK_NOT_HELD:linkKeepSent();
+  if (kept==LINK_NOT_HELD && !callback && 
+      (payloadLength || !(Mash->TCP.flags & (FL_SYN | FL_FIN)))) return;
 
   ReTx[i].role=(*role);
   ReTx[i].active=TRUE;
   ReTx[i].retries=TCP_RETRIES;
-  ReTx[i].timeout=TCP_TIMEOUT;
+  ReTx[i].sentAt=clockTCP();
+  ReTx[i].due=ReTx[i].sentAt+TCB[*role].rto;
+  ReTx[i].kept=kept;
+  ReTx[i].callback=(void *)callback;
+  ReTx[i].flags=Mash->TCP.flags;
   ReTx[i].payloadLength=payloadLength;
-  ReTx[i].headerLength=headerLength;
   ReTx[i].lastByte=Mash->TCP.sequence+((payloadLength)?(payloadLength-1):0);
-  
-  if (callback) {
-	  ReTx[i].callback=callback;
-	  ReTx[i].data=NULL;
-	  ReTx[i].start=offset;
-    ReTx[i].sequence=Mash->TCP.sequence;
-    } else {
-      ReTx[i].callback=NULL;
-      ReTx[i].data=malloc(payloadLength+headerLength);
-
-      if (ReTx[i].data == NULL) MemOverflow();  // Maloc failed
-      else
-      {
-        for (j=0;j<(payloadLength+headerLength);j++)
-          ReTx[i].data[j]=Mash->bytes[j+ETH_HEADER_SIZE+IP_HEADER_SIZE];
-      }
-    }
-//#endif
+  ReTx[i].sequence=Mash->TCP.sequence;
+  ReTx[i].start=offset;
+  ReTx[i].checksum=windowAdjust(ackAdjust(Mash->TCP.TCP_checksum,Mash->TCP.ack,0),
+                                Mash->TCP.windowSize,0);
 }
 // ----------------------------------------------------------------------------
 /*static uint16_t TCP_Checksum(MergedPacket * Mash,uint16_t TCP_length,
@@ -346,6 +520,15 @@ void defaultHead(MergedPacket * Mash,const uint8_t * role)
   Mash->TCP.ack            =TCB[*role].lastByteReceived+1;  // Comer V1 p208
   // You provide the ack for the byte you next expect.
   Mash->TCP.unused2        =0;
+  TCB[*role].ackOwed       =0;  // Which any delayed ACK is now part of
+}
+// ----------------------------------------------------------------------------
+static void optionMSS(MergedPacket * Mash)
+{ // The one option a SYN or SYN-ACK carries (headerLength 6)
+  Mash->TCP_options[0]=02;  // MSS
+  Mash->TCP_options[1]=04;  // Length
+  Mash->TCP_options[2]=(MAX_PACKET_PAYLOAD>>8); // MSS=0x218 (536) : payload only
+  Mash->TCP_options[3]=(MAX_PACKET_PAYLOAD&0xFF);
 }
 // ----------------------------------------------------------------------------
 void initiate_TCP_connection(MergedPacket * Mash,uint16_t sourcePort,
@@ -361,31 +544,28 @@ uint8_t payloadLength;
   Mash->TCP.headerLength   =6;
   Mash->TCP.flags          =FL_SYN;
 
-  Mash->TCP.windowSize     =MAX_PACKET_PAYLOAD;
+  Mash->TCP.windowSize     =TCP_WINDOW_SYN;
 //  Set checksum last (i.e. later)
   Mash->TCP.urgent         =0;
 
-// Options
-  Mash->TCP_options[0]=02;  // MSS
-  Mash->TCP_options[1]=04;  // Length
-  Mash->TCP_options[2]=((MAX_PACKET_SIZE-ETH_HEADER_SIZE-IP_HEADER_SIZE) >> 8); // MSS=0x240 (576)
-  Mash->TCP_options[3]=((MAX_PACKET_SIZE-ETH_HEADER_SIZE-IP_HEADER_SIZE) & 0xFF);
+  optionMSS(Mash);
 //  Mash->TCP_options[4]=01;  // NOP
 //  Mash->TCP_options[5]=01;  // NOP
 //  Mash->TCP_options[6]=04;  // SACK permitted
 //  Mash->TCP_options[7]=02;  // Length
 
   TCB[role].status         =TCP_SYN_SENT;
+  resetTCB(role);
   TCB[role].age            =TCP_MAX_AGE; 
   TCB[role].localPort      =sourcePort;
   TCB[role].remotePort     =destinationPort;
   copyIP4(&TCB[role].remoteIP,&ToIP);
   TCB[role].lastAckReceived=TCB[role].lastByteSent-1; // initial condition
-  TCB[role].windowSize     =MAX_PACKET_PAYLOAD;
+  TCB[role].windowSize     =MAX_PAYLOAD;  // Until their SYN-ACK says
   payloadLength=0;
 
   launchTCP(Mash,0,&ToIP,NULL,0); 
-  scheduleReTx(Mash,payloadLength,Mash->TCP.headerLength*4,&role,NULL,0);
+  scheduleReTx(Mash,payloadLength,&role,NULL,0);
 
   TCB[role].lastByteSent++; // SYN counts as a byte in the stream
 } 
@@ -395,10 +575,12 @@ void TCP_SYN_ACK(MergedPacket * Mash, uint16_t sourcePort,
 { // Acknowledge a proffered connection with a SYN-ACK packet
 // Don't pass source/dest as refs as we overwrite in Mash
   uint8_t payloadLength;
+  uint16_t mss=peerMSS(Mash);  // Before our options overwrite theirs
 
   Mash->TCP.sourcePort     =TCB[role].localPort  = sourcePort;
   Mash->TCP.destinationPort=TCB[role].remotePort = destinationPort;
   TCB[role].lastByteReceived=Mash->TCP.sequence;
+  TCB[role].windowSize     =Mash->TCP.windowSize;  // Theirs, from the SYN
   shuffleLFSR(Mash->TCP.sequence); // Seed some randomness into our LFSR
   Mash->TCP.ack            =TCB[role].lastByteReceived+1;
   Mash->TCP.sequence       =TCB[role].lastByteSent+=(1500+(uint32_t)Rnd16bit()); // New random seq
@@ -406,17 +588,16 @@ void TCP_SYN_ACK(MergedPacket * Mash, uint16_t sourcePort,
   Mash->TCP.headerLength   =6;
   Mash->TCP.flags=(FL_SYN | FL_ACK);
 
-  Mash->TCP.windowSize     =TCB[role].windowSize = MAX_PACKET_PAYLOAD;
+  Mash->TCP.windowSize     =TCP_WINDOW_SYN;
 //  Set checksum last (i.e. later)
   Mash->TCP.urgent         =0;
 
-// Options
-  Mash->TCP_options[0]=02;  // MSS
-  Mash->TCP_options[1]=04;  // Length
-  Mash->TCP_options[2]=((MAX_PACKET_SIZE-ETH_HEADER_SIZE-IP_HEADER_SIZE)>>8); // MSS=0x240 (576)
-  Mash->TCP_options[3]=((MAX_PACKET_SIZE-ETH_HEADER_SIZE-IP_HEADER_SIZE)&0xFF);
+  optionMSS(Mash);
 
   TCB[role].status         =TCP_SYN_RCVD;
+  resetTCB(role);
+  useMSS(role,mss);
+  TCB[role].windowEdge     =TCB[role].lastByteReceived+1+TCP_WINDOW_SYN;  // As offered above
   TCB[role].age            =TCP_MAX_AGE; 
   payloadLength=0;
 
@@ -424,7 +605,7 @@ void TCP_SYN_ACK(MergedPacket * Mash, uint16_t sourcePort,
   TCB[role].lastAckReceived=TCB[role].lastByteSent-1; // initial condition
 
   launchTCP(Mash,0,&TCB[role].remoteIP,NULL,0); 
-  scheduleReTx(Mash,payloadLength,Mash->TCP.headerLength*4,&role,NULL,0);
+  scheduleReTx(Mash,payloadLength,&role,NULL,0);
 
   TCB[role].lastByteSent++; // SYN-ACK counts as a byte in the stream 
 }
@@ -436,7 +617,7 @@ void TCP_ACK(MergedPacket * Mash,uint8_t role)
   Mash->TCP.headerLength=5;
   Mash->TCP.flags     =(FL_ACK);
 
-  Mash->TCP.windowSize=MAX_PACKET_PAYLOAD;
+  Mash->TCP.windowSize=windowFor(role);
 //  Set checksum last (i.e. later)
   Mash->TCP.urgent    =0;
 
@@ -453,60 +634,232 @@ void TCP_PrivateDataOut(MergedPacket * Mash,const uint8_t role,
   defaultHead(Mash,&role);
   Mash->TCP.headerLength=5;
   Mash->TCP.flags       =(/*FL_PSH |*/ FL_ACK); // PSH should be unnecessary
-  // Setting ACK may lead to repeated ACKs if we pass data in response to a packet
-  // we acked on receipt.  This should be harmless (Wireshark points it out) but helpful
-  // in case function is slow - so host gets a quick ACK, at the price of a later duplicate.
+  // Carries the ACK for what we've received, so one delayed (handleTCP()) need 
+  // not go alone.
 
-  Mash->TCP.windowSize  =MAX_PACKET_PAYLOAD;
+  Mash->TCP.windowSize  =windowFor(role);
 //  Set checksum last (i.e. later)
   Mash->TCP.urgent      =0;
 
   TCB[role].lastByteSent+=(payloadLength);
 
   launchTCP(Mash,payloadLength,&TCB[role].remoteIP,(void *)callback,offset); 
-  if (reTx) scheduleReTx(Mash,payloadLength,Mash->TCP.headerLength*4,&role,(void *)callback,offset);
+  if (reTx) scheduleReTx(Mash,payloadLength,&role,(void *)callback,offset);
 
   TCB[role].age         =TCP_MAX_AGE; // Keep alive
 }
 // ----------------------------------------------------------------------------
-void TCP_ComplexDataOut(MergedPacket * Mash, const uint8_t role, 
+uint8_t TCP_ComplexDataOut(MergedPacket * Mash, const uint8_t role, 
               const uint16_t payloadLength,
               uint16_t (* callback)(uint16_t start,uint16_t length,uint8_t * result),
               uint16_t offset,uint8_t reTx)
 { // Pass some data.  Splits into separate packets if required.  Relies on callback
-//   functions to allow data larger than our own free RAM.
-
-#define MAX_PAYLOAD (1460)  // <=1460 for Ethernet for TCP
+//   functions to allow data larger than our own free RAM : such data is queued,
+//   to go as the peer's window and the congestion window allow (pumpTCP()), 
+//   made by the callback from its offset as each segment goes.  Data without a
+//   callback (in Mash), or with the queue full, goes at once.
+//   Data that carries straight on from the last queued, from the same callback,
+//   joins it : many small writes go in few segments.
+//   Returns FALSE, having sent nothing, if it can neither be queued nor go at 
+//   once : callback data for this connection is still queued, and holds the 
+//   sequence numbers next.  The caller tries again later.
+uint8_t i,j;
+int32_t delta,sequence;
+
+if (callback && payloadLength) {
+  sequence=TCB[role].lastByteSent;  // Follows whatever is queued already
+  for (j=0;j<TCP_QUEUE;j++)
+    if (TxQ[j].active && TxQ[j].role==role) {
+      delta=TxQ[j].sequence+TxQ[j].length-sequence;
+      if (delta>0) sequence+=delta;
+    }
+  for (j=0;j<TCP_QUEUE;j++)
+    if (TxQ[j].active && TxQ[j].role==role && TxQ[j].sequence+TxQ[j].length==sequence &&
+        TxQ[j].callback==(void *)callback && TxQ[j].reTx==reTx &&
+        TxQ[j].offset+TxQ[j].length==offset && TxQ[j].length<=0xFFFF-payloadLength) {
+      TxQ[j].length+=payloadLength;
+      pumpRole(role);
+      return (TRUE);
+    }
+  for (i=0;i<TCP_QUEUE;i++) if (!TxQ[i].active) break;
+
+  if (i<TCP_QUEUE) {
+    TxQ[i].sequence=sequence;
+    TxQ[i].role    =role;
+    TxQ[i].reTx    =reTx;
+    TxQ[i].callback=(void *)callback;
+    TxQ[i].offset  =offset;
+    TxQ[i].length  =payloadLength;
+    TxQ[i].active  =TRUE;
+
+    pumpRole(role);  // What can go now, does
+    return (TRUE);
+  }
+}
+if (queuedTCP(role)) return (FALSE);  // Would overtake what's queued
+// No callback, or no room to queue : all now.  Data in Mash goes from the 
+// front of the payload each time : what is left moves down to it.
 
 uint16_t totalData=payloadLength;
-while (totalData>MAX_PAYLOAD) {
-  TCP_PrivateDataOut(&MashE,TCP_SERVER,MAX_PAYLOAD,callback,offset,reTx); 
-  totalData-=MAX_PAYLOAD;
-  offset+=MAX_PAYLOAD;
+while (totalData>TCB[role].mss) {
+  TCP_PrivateDataOut(&MashE,role,TCB[role].mss,callback,offset,reTx); 
+  totalData-=TCB[role].mss;
+  if (callback) offset+=TCB[role].mss;
+  else memmove(MashE.TCP_payload.chars,MashE.TCP_payload.chars+TCB[role].mss,totalData);
 }
-if (totalData) TCP_PrivateDataOut(&MashE,TCP_SERVER,totalData,callback,offset,reTx);  // Leftovers
+if (totalData) TCP_PrivateDataOut(&MashE,role,totalData,callback,offset,reTx);  // Leftovers
+return (TRUE);
+}
+// ----------------------------------------------------------------------------
+void pumpTCP(void) // Called from main loop.
+{ // Sends what is queued, as ACKs open the windows.  Then any ACK delayed in 
+  // hope of data to carry it, once it has waited long enough; or, with none
+  // owed, a window update, once the window has fallen below half and would
+  // now open by a step.
+uint8_t  role;
+uint16_t now=clockTCP(),left;
+
+for (role=0;role<MAX_TCP_ROLES;role++) {
+  pumpRole(role);
+  if (TCB[role].ackOwed) {
+    if (TCB[role].status>=TCP_ESTABLISHED && (int16_t)(now-TCB[role].ackDue)>=0) 
+      TCP_ACK(&MashE,role);
+  } else if (TCB[role].status==TCP_ESTABLISHED || TCB[role].status==TCP_FIN_WAIT1 ||
+             TCB[role].status==TCP_FIN_WAIT2) {
+    left=windowLeft(role);
+    if (left<TCP_WINDOW/2 && roomFor(role,left)!=left) TCP_ACK(&MashE,role);  // Update
+  }
+}
+}
+// ----------------------------------------------------------------------------
+static void pumpRole(uint8_t role)
+{ // Sends this connection's queued data, a segment at a time, while what is in 
+  // flight is within both the peer's window and the congestion window.  Then 
+  // any FIN that waited for it.
+uint8_t  i,j;
+uint16_t window,flight,length;
+int32_t  done;
+
+if (TCB[role].status<TCP_ESTABLISHED) return;
+if (TCB[role].windowSize) TCB[role].probes=0;
+
+window=(TCB[role].windowSize<TCB[role].cwnd)?TCB[role].windowSize:TCB[role].cwnd;
+
+for (;;) {
+  for (i=0;i<TCP_QUEUE;i++)  // That which holds the next byte to send
+    if (TxQ[i].active && TxQ[i].role==role) {
+      done=TCB[role].lastByteSent-TxQ[i].sequence;
+      if (done>=0 && done<TxQ[i].length) break;
+      if (done>=TxQ[i].length) TxQ[i].active=FALSE;  // Its last byte went as a probe
+    }
+  if (i==TCP_QUEUE) break;
+
+  flight=TCB[role].lastByteSent-TCB[role].lastAckReceived;
+  if (!flight && !TCB[role].windowSize) {  // Nothing in flight to learn when it opens by
+    probeWindow(role,i,done);
+    return;
+  }
+  if (flight>=window) return;  // Wait for ACKs
+
+  length=TxQ[i].length-done;
+  if (length>TCB[role].mss) length=TCB[role].mss;
+  if (length>window-flight) {
+    if (flight) return;  // Wait for the window to open, not send it in dribs (RFC 1122 SWS)
+    length=window-flight;
+  }
+#ifdef USE_TCP_STREAMS
+  // A stream's small writes wait for what's in flight, to go as one (Nagle, RFC 896)
+  if (flight && length<TCB[role].mss && done+length==TxQ[i].length && isStream(role)) return;
+#endif
+  if (TxQ[i].reTx) {  // Wait for a free ReTx slot : else it could not be resent
+    for (j=0;j<MAX_RETX;j++) if (!ReTx[j].active) break;
+    if (j==MAX_RETX) return;
+  }
+
+  TCP_PrivateDataOut(&MashE,role,length,TxQ[i].callback,TxQ[i].offset+done,TxQ[i].reTx);
+  if (done+length==TxQ[i].length) TxQ[i].active=FALSE;
+}
+if (TCB[role].finQueued) {
+  TCB[role].finQueued=FALSE;
+  TCP_FIN(&MashE,role);
+}
+}
+// ----------------------------------------------------------------------------
+static void probeWindow(uint8_t role,uint8_t i,uint16_t done)
+{ // The peer's window is shut, with data queued and none in flight : a window
+  // update it sends could be lost, leaving both ends waiting.  So, an RTO after 
+  // it shut, and then twice as long each time (to TCP_RTO_MAX), the next byte
+  // (TxQ[i], 'done' bytes in) goes alone (RFC 9293 3.8.6.1).  Not counted as 
+  // sent unless the peer takes it (handleTCP()).  Should more than TCP_RETRIES
+  // in a row go unanswered, the peer is gone : close, as retxTCP().
+uint16_t now=clockTCP();
+uint32_t wait;
+
+if (!TCB[role].probes) {  // Just shut
+  TCB[role].probes=1;
+  TCB[role].unanswered=0;
+  TCB[role].probeDue=now+TCB[role].rto;
+  return;
+}
+if ((int16_t)(now-TCB[role].probeDue)<0) return;
+
+if (TCB[role].unanswered>TCP_RETRIES) {
+  TCB[role].status=TCP_CLOSED;
+  cancelAllReTx(&role);
+  dropQueued(role);
+  return;
+}
+TCP_PrivateDataOut(&MashE,role,1,TxQ[i].callback,TxQ[i].offset+done,FALSE);
+TCB[role].lastByteSent--;
+TCB[role].unanswered++;
+
+wait=(uint32_t)TCB[role].rto<<TCB[role].probes;
+TCB[role].probeDue=now+((wait>TCP_RTO_MAX)?TCP_RTO_MAX:(uint16_t)wait);
+if (TCB[role].probes<16) TCB[role].probes++;
+}
+// ----------------------------------------------------------------------------
+static uint8_t queuedTCP(uint8_t role)
+{ // TRUE if this connection has data queued
+uint8_t i;
+
+for (i=0;i<TCP_QUEUE;i++) if (TxQ[i].active && TxQ[i].role==role) return (TRUE);
+return (FALSE);
+}
+// ----------------------------------------------------------------------------
+static void dropQueued(uint8_t role)
+{ // The connection is gone : nothing more to send on it
+uint8_t i;
+
+for (i=0;i<TCP_QUEUE;i++) if (TxQ[i].role==role) TxQ[i].active=FALSE;
+TCB[role].finQueued=FALSE;
 }
 // ----------------------------------------------------------------------------
 void TCP_FIN(MergedPacket * Mash,uint8_t role)
 { // Signal we wish to close a connection (ESTABLISHED->FIN_WAIT1)
 uint8_t payloadLength;
 
+  if (queuedTCP(role)) {  // After the data still to go : pumpTCP() will call again
+    TCB[role].finQueued=TRUE;
+    return;
+  }
   defaultHead(Mash,&role);
   Mash->TCP.headerLength=5;
   Mash->TCP.flags       =(FL_FIN | FL_ACK);
 
-  Mash->TCP.windowSize  =(MAX_PACKET_PAYLOAD);
+  Mash->TCP.windowSize  =windowFor(role);
 //  Set checksum last (i.e. later)
   Mash->TCP.urgent      =0;
   payloadLength=0;
 
   launchTCP(Mash,payloadLength,&TCB[role].remoteIP,NULL,0); 
-// TODO - re tx for FIN? Probably not.
-//  scheduleReTx(Mash,payloadLength,Mash->TCP.headerLength*4,&role,NULL,0);
-  cancelAllReTx(&role); 
+  scheduleReTx(Mash,payloadLength,&role,NULL,0);  // Data before it still may be, too
+  TCB[role].lastByteSent++; // FIN counts as a byte in the stream
+  TCB[role].age         =TCP_MAX_AGE;
 
   if (TCB[role].status==TCP_ESTABLISHED) {  // Closing was our idea 
     TCB[role].status=TCP_FIN_WAIT1; // If their idea, go to CLOSE_WAIT (done in caller)
+  } else if (TCB[role].status==TCP_CLOSE_WAIT) {  // Theirs, and now ours (streamClose())
+    TCB[role].status=TCP_LAST_ACK;
   }
 }
 // ----------------------------------------------------------------------------
@@ -521,11 +874,14 @@ void TCP_RST(MergedPacket * Mash, uint16_t sourcePort,
   Mash->TCP.headerLength   =5;
   Mash->TCP.flags          =FL_RST;
 
-  Mash->TCP.windowSize     =MAX_PACKET_PAYLOAD;
+  Mash->TCP.windowSize     =TCP_WINDOW;
 //  Set checksum last (i.e. later)
   Mash->TCP.urgent         =0;
   
-  if (role != TCP_REJECT) cancelAllReTx(&role); 
+  if (role != TCP_REJECT) {
+    cancelAllReTx(&role); 
+    dropQueued(role);
+  }
   // TCP_REJECT role specific to reject, where it was never our connection
 
   launchTCP(Mash,0,&ToIP,NULL,0); // 0 is payload length; no payload at RST
@@ -537,6 +893,15 @@ void launchTCP(MergedPacket * Mash,uint16_t payloadLength,IP4_address * ToIP,
 { // Setup the TCP checksum and then send it on
 // payloadLength is the TCP length less the TCP header
 
+launchSegment(Mash,payloadLength,ToIP,CS_TCP,callback,offset);
+}
+// ----------------------------------------------------------------------------
+static void launchSegment(MergedPacket * Mash,uint16_t payloadLength,IP4_address * ToIP,
+              uint8_t csums,void (* callback)(uint16_t start,uint16_t length,uint8_t * result),
+              uint16_t offset)
+{ // As launchTCP(), but 'csums' 0 if the TCP checksum is already in place 
+  // (retransmissions).  Either way it is left in Mash as sent.
+
 TCP_Endianism(Mash);
 
 //Mash->TCP.TCP_checksum=0x0000;  // 0 does not suffer from endianism
@@ -546,23 +911,192 @@ TCP_Endianism(Mash);
 // Insert IP4 header into mash
 prepareIP4(Mash, 4*(Mash->TCP.headerLength)+(payloadLength),ToIP,TCPinIP4);  
 
-launchIP4(Mash,CS_TCP,callback,offset);
+launchIP4(Mash,csums,callback,offset);
 TCP_Endianism(Mash); // Returns Mash in same state as started
 
 return;
 }
 // ----------------------------------------------------------------------------
+static uint16_t ackAdjust(uint16_t csum,uint32_t from,uint32_t to)
+{ // TCP checksum 'csum' adjusted (RFC 1624) for the ack changing 'from' 'to' 
+  // (host order)
+from=BYTESWAP32(from);  // Words as they lie in the segment
+to  =BYTESWAP32(to);
+
+return (checksumAdjust(csum,(uint16_t *)&from,(uint16_t *)&to,2));
+}
+// ----------------------------------------------------------------------------
+static uint16_t windowAdjust(uint16_t csum,uint16_t from,uint16_t to)
+{ // Likewise, for the window
+from=BYTESWAP16(from);
+to  =BYTESWAP16(to);
+
+return (checksumAdjust(csum,&from,&to,1));
+}
+// ----------------------------------------------------------------------------
+static uint8_t listening(uint16_t port)
+{ // TRUE if the server takes connections to this port (host order)
+#ifdef USE_TCP_STREAMS
+if (streamListening(port)) return (TRUE);
+#endif
+return (port==HTTP_SERVER_PORT);
+}
+// ----------------------------------------------------------------------------
+static uint16_t windowLeft(uint8_t role)
+{ // What remains of the window we last advertised, beyond what we've had
+int32_t left=TCB[role].windowEdge-(TCB[role].lastByteReceived+1);
+
+return ((left<0 || left>TCP_WINDOW)?0:left);  // Stale : data beyond it was taken
+}
+// ----------------------------------------------------------------------------
+static uint16_t roomFor(uint8_t role,uint16_t left)
+{ // The window we could advertise on this connection now, if a step beyond 
+  // 'left' (what remains of the last), else 'left'.  What we can take : no 
+  // more than a stream's RX ring has room for, nor the ENC28J60's RX ring in
+  // full sized segments, so that a fast sender sees backpressure, not loss.
+  // The chip is asked last, only if it could matter.
+uint16_t room=TCP_WINDOW,rx;
+
+#ifdef USE_TCP_STREAMS
+rx=streamRoom(role);
+if (rx<room) room=rx;
+#endif
+if (room<left+TCP_WINDOW_STEP) return (left);
+rx=(linkRxRoom()/TCP_RX_FRAME)*MAX_PACKET_PAYLOAD;
+if (rx<room) room=rx;
+return ((room<left+TCP_WINDOW_STEP)?left:room);
+}
+// ----------------------------------------------------------------------------
+static uint16_t windowFor(uint8_t role)
+{ // The window we advertise on this connection.  Its right edge never moves 
+  // back (RFC 9293), and on only a step at a time (RFC 1122 SWS avoidance).
+uint16_t window=roomFor(role,windowLeft(role));
+
+TCB[role].windowEdge=TCB[role].lastByteReceived+1+window;
+return (window);
+}
+// ----------------------------------------------------------------------------
+static uint8_t findRole(MergedPacket * Mash)
+{ // The TCB for this segment's 4-tuple, else TCP_REJECT.  A linear scan : there
+  // are only ever a handful, and each test usually fails on the first compare.
+uint8_t i;
+
+for (i=0;i<MAX_TCP_ROLES;i++)
+  if (TCB[i].status>TCP_LISTEN && 
+      TCB[i].localPort ==Mash->TCP.destinationPort &&
+      TCB[i].remotePort==Mash->TCP.sourcePort && // deliberate reversal
+      IP4_match(&TCB[i].remoteIP,&Mash->IP4.source)) return (i);
+
+return (TCP_REJECT);
+}
+// ----------------------------------------------------------------------------
+#ifdef USE_SYN_COOKIES
+#define ROTL32(x,b) (((x)<<(b))|((x)>>(32-(b))))
+static uint32_t cookie(MergedPacket * Mash,uint32_t theirs,uint8_t slot,uint8_t mss)
+{ // The sequence number we'd open with to this SYN's 4-tuple and initial sequence
+  // 'theirs', made in time 'slot' for an MSS of cookieMSS['mss'].  Top 3 bits the 
+  // slot, then 3 the MSS, then 26 of a keyed hash of it all : HalfSipHash-1-3, 
+  // the 32 bit SipHash, small enough for an 8 bit micro.
+uint32_t v[4],m[5];
+uint8_t  i;
+
+v[0]=cookieKey[0];
+v[1]=cookieKey[1];
+v[2]=cookieKey[0]^0x6c796765;
+v[3]=cookieKey[1]^0x74656462;
+
+m[0]=Mash->IP4.source;
+m[1]=((uint32_t)Mash->TCP.sourcePort<<16)|Mash->TCP.destinationPort;
+m[2]=theirs;
+m[3]=((uint32_t)slot<<3)|mss;
+m[4]=(uint32_t)16<<24;  // Length, as the final block
+
+for (i=0;i<5+3;i++) {  // A round for each block, then three to finish
+  if (i<5) v[3]^=m[i];
+  else if (i==5) v[2]^=0xFF;
+  v[0]+=v[1]; v[1]=ROTL32(v[1],5);  v[1]^=v[0]; v[0]=ROTL32(v[0],16);  // SipRound
+  v[2]+=v[3]; v[3]=ROTL32(v[3],8);  v[3]^=v[2];
+  v[0]+=v[3]; v[3]=ROTL32(v[3],7);  v[3]^=v[0];
+  v[2]+=v[1]; v[1]=ROTL32(v[1],13); v[1]^=v[2]; v[2]=ROTL32(v[2],16);
+  if (i<5) v[0]^=m[i];
+}
+return (((uint32_t)(slot&0x07)<<29)|((uint32_t)(mss&0x07)<<26)|((v[1]^v[3])&0x03FFFFFF));
+}
+// ----------------------------------------------------------------------------
+static void cookieSYN_ACK(MergedPacket * Mash)
+{ // Answer a SYN with no TCB to spare : what a TCB would have held is in our 
+  // sequence number (cookie()), for its ACK to bring back (cookieRole())
+uint16_t port=Mash->TCP.sourcePort,mss=peerMSS(Mash);
+uint8_t  i;
+IP4_address ToIP;
+
+copyIP4(&ToIP,&Mash->IP4.source);
+i=7;
+while (i && cookieMSS[i]>mss) i--;  // The most it will take
+
+  Mash->TCP.ack            =Mash->TCP.sequence+1;
+  Mash->TCP.sequence       =cookie(Mash,Mash->TCP.sequence,clockTCP()>>TCP_COOKIE_SLOT,i);
+  Mash->TCP.sourcePort     =Mash->TCP.destinationPort;
+  Mash->TCP.destinationPort=port;
+  Mash->TCP.unused2        =0;
+  Mash->TCP.headerLength   =6;
+  Mash->TCP.flags=(FL_SYN | FL_ACK);
+
+  Mash->TCP.windowSize     =TCP_WINDOW_SYN;
+  Mash->TCP.urgent         =0;
+
+  optionMSS(Mash);
+
+  launchTCP(Mash,0,&ToIP,NULL,0);  // Not resent : their SYN will be, if it's lost
+}
+// ----------------------------------------------------------------------------
+static uint8_t cookieRole(MergedPacket * Mash)
+{ // If this ACK brings back a cookie of ours, still fresh, a server TCB for it : 
+  // free, else taken from a handshake still half open (as a SYN flood leaves 
+  // them).  Else TCP_REJECT.
+int32_t  ours=Mash->TCP.ack-1,theirs=Mash->TCP.sequence-1;
+uint8_t  slot=(uint32_t)ours>>29,i;
+
+if (((uint8_t)(clockTCP()>>TCP_COOKIE_SLOT)-slot)&0x06) return (TCP_REJECT);  // Stale
+if (cookie(Mash,theirs,slot,((uint32_t)ours>>26)&0x07)!=(uint32_t)ours) return (TCP_REJECT);
+
+for (i=TCP_SERVER;i<MAX_TCP_ROLES;i++)
+  if (TCB[i].status==TCP_CLOSED || TCB[i].status==TCP_LISTEN) break;
+if (i==MAX_TCP_ROLES)
+  for (i=TCP_SERVER;i<MAX_TCP_ROLES;i++) if (TCB[i].status==TCP_SYN_RCVD) {
+    cancelAllReTx(&i);
+    break;
+  }
+if (i==MAX_TCP_ROLES) return (TCP_REJECT);  // All busy : their resend may find one
+
+resetHTTPServer(i);
+resetTCB(i);
+useMSS(i,cookieMSS[((uint32_t)ours>>26)&0x07]);
+TCB[i].localPort       =Mash->TCP.destinationPort;
+TCB[i].remotePort      =Mash->TCP.sourcePort;
+copyIP4(&TCB[i].remoteIP,&Mash->IP4.source);
+TCB[i].lastByteSent    =Mash->TCP.ack;
+TCB[i].lastAckReceived =Mash->TCP.ack;
+TCB[i].lastByteReceived=theirs;
+TCB[i].windowEdge      =theirs+1+TCP_WINDOW_SYN;  // As cookieSYN_ACK() offered
+TCB[i].age             =TCP_MAX_AGE;
+TCB[i].status          =TCP_ESTABLISHED;
+#ifdef USE_TCP_STREAMS
+if (streamListening(TCB[i].localPort)) streamAttach(i);
+#endif
+return (i);
+}
+#endif
+// ----------------------------------------------------------------------------
 void handleTCP(MergedPacket * Mash)
 { // Handle a received TCP packet.  Generally treat LISTEN and CLOSED as same thing :
   // We know if we are meant to respond on this port, irrespective of CLOSED/LISTEN
-uint16_t TCP_length,newData;
-uint8_t role,ack,i;
+uint16_t newData;
+uint8_t role,ack,i,now;
 int32_t delta;
 
 MergedACK * Mack;
 
-TCP_length = Mash->IP4.totalLength - 4*Mash->IP4.headerLength; 
-
 // Check TCP checksum, silently reject if necessary
 //if (TCP_Checksum(Mash,TCP_length,&Mash->IP4.source,&Mash->IP4.destination)) return;
 // New method has checked in network layer
@@ -597,29 +1131,30 @@ if ((Mash->TCP.flags & (FL_FIN | FL_SYN | FL_ACK | FL_URG | FL_RST | FL_PSH))==
                        (FL_FIN | FL_SYN | FL_ACK | FL_URG | FL_RST)) return;
 #endif
 // ---------------------------------------------------------------------------
-//  First see if this is a new connection to our server
+// It should match one of our TCB, or else be a new connection to our server
 
-if (Mash->TCP.destinationPort == HTTP_SERVER_PORT)
+role=findRole(Mash);
+
+#ifdef USE_SYN_COOKIES
+if (role==TCP_REJECT && listening(Mash->TCP.destinationPort) &&
+    (Mash->TCP.flags & (FL_SYN | FL_RST | FL_ACK))==FL_ACK)
+  role=cookieRole(Mash);  // Ends a handshake we kept no TCB for?
+#endif
+
+if (role==TCP_REJECT)
 {
-  if (TCB[TCP_SERVER].status==TCP_CLOSED  || TCB[TCP_SERVER].status==TCP_LISTEN) 
-  {   // A new connection and we're ready
-    /* Option : reject all.  Which is what we should do if closed.  Skip this test behaviour for LISTEN
-    Mash->TCP.ack=(Mash->TCP.sequence+1);
-    TCP_RST(Mash,Mash->TCP.destinationPort,Mash->TCP.sourcePort,
-            Mash->IP4.source,TCP_REJECT);
-    return; */
-    if (Mash->TCP.flags & FL_SYN) // Connection initiation
-    {
-	  resetHTTPServer(); // Clean the paramaters
-      TCP_SYN_ACK(Mash, Mash->TCP.destinationPort,Mash->TCP.sourcePort,
-            Mash->IP4.source, TCP_SERVER);
-    }     
-    return; 
-  }
-// ---------------------------------------------------------------------------
-  else if (TCB[TCP_SERVER].localPort !=Mash->TCP.destinationPort ||
-           TCB[TCP_SERVER].remotePort!=Mash->TCP.sourcePort)
-  { // A new connection and we're already busy on another
+  if (!listening(Mash->TCP.destinationPort)) return; // Ignore those that don't match
+  if (!(Mash->TCP.flags & FL_SYN)) return;  // Only a SYN opens a connection
+
+  for (i=TCP_SERVER;i<MAX_TCP_ROLES;i++)  // A free server TCB?
+    if (TCB[i].status==TCP_CLOSED || TCB[i].status==TCP_LISTEN) break;
+
+  if (i==MAX_TCP_ROLES)
+  { // A new connection and we're already busy on all the others
+#ifdef USE_SYN_COOKIES
+    cookieSYN_ACK(Mash);  // Costs no TCB until its ACK comes
+    return;
+#endif
     Mash->TCP.ack=(Mash->TCP.sequence+1);
     TCP_RST(Mash,Mash->TCP.destinationPort,Mash->TCP.sourcePort,
             Mash->IP4.source,TCP_REJECT);
@@ -627,23 +1162,15 @@ if (Mash->TCP.destinationPort == HTTP_SERVER_PORT)
     // N.B. Source/destination reversed in response
     return;
   }
-  // Fall through to normal procedure
-}
-// ---------------------------------------------------------------------------
-// If it's not new, it should match one of our TCB : ignore those that don't
-
-role=MAX_TCP_ROLES+1;
-for (i=0;i<MAX_TCP_ROLES;i++) {
-
-  if ((TCB[i].status!=TCP_CLOSED) && 
-       TCB[i].localPort ==Mash->TCP.destinationPort &&
-       TCB[i].remotePort==Mash->TCP.sourcePort && // deliberate reversal
-       IP4_match(&TCB[i].remoteIP,&Mash->IP4.source))
-    role=i;
+  resetHTTPServer(i); // Clean the paramaters
+  TCP_SYN_ACK(Mash, Mash->TCP.destinationPort,Mash->TCP.sourcePort,
+            Mash->IP4.source,i);
+#ifdef USE_TCP_STREAMS
+  if (streamListening(TCB[i].localPort)) streamAttach(i);
+#endif
+  return; 
 }
 
-if (role == (MAX_TCP_ROLES+1)) return; // failure (But this test is the same as one above for server?)
-
 // Only get to here if it actually matches the extant connection
 
 // ---------------------------------------------------------------------------
@@ -652,13 +1179,23 @@ if (Mash->TCP.flags & FL_RST)
 {
   TCB[role].status=TCP_CLOSED;  
   cancelAllReTx(&role);
+  dropQueued(role);
   return;
 }
 // ---------------------------------------------------------------------------
 if (Mash->TCP.flags & FL_ACK) // In all cases, if ACK field is significant : cancel relevant ReTx
 { 
   delta=Mash->TCP.ack-TCB[role].lastAckReceived;
-  if (delta > 0)  TCB[role].lastAckReceived=Mash->TCP.ack; // update 
+  if (delta >= 0) {  // Not from a stale one
+    TCB[role].windowSize=Mash->TCP.windowSize;
+    TCB[role].unanswered=0;
+  }
+  if (delta > 0) { // update
+    TCB[role].lastAckReceived=Mash->TCP.ack;
+    if (TCB[role].probes && Mash->TCP.ack==TCB[role].lastByteSent+1) 
+      TCB[role].lastByteSent++;  // They took the probe's byte (probeWindow()) : sent after all
+    openCwnd(role,delta);
+  }
   cancelAckdReTx(&role); 
 }
 // ---------------------------------------------------------------------------
@@ -677,8 +1214,8 @@ switch (TCB[role].status)
       if (Mash->TCP.ack==TCB[role].lastByteSent) // ... got it.
       {
         TCB[role].lastAckReceived=Mash->TCP.ack; 
-        TCB[role].lastByteReceived=Mash->TCP.sequence;
-      }
+        TCB[role].lastByteReceived=Mash->TCP.sequence-1;  // Still their SYN : this
+      }                                                   // is their first data
       TCB[role].status=TCP_ESTABLISHED;  // No need to ACK their ACK
     }
     return;
@@ -692,7 +1229,9 @@ switch (TCB[role].status)
       {
         TCB[role].lastAckReceived=Mash->TCP.ack; // initialise
         TCB[role].lastByteReceived=Mash->TCP.sequence;
+        TCB[role].windowEdge=Mash->TCP.sequence+1;  // Nothing offered of theirs yet
       }
+      useMSS(role,peerMSS(Mash));
 
       TCP_ACK(Mash, role);
       TCB[role].status=TCP_ESTABLISHED;
@@ -706,26 +1245,46 @@ switch (TCB[role].status)
     newData=handleMetrics(Mash,&role,&ack);      // Sets last byte received
     uint8_t theirFin=(Mash->TCP.flags & FL_FIN); // Record, 'cos gets overwritten
 
-    if (ack) { // An ACK is required.  Create temp structure 'cos Mash has data > 0
+    if (ack) { // An ACK is required.  Delayed, so that the reply TCP_DataIn() 
+	  // makes can carry it : else it goes alone after TCP_ACK_DELAY (pumpTCP()), 
+	  // or now if a duplicate or out of order, or every TCP_ACK_SEGMENTS (RFC 1122).
 	  // Note if ACK not required, this isn't new data, so we ignore
-      //Mack=malloc(sizeof(MergedACK));
-      Mack=(MergedACK *)buffer; // Use buffer instead
-      //if (Mack) {
-        TCP_ACK((MergedPacket *)Mack,role);
-        //free (Mack);
-      //}
+      if (!TCB[role].ackOwed++) TCB[role].ackDue=clockTCP()+TCP_ACK_DELAY;
+      now=(!newData || theirFin || TCB[role].ackOwed>=TCP_ACK_SEGMENTS);
+
       TCP_DataIn(Mash,newData,role); // Process the data in the packet
+#ifdef USE_TCP_REORDER
+      if (newData && (newData=heldIn(Mash,role))) {  // It filled a gap : what was
+        do TCP_DataIn(Mash,newData,role);            // held beyond follows on
+        while ((newData=heldIn(Mash,role)));
+        now=TRUE;  // So the sender learns at once (RFC 5681)
+      }
+#endif
 
       if (theirFin) {
+#ifdef USE_TCP_STREAMS
+        // A stream is only half closed : the application may yet write its reply,
+        // and closes when done (streamClose()).  The ACK goes below, at once.
+        if (isStream(role)) TCB[role].status=TCP_CLOSE_WAIT;
+        else
+#endif
+        {
       // Notionally skip through TCP_CLOSE_WAIT;  
-        TCP_FIN(Mash,role);
+        TCP_FIN(Mash,role);  // Carries the ACK, unless it waits for data
         TCB[role].status=TCP_LAST_ACK;
+        }
+      }
+      if (TCB[role].ackOwed && now) {  // Create temp structure 'cos Mash has data > 0
+        Mack=(MergedACK *)buffer; // Use buffer instead
+        TCP_ACK((MergedPacket *)Mack,role);
       }
     }
 
     return;
 // ---------------------------------------------------------------------------
-  case (TCP_CLOSE_WAIT): return; // The other side has initiated a release
+  case (TCP_CLOSE_WAIT): // The other side has initiated a release
+    if (Mash->TCP.flags & FL_FIN) TCP_ACK(Mash,role);  // Our ACK of it was lost
+    return;
 // ---------------------------------------------------------------------------
   case (TCP_FIN_WAIT1):  // We have said we are finished
 
@@ -741,7 +1300,7 @@ switch (TCB[role].status)
       TCB[role].status=TCP_CLOSED; // Should really be TIME_WAIT;
       return;
     }
-    if (Mash->TCP.flags & FL_ACK) 
+    if ((Mash->TCP.flags & FL_ACK) && Mash->TCP.ack==TCB[role].lastByteSent) // Of our FIN
       TCB[role].status=TCP_FIN_WAIT2;
 
     return;
@@ -760,12 +1319,42 @@ switch (TCB[role].status)
   case (TCP_TIME_WAIT): return;  // Wait for packets to die off
 // ---------------------------------------------------------------------------
   case (TCP_LAST_ACK):   // Wait for packets to die off
-    if (Mash->TCP.flags & FL_ACK) TCB[role].status=TCP_CLOSED; // Seq no checked above?
+    if ((Mash->TCP.flags & FL_ACK) && !TCB[role].finQueued &&   // Our FIN has gone ...
+        Mash->TCP.ack==TCB[role].lastByteSent) TCB[role].status=TCP_CLOSED; // ... and is ACK'd
     return;
 }
 return;
 }
 // -------------------------------------------------------------------------------
+#ifdef USE_TCP_REORDER
+static uint16_t heldIn(MergedPacket * Mash,uint8_t role)
+{ // Data reorder.c held that now follows on from what we have : as much as Mash 
+  // takes, and a stream's RX ring, dressed as a segment just arrived, for
+  // TCP_DataIn().  Returns its length (0 : none, still a gap, or no room : it 
+  // stays held).
+uint16_t length=sizeof(Mash->TCP_payload);
+
+#ifdef USE_TCP_STREAMS
+if (isStream(role) && streamRoom(role)<length) length=streamRoom(role);
+#endif
+if (length) length=reorderNext(role,TCB[role].lastByteReceived+1,Mash->TCP_payload.bytes,
+                               length);
+if (!length) return (0);
+
+copyIP4(&Mash->IP4.source,&TCB[role].remoteIP);
+Mash->IP4.headerLength  =5;
+Mash->IP4.totalLength   =IP_HEADER_SIZE+TCP_HEADER_SIZE+length;
+Mash->TCP.sourcePort    =TCB[role].remotePort;
+Mash->TCP.destinationPort=TCB[role].localPort;
+Mash->TCP.sequence      =TCB[role].lastByteReceived+1;
+Mash->TCP.headerLength  =5;
+Mash->TCP.flags         =FL_ACK;
+
+TCB[role].lastByteReceived+=length;
+return (length);
+}
+#endif
+// -------------------------------------------------------------------------------
 uint16_t handleMetrics(MergedPacket * Mash, const uint8_t * role, uint8_t * ack)
 { // Returns byte count of NEW data received, i.e. zero if seen already
   // Only call for ESTABLISHED connections, so we have a TCB
@@ -774,18 +1363,49 @@ uint16_t handleMetrics(MergedPacket * Mash, const uint8_t * role, uint8_t * ack)
   // Updates the last ack received & lastByteReceived counter
 
 int32_t lastByte,payloadLength,delta;
+uint8_t trimmed=FALSE;
 
 delta=Mash->TCP.sequence-TCB[*role].lastByteReceived;
+payloadLength=Mash->IP4.totalLength-(Mash->IP4.headerLength+Mash->TCP.headerLength)*4;
+
 if (delta>1) { // Enforce in order delivery
+#ifdef USE_TCP_REORDER
+  // ... but hold what's beyond the gap (not a FIN) for when it fills (heldIn()).
+  // The ACK, a duplicate, tells the sender what's missing.
+  // Only what's within the window we advertised, which a stream's RX ring
+  // could take too.
+  *ack=FALSE;
+  if (!(Mash->TCP.flags & FL_FIN)) {
+    uint16_t room=windowLeft(*role);
+#ifdef USE_TCP_STREAMS
+    if (isStream(*role) && streamRoom(*role)<room) room=streamRoom(*role);
+#endif
+    linkReadRandomAccess(ETH_HEADER_SIZE+(Mash->IP4.headerLength+Mash->TCP.headerLength)*4);
+    *ack=reorderHold(*role,TCB[*role].lastByteReceived+1,Mash->TCP.sequence,payloadLength,
+                     room,Mash->TCP_payload.bytes,sizeof(Mash->TCP_payload));
+  }
+#else
   *ack=FALSE;
+#endif
   return 0;
 }
-payloadLength=Mash->IP4.totalLength-(Mash->IP4.headerLength+Mash->TCP.headerLength)*4;
 
+#ifdef USE_TCP_STREAMS
+// A stream takes no more than its RX ring has room for (what we advertised).
+// The rest, and any FIN after it, the peer sends again : a probe of a zero
+// window, say, which is ACK'd so that it learns the window.
+delta=TCB[*role].lastByteReceived+1+streamRoom(*role)-Mash->TCP.sequence;
+if (isStream(*role) && payloadLength>delta) {
+  Mash->IP4.totalLength-=payloadLength-delta;
+  Mash->TCP.flags&=~FL_FIN;
+  payloadLength=delta;
+  trimmed=TRUE;
+}
+#endif
 lastByte=Mash->TCP.sequence+payloadLength-1+((Mash->TCP.flags & FL_FIN)?1:0);  // FIN takes a byte
 
 // Don't ack packets that are zero length, but ACK FINs (N.B. SYNs handled elsewhere)
-*ack=(payloadLength!=0 || (Mash->TCP.flags & FL_FIN));
+*ack=(payloadLength!=0 || (Mash->TCP.flags & FL_FIN) || trimmed);
 
 delta=lastByte-TCB[*role].lastByteReceived;
 
@@ -805,6 +1425,19 @@ void TCP_Endianism(MergedPacket * Mash)
    Mash->TCP.windowSize=BYTESWAP16(Mash->TCP.windowSize);
    Mash->TCP.urgent=BYTESWAP16(Mash->TCP.urgent);
 }
+// ----------------------------------------------------------------------------
+uint8_t TCP_Wanted(uint16_t destinationPort)
+{ // Would handleTCP() act on a segment to this port (host order)?  Lets the
+  // link layer drop the rest unread.  The ports we listen on always qualify, 
+  // as handleTCP() may need to answer a caller beyond the pool.
+uint8_t i;
+
+if (listening(destinationPort)) return (TRUE);
+for (i=0;i<MAX_TCP_ROLES;i++)
+  if (TCB[i].status!=TCP_CLOSED && TCB[i].localPort==destinationPort) return (TRUE);
+
+return (FALSE);
+}
 #endif  // End of TCP specific
 // ----------------------------------------------------------------------------
 /*static uint16_t UDP_Checksum(MergedPacket * Mash,IP4_address * FromIP, IP4_address * ToIP) 
@@ -874,85 +1507,97 @@ if (!Mash->UDP.UDP_checksum) // Special case for UDP : csum = 0 => not set => OK
 */
 UDP_Endianism(&Mash->UDP);
 
-// Send to correct handling routine (on basis of ports)
-// Time first, it is time critical, after all!
-#ifdef USE_NTP
-if  (Mash->UDP.destinationPort ==UDP_Port[NTP_CLIENT_PORT_REF] && 
-     Mash->UDP.sourcePort      ==NTP_SERVER_PORT)   handleNTP(&Mash->NTP);  
-else 
-#endif
-#ifdef USE_DHCP
-// Test now baked into CS_DHCP
-//      if  (Mash->UDP.destinationPort ==DHCP_CLIENT_PORT &&  // DHCP client is a constant 
-//           Mash->UDP.sourcePort      ==DHCP_SERVER_PORT)
-  if (flags & CS_DHCP)           handleDHCP(&Mash->DHCP);  
-	else
-#endif
-#ifdef USE_DNS
-  if  (Mash->UDP.destinationPort ==UDP_Port[DNS_CLIENT_PORT_REF] &&
-       Mash->UDP.sourcePort      ==DNS_SERVER_PORT)   handleDNS(&Mash->DNS);  
-#endif
-
-#ifdef USE_mDNS 
-// Check PORT, MAC and IP match ??? Or allow unicast 
-  if  (Mash->UDP.destinationPort ==mDNS_PORT && 
-       Mash->UDP.sourcePort      ==mDNS_PORT && 
-       MACForUs(&MashE.Ethernet.destinationMAC) == mDNS_MULTICAST &&
-       mDNS(&Mash->IP4.destination))
-    handleMDNS(Mash);  
-#endif
-
-#ifdef USE_LLMNR
-// Check PORT, MAC and IP match
-  if  (Mash->UDP.destinationPort ==LLMNR_PORT && 
-       MACForUs(&MashE.Ethernet.destinationMAC) == LLMNR_MULTICAST &&
-       LLMNR(&Mash->IP4.destination))
-    handleLLMNR(Mash);  
-#endif
-#ifdef POWER_METER // Message format is "POWER n" here n is an ASCII digit 0,1,2 etc
-  if (Mash->UDP.destinationPort ==POWER_MY_PORT && 
-	    Mash->UDP_payload.words[0] ==BYTESWAP16(0x504F) && // "PO"
-	    Mash->UDP_payload.words[1] ==BYTESWAP16(0x5745))   // "WE" 
-      {
-        handlePower((Mash->UDP_payload.bytes[6]-0x30));  
-// Test correct port, and msg begins "POWE" then convert n to 0-2 by subtracting ASCII "0"
-
-/*
-for (uint8_t i=0;i<4;i++) { // TODO TEST
-  LEDON;
-  delay_ms(200);
-  LEDOFF;
-  delay_ms(200);
-}*/
-
-      }
-
+// Send to the handler bound to the port : see udpBind().  Handlers check
+// anything else they need (source port, multicast address, content).
+UDP_binding * bound=udpFind(Mash->UDP.destinationPort);
 
-#endif
-
-#ifdef WHEREABOUTS // Message format is "G=nnR=nnF=nn" here n is an ASCII digit 0,1,2 etc
-// Not overly fussy - don't bother matching the port we sent from (Firewall will enforce for external)
-  if  (Mash->UDP.sourcePort == WHEREABOUTS_SERVER_PORT && 
-	  Mash->UDP_payload.bytes[0] =='G' &&
-	  Mash->UDP_payload.bytes[4] =='R' &&
-	  Mash->UDP_payload.bytes[8] =='F' ) {
-	    gis=(10*(Mash->UDP_payload.bytes[2] -'0')+(Mash->UDP_payload.bytes[3] -'0'))%12;  // %12 for safety  
-	    ris=(10*(Mash->UDP_payload.bytes[6] -'0')+(Mash->UDP_payload.bytes[7] -'0'))%12;  // %12 for safety  
-	    fis=(10*(Mash->UDP_payload.bytes[10]-'0')+(Mash->UDP_payload.bytes[11]-'0'))%12;  // %12 for safety  
-        if (lastMode==MODE_WEB) lastMode=MODE_WEB_UPDATE;  // Force a refresh
-  }
-#endif
+if (bound)               bound->handler(Mash,flags);
+else if (UDP_anyHandler) UDP_anyHandler(Mash,flags);
 
 // Should reply with ICMP for unknown ports, choose instead to be stealthy.
 return;
 }
 // ----------------------------------------------------------------------------
+uint8_t UDP_Wanted(uint16_t destinationPort,uint16_t sourcePort)
+{ // Would handleUDP() act on a datagram between these ports (host order)?  
+  // Lets the link layer drop the rest unread.
+return (udpFind(destinationPort) || UDP_anyHandler);
+}
+// ----------------------------------------------------------------------------
+static uint8_t udpSlot(uint16_t port)
+{ // Home slot for 'port' in UDP_bound[].  Well known ports are small, dynamic
+  // ones sequential : both bytes count.
+return ((port^(port>>8))&(UDP_BINDINGS-1));
+}
+// ----------------------------------------------------------------------------
+static UDP_binding * udpFind(uint16_t port)
+{ // The binding for 'port', or NULL.  Linear probe from the home slot : chains
+  // have no gaps (see udpUnbind()), so the first free slot ends the search.
+  // Port 0 marks a free slot, so is never bound.
+uint8_t i=udpSlot(port),n;
+
+if (port==UDP_ANY_PORT) return (NULL);
+for (n=0;n<UDP_BINDINGS;n++) {
+  if (UDP_bound[i].port==port) return (&UDP_bound[i]);
+  if (!UDP_bound[i].port) break;
+  i=(i+1)&(UDP_BINDINGS-1);
+}
+return (NULL);
+}
+// ----------------------------------------------------------------------------
+uint8_t udpBind(uint16_t port,UDP_handler handler)
+{ // Datagrams to 'port' (host order) go to 'handler', from now on.  Binding a
+  // bound port replaces its handler.  UDP_ANY_PORT : the handler for datagrams
+  // to no bound port (NULL : none).  Returns FALSE if the table (UDP_BINDINGS)
+  // is full.
+uint8_t i=udpSlot(port),n;
+
+if (port==UDP_ANY_PORT) {
+  UDP_anyHandler=handler;
+  return (TRUE);
+}
+for (n=0;n<UDP_BINDINGS;n++) {
+  if (!UDP_bound[i].port || UDP_bound[i].port==port) {
+    UDP_bound[i].handler=handler;
+    UDP_bound[i].port=port;
+    return (TRUE);
+  }
+  i=(i+1)&(UDP_BINDINGS-1);
+}
+return (FALSE);
+}
+// ----------------------------------------------------------------------------
+void udpUnbind(uint16_t port)
+{ // Datagrams to 'port' are no longer wanted.  Later entries in the probe
+  // chain move back into the gap, so lookups never meet a false end.
+  // UDP_ANY_PORT does nothing : a client's port not yet chosen is 0 too, and
+  // must not take the any port handler with it.  See udpBind() for that.
+UDP_binding * bound=udpFind(port);
+uint8_t i,j,n,home;
+
+if (!bound) return;
+
+i=j=bound-UDP_bound;
+for (n=1;n<UDP_BINDINGS;n++) {
+  j=(j+1)&(UDP_BINDINGS-1);
+  if (!UDP_bound[j].port) break;
+  home=udpSlot(UDP_bound[j].port);
+  // Stays put if its home is (cyclically) after the gap, up to where it is
+  if ((i<j)?(home>i && home<=j):(home>i || home<=j)) continue;
+  UDP_bound[i]=UDP_bound[j];
+  i=j;
+}
+UDP_bound[i].port=0;
+}
+// ----------------------------------------------------------------------------
 uint16_t newPort( uint8_t protocol)
 { // Finds a port for TCP or UDP See http://www.iana.org/assignments/port-numbers
 // Avoid using recent port by incrementing the port and avoiding existing.
 
-uint8_t pass,i;
 uint16_t port;
+#ifdef USE_TCP
+uint8_t i;
+#endif
 
 switch (protocol)
 {
@@ -960,13 +1605,7 @@ switch (protocol)
     do
     {
       if (++UDP_low_port < START_DYNAMIC_PORTS) UDP_low_port = START_DYNAMIC_PORTS;
-
-      pass=TRUE;
-      for (i=0;i<MAX_UDP_PORTS;i++)
-        if (UDP_low_port == UDP_Port[i]) pass=FALSE;
-        // Does look at uninitialised bit of array, don't care if avoids a random port
-
-    } while (!pass);  // This is a port we are using already
+    } while (udpFind(UDP_low_port));  // This is a port we are using already
 
 #ifdef USE_EEPROM
     //TODO eeprom_write_word((uint16_t *)EEPROM_UDP_PORT,UDP_low_port);
@@ -977,11 +1616,12 @@ switch (protocol)
 
 #ifdef USE_TCP  
   case (TCP_PORT):
-    port=TCB[TCP_CLIENT].localPort;  // One of the two - doesn't matter [TODO now more than two]
+    port=TCB[TCP_CLIENT].localPort;  // Any of them - doesn't matter
     do
     {
       if (++port < (uint16_t)START_DYNAMIC_PORTS) port = START_DYNAMIC_PORTS;
-    } while (port == TCB[TCP_CLIENT].localPort || port == TCB[TCP_SERVER].localPort);
+      for (i=0;i<MAX_TCP_ROLES;i++) if (port == TCB[i].localPort) break;
+    } while (i<MAX_TCP_ROLES);  // This is a port we are using already
 
 #ifdef USE_EEPROM
     // TODO  eeprom_write_word((uint16_t *)EEPROM_TCP_PORT,port); 
@@ -27,6 +27,8 @@ extern volatile uint8_t timecount;
 
 extern uint8_t rpos;
 extern uint8_t lpos;
+extern uint8_t gis,ris,fis;  // Locations of G & R (0-11)
+extern uint8_t lastMode;
 volatile extern uint8_t timecount;
 
 #define PATTERN(x) ((1<<(x>>1))|(1<<(((x+1)%8)>>1)))
@@ -43,6 +45,21 @@ volatile extern uint8_t timecount;
 #define S_ACTIVATE    (PORTD&=(~(1<<0))) // Seconds
 #define S_DEACTIVATE  (PORTD|=  (1<<0))
 
+// -----------------------------------------------------------------------------
+static void udpWhereabouts(MergedPacket * Mash,uint8_t flags)
+{ // Bound to UDP_ANY_PORT.  Message format is "G=nnR=nnF=nn" here n is an ASCII
+  // digit 0,1,2 etc.  Not overly fussy - don't bother matching the port we sent
+  // from (Firewall will enforce for external)
+if  (Mash->UDP.sourcePort == WHEREABOUTS_SERVER_PORT && 
+     Mash->UDP_payload.bytes[0] =='G' &&
+     Mash->UDP_payload.bytes[4] =='R' &&
+     Mash->UDP_payload.bytes[8] =='F' ) {
+  gis=(10*(Mash->UDP_payload.bytes[2] -'0')+(Mash->UDP_payload.bytes[3] -'0'))%12;  // %12 for safety  
+  ris=(10*(Mash->UDP_payload.bytes[6] -'0')+(Mash->UDP_payload.bytes[7] -'0'))%12;  // %12 for safety  
+  fis=(10*(Mash->UDP_payload.bytes[10]-'0')+(Mash->UDP_payload.bytes[11]-'0'))%12;  // %12 for safety  
+  if (lastMode==MODE_WEB) lastMode=MODE_WEB_UPDATE;  // Force a refresh
+}
+}
 // -----------------------------------------------------------------------------
 void InitWhereabouts() {
 
@@ -93,6 +110,7 @@ setClockout12pt5MHz();
 delay_ms(10);
 //enc28j60powerUp();
 #endif
+udpBind(UDP_ANY_PORT,udpWhereabouts);
 
 if (!SWITCHED_OFF) {
 